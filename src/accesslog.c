@@ -0,0 +1,257 @@
+/*
+ * accesslog.c
+ * Queues access log records in a ring and writes them out from a separate
+ *    thread in large batches. Functions are prototyped in accesslog.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "accesslog.h"
+#include "util.h"
+
+/* How long the flusher sleeps when there is nothing to write, in ns */
+#define FLUSH_INTERVAL 20000000
+
+/* How long a blocked worker waits for the flusher to make room, in ns */
+#define FULL_WAIT 100000
+
+/*
+ * Sleeps for a number of nanoseconds, under a second.
+ * Params:
+ *    long nanoseconds: How long to sleep
+ */
+static void pause_for(long nanoseconds) {
+
+   struct timespec delay;
+
+   delay.tv_sec = 0;
+   delay.tv_nsec = nanoseconds;
+   nanosleep(&delay, NULL);
+
+}
+
+/*
+ * Opens the file of a log for appending.
+ * Params:
+ *    const char *path: The file to open
+ * Returns:
+ *    int fd: The open file or -1 on error
+ */
+static int open_log_file(const char *path) {
+
+   return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+}
+
+/*
+ * Replaces the file of a log with a freshly opened one of the same name,
+ *    keeping the descriptor number.
+ * Params:
+ *    struct access_log *log: The log to reopen
+ */
+static void reopen_log_file(struct access_log *log) {
+
+   int fd;
+
+   if (log->path == NULL) {
+      return;
+   }
+
+   if ((fd = open_log_file(log->path)) < 0) {
+      perror("access log reopen failed");
+      return;
+   }
+
+   dup2(fd, log->fd);
+   close(fd);
+
+}
+
+/*
+ * Writes out everything queued in a log, until it is closed.
+ * Params:
+ *    void *arg: The log to flush
+ * Returns:
+ *    void *result: Always NULL
+ */
+static void *flush_forever(void *arg) {
+
+   struct access_log *log = arg;
+   struct iovec iov[2];
+   unsigned long head;
+   size_t start, len;
+   ssize_t written;
+   int count;
+
+   while (1) {
+
+      if (log->reopen) {
+         log->reopen = 0;
+         reopen_log_file(log);
+      }
+
+      /* Everything up to head was fully copied in by the worker */
+      head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+      if (head == log->tail) {
+         if (__atomic_load_n(&log->closing, __ATOMIC_ACQUIRE)) {
+            return NULL;
+         }
+         pause_for(FLUSH_INTERVAL);
+         continue;
+      }
+
+      /* The queued bytes may wrap around the end of the ring */
+      start = log->tail & (log->size - 1);
+      len = head - log->tail;
+      iov[0].iov_base = log->ring + start;
+      iov[0].iov_len = start + len > log->size ? log->size - start : len;
+      iov[1].iov_base = log->ring;
+      iov[1].iov_len = len - iov[0].iov_len;
+      count = iov[1].iov_len > 0 ? 2 : 1;
+
+      written = writev(log->fd, iov, count);
+
+      /* Records that can't be written are lost rather than retried forever */
+      if (written < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         written = len;
+      }
+
+      __atomic_store_n(&log->tail, log->tail + written, __ATOMIC_RELEASE);
+
+   }
+
+}
+
+/*
+ * Opens an access log and starts the thread that writes it out.
+ * Params:
+ *    const char *path: The file to append records to, NULL for stdout
+ *    size_t size: The size of the ring in bytes, a power of two
+ *    int policy: LOG_FULL_DROP or LOG_FULL_BLOCK
+ * Returns:
+ *    struct access_log *log: The new log
+ */
+struct access_log *open_access_log(const char *path, size_t size,
+   int policy) {
+
+   struct access_log *log = malloc(sizeof(struct access_log));
+   memset(log, 0, sizeof(struct access_log));
+
+   log->ring = malloc(size);
+   log->size = size;
+   log->policy = policy;
+   log->path = path;
+
+   if (path == NULL) {
+      log->fd = STDOUT_FILENO;
+   }
+   else if ((log->fd = open_log_file(path)) < 0) {
+      report_errno();
+   }
+
+   if ((errno = pthread_create(&log->flusher, NULL, flush_forever, log))) {
+      report_errno();
+   }
+
+   return log;
+
+}
+
+/*
+ * Appends a record to the log without waiting for it to be written.
+ * Params:
+ *    struct access_log *log: The log to append to
+ *    const char *record: The formatted record, including its newline
+ *    size_t len: The length of the record
+ * Returns:
+ *    int result: 1 if the record was queued, 0 if it was dropped
+ */
+int access_log_write(struct access_log *log, const char *record, size_t len) {
+
+   size_t start = log->head & (log->size - 1), first;
+
+   if (len > log->size) {
+      return 0;
+   }
+
+   /* Only the flusher frees space, wait for it or give up */
+   while (log->size - (log->head -
+      __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE)) < len) {
+      if (log->policy != LOG_FULL_BLOCK) {
+         return 0;
+      }
+      pause_for(FULL_WAIT);
+   }
+
+   first = start + len > log->size ? log->size - start : len;
+   memcpy(log->ring + start, record, first);
+   memcpy(log->ring, record + first, len - first);
+
+   /* Publish the record only once all of it is in the ring */
+   __atomic_store_n(&log->head, log->head + len, __ATOMIC_RELEASE);
+   return 1;
+
+}
+
+/*
+ * Asks the flusher to reopen the log file, after it was rotated. Safe to
+ *    call from a signal handler.
+ * Params:
+ *    struct access_log *log: The log to reopen
+ */
+void access_log_reopen(struct access_log *log) {
+
+   log->reopen = 1;
+
+}
+
+/*
+ * Writes out every record still queued, stops the flusher and frees a log.
+ * Params:
+ *    struct access_log *log: The log to close
+ */
+void close_access_log(struct access_log *log) {
+
+   /* The flusher only stops once it finds the ring empty */
+   __atomic_store_n(&log->closing, 1, __ATOMIC_RELEASE);
+   pthread_join(log->flusher, NULL);
+
+   if (log->fd != STDOUT_FILENO) {
+      close(log->fd);
+   }
+
+   free(log->ring);
+   free(log);
+
+}
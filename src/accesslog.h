@@ -0,0 +1,91 @@
+/*
+ * accesslog.h
+ * Makes available the buffered access log of a worker.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+
+/* What to do with a record that doesn't fit in a full ring */
+#define LOG_FULL_DROP  0
+#define LOG_FULL_BLOCK 1
+
+/*
+ * Records are appended to a ring by the worker and written out in batches by
+ *    a flusher thread. The worker only moves head and the flusher only moves
+ *    tail, both count bytes ever passed through, so no lock is needed.
+ */
+struct access_log {
+   char *ring;
+   size_t size;
+   unsigned long head, tail;
+   int fd, policy;
+   const char *path;
+   volatile sig_atomic_t reopen;
+   int closing;
+   pthread_t flusher;
+};
+
+/*
+ * Opens an access log and starts the thread that writes it out.
+ * Params:
+ *    const char *path: The file to append records to, NULL for stdout
+ *    size_t size: The size of the ring in bytes, a power of two
+ *    int policy: LOG_FULL_DROP or LOG_FULL_BLOCK
+ * Returns:
+ *    struct access_log *log: The new log
+ */
+struct access_log *open_access_log(const char *, size_t, int);
+
+/*
+ * Appends a record to the log without waiting for it to be written.
+ * Params:
+ *    struct access_log *log: The log to append to
+ *    const char *record: The formatted record, including its newline
+ *    size_t len: The length of the record
+ * Returns:
+ *    int result: 1 if the record was queued, 0 if it was dropped
+ */
+int access_log_write(struct access_log *, const char *, size_t);
+
+/*
+ * Asks the flusher to reopen the log file, after it was rotated. Safe to
+ *    call from a signal handler.
+ * Params:
+ *    struct access_log *log: The log to reopen
+ */
+void access_log_reopen(struct access_log *);
+
+/*
+ * Writes out every record still queued, stops the flusher and frees a log.
+ * Params:
+ *    struct access_log *log: The log to close
+ */
+void close_access_log(struct access_log *);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * arena.c
+ * A bump-pointer allocator, so everything a request needs is released in one
+ *    step once its response is sent. Functions are prototyped in arena.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "util.h"
+
+/* Every allocation is aligned for any type */
+#define ARENA_ALIGNMENT 16
+#define ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+#define BLOCK_HEADER_LEN ALIGN(sizeof(struct arena_block))
+
+/*
+ * Allocates a new block and makes it the one memory is taken from.
+ * Params:
+ *    struct arena *arena: The arena to add the block to
+ *    size_t size: The usable size of the block
+ */
+static void add_block(struct arena *arena, size_t size) {
+
+   struct arena_block *block = malloc(BLOCK_HEADER_LEN + size);
+
+   block->prev = arena->current;
+   block->size = size;
+   block->used = 0;
+   arena->current = block;
+   arena->allocated += BLOCK_HEADER_LEN + size;
+
+}
+
+/*
+ * Prepares an arena, allocating its first block.
+ * Params:
+ *    struct arena *arena: The arena to be initialized
+ *    size_t block_size: The usual size of the blocks memory is taken from
+ */
+void init_arena(struct arena *arena, size_t block_size) {
+
+   arena->current = NULL;
+   arena->block_size = ALIGN(block_size);
+   arena->allocated = 0;
+   add_block(arena, arena->block_size);
+
+}
+
+/*
+ * Frees every block of an arena.
+ * Params:
+ *    struct arena *arena: The arena to be freed
+ */
+void free_arena(struct arena *arena) {
+
+   struct arena_block *prev;
+
+   while (arena->current != NULL) {
+      prev = arena->current->prev;
+      free(arena->current);
+      arena->current = prev;
+   }
+
+   arena->allocated = 0;
+
+}
+
+/*
+ * Allocates suitably aligned memory from an arena.
+ * Params:
+ *    struct arena *arena: The arena to allocate from
+ *    size_t size: The number of bytes needed
+ * Returns:
+ *    void *ptr: The memory, valid until the arena is reset
+ */
+void *arena_alloc(struct arena *arena, size_t size) {
+
+   struct arena_block *block = arena->current;
+   void *ptr;
+
+   size = ALIGN(size);
+
+   /* Current block is full, oversized requests get a block of their own */
+   if (block->size - block->used < size) {
+      add_block(arena, size > arena->block_size ? size : arena->block_size);
+      block = arena->current;
+   }
+
+   ptr = (char *) block + BLOCK_HEADER_LEN + block->used;
+   block->used += size;
+   return ptr;
+
+}
+
+/*
+ * Copies a string of known length into an arena as a c-style string.
+ * Params:
+ *    struct arena *arena: The arena to allocate from
+ *    const char *src: The characters to copy
+ *    size_t len: The number of characters to copy
+ * Returns:
+ *    char *result: The '\0' terminated copy
+ */
+char *arena_strndup(struct arena *arena, const char *src, size_t len) {
+
+   char *result = arena_alloc(arena, len + 1);
+
+   memcpy(result, src, len);
+   result[len] = '\0';
+   return result;
+
+}
+
+/*
+ * Remembers the current position of an arena.
+ * Params:
+ *    struct arena *arena: The arena to mark
+ *    struct arena_mark *mark: Filled with the current position
+ */
+void arena_mark(struct arena *arena, struct arena_mark *mark) {
+
+   mark->block = arena->current;
+   mark->used = arena->current->used;
+
+}
+
+/*
+ * Releases everything allocated since a mark was taken.
+ * Params:
+ *    struct arena *arena: The arena to roll back
+ *    struct arena_mark *mark: The position to roll back to
+ */
+void arena_rewind(struct arena *arena, struct arena_mark *mark) {
+
+   struct arena_block *prev;
+
+   while (arena->current != mark->block) {
+      prev = arena->current->prev;
+      arena->allocated -= BLOCK_HEADER_LEN + arena->current->size;
+      free(arena->current);
+      arena->current = prev;
+   }
+
+   arena->current->used = mark->used;
+
+}
+
+/*
+ * Releases everything allocated from an arena at once, keeping its first
+ *    block for reuse.
+ * Params:
+ *    struct arena *arena: The arena to reset
+ */
+void arena_reset(struct arena *arena) {
+
+   struct arena_block *prev;
+
+   while (arena->current->prev != NULL) {
+      prev = arena->current->prev;
+      arena->allocated -= BLOCK_HEADER_LEN + arena->current->size;
+      free(arena->current);
+      arena->current = prev;
+   }
+
+   arena->current->used = 0;
+
+}
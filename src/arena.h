@@ -0,0 +1,116 @@
+/*
+ * arena.h
+ * Makes available the bump allocator used for per-request memory.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <sys/types.h>
+
+struct arena_block {
+   struct arena_block *prev;
+   size_t size, used;
+};
+
+/*
+ * Hands out memory from a chain of blocks, all released together by
+ *    arena_reset rather than one allocation at a time. Allocated counts the
+ *    bytes its blocks take up.
+ */
+struct arena {
+   struct arena_block *current;
+   size_t block_size, allocated;
+};
+
+/*
+ * A position in an arena that later allocations can be rolled back to.
+ */
+struct arena_mark {
+   struct arena_block *block;
+   size_t used;
+};
+
+/*
+ * Prepares an arena, allocating its first block.
+ * Params:
+ *    struct arena *arena: The arena to be initialized
+ *    size_t block_size: The usual size of the blocks memory is taken from
+ */
+void init_arena(struct arena *, size_t);
+
+/*
+ * Frees every block of an arena.
+ * Params:
+ *    struct arena *arena: The arena to be freed
+ */
+void free_arena(struct arena *);
+
+/*
+ * Allocates suitably aligned memory from an arena.
+ * Params:
+ *    struct arena *arena: The arena to allocate from
+ *    size_t size: The number of bytes needed
+ * Returns:
+ *    void *ptr: The memory, valid until the arena is reset
+ */
+void *arena_alloc(struct arena *, size_t);
+
+/*
+ * Copies a string of known length into an arena as a c-style string.
+ * Params:
+ *    struct arena *arena: The arena to allocate from
+ *    const char *src: The characters to copy
+ *    size_t len: The number of characters to copy
+ * Returns:
+ *    char *result: The '\0' terminated copy
+ */
+char *arena_strndup(struct arena *, const char *, size_t);
+
+/*
+ * Remembers the current position of an arena.
+ * Params:
+ *    struct arena *arena: The arena to mark
+ *    struct arena_mark *mark: Filled with the current position
+ */
+void arena_mark(struct arena *, struct arena_mark *);
+
+/*
+ * Releases everything allocated since a mark was taken.
+ * Params:
+ *    struct arena *arena: The arena to roll back
+ *    struct arena_mark *mark: The position to roll back to
+ */
+void arena_rewind(struct arena *, struct arena_mark *);
+
+/*
+ * Releases everything allocated from an arena at once, keeping its first
+ *    block for reuse.
+ * Params:
+ *    struct arena *arena: The arena to reset
+ */
+void arena_reset(struct arena *);
+
+#endif
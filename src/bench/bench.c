@@ -0,0 +1,81 @@
+/*
+ * bench.c
+ * Timing and reporting shared by the benchmarks. Prototyped in bench.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+static const char *browser_request[] = {
+   "GET /index.html HTTP/1.1\r\n",
+   "Host: localhost:8000\r\n",
+   "Connection: keep-alive\r\n",
+   "Cache-Control: max-age=0\r\n",
+   "Upgrade-Insecure-Requests: 1\r\n",
+   "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+      "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n",
+   "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+      "image/avif,image/webp,image/apng,*/*;q=0.8\r\n",
+   "Sec-Fetch-Site: none\r\n",
+   "Sec-Fetch-Mode: navigate\r\n",
+   "Sec-Fetch-User: ?1\r\n",
+   "Sec-Fetch-Dest: document\r\n",
+   "Accept-Encoding: gzip, deflate, br\r\n",
+   "Accept-Language: en-US,en;q=0.9\r\n",
+   "Cookie: session=5f2b1c9e8d7a6b5c4d3e2f1a0b9c8d7e; theme=dark\r\n",
+   "\r\n"
+};
+
+/*
+ * Reads the monotonic clock.
+ * Returns:
+ *    double now: The current time in nanoseconds
+ */
+double bench_now() {
+
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return now.tv_sec * 1e9 + now.tv_nsec;
+
+}
+
+/*
+ * Prints one measurement as a JSON line.
+ * Params:
+ *    const char *name: The benchmark that was run
+ *    const char *metric: What was measured, e.g. ns_per_op
+ *    double value: The measurement
+ */
+void bench_report(const char *name, const char *metric, double value) {
+
+   printf("{\"name\": \"%s\", \"metric\": \"%s\", \"value\": %.3f}\n", name,
+      metric, value);
+   fflush(stdout);
+
+}
+
+/*
+ * Builds the request head a current desktop browser sends for a page.
+ * Params:
+ *    size_t *len: Filled with the length of the request
+ * Returns:
+ *    char *request: The request, in static storage
+ */
+char *bench_browser_request(size_t *len) {
+
+   static char request[1024];
+   size_t index;
+
+   request[0] = '\0';
+   for (index = 0; index < sizeof(browser_request) / sizeof(char *); index++) {
+      strcat(request, browser_request[index]);
+   }
+
+   *len = strlen(request);
+   return request;
+
+}
@@ -0,0 +1,37 @@
+/*
+ * bench.h
+ * Timing and reporting shared by the benchmarks. Every result is printed as
+ *    one JSON object per line so runs can be collected and compared.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <time.h>
+
+/*
+ * Reads the monotonic clock.
+ * Returns:
+ *    double now: The current time in nanoseconds
+ */
+double bench_now();
+
+/*
+ * Prints one measurement as a JSON line.
+ * Params:
+ *    const char *name: The benchmark that was run
+ *    const char *metric: What was measured, e.g. ns_per_op
+ *    double value: The measurement
+ */
+void bench_report(const char *, const char *, double);
+
+/*
+ * Builds the request head a current desktop browser sends for a page.
+ * Params:
+ *    size_t *len: Filled with the length of the request
+ * Returns:
+ *    char *request: The request, in static storage
+ */
+char *bench_browser_request(size_t *);
+
+#endif
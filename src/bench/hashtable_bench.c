@@ -0,0 +1,85 @@
+/*
+ * hashtable_bench.c
+ * Compares the open addressing hash table against the implementation it
+ *    replaced, on the headers of a typical browser request. Each result is
+ *    the time to set every header and perform the lookups of one request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../arena.h"
+#include "../hashtable.h"
+#include "bench.h"
+#include "legacy_hashtable.h"
+
+#define ITERATIONS 200000
+
+static char *header_names[] = {
+   "Host", "Connection", "Cache-Control", "Upgrade-Insecure-Requests",
+   "User-Agent", "Accept", "Sec-Fetch-Site", "Sec-Fetch-Mode",
+   "Sec-Fetch-Dest", "Accept-Encoding", "Accept-Language", "Cookie"
+};
+
+static char *header_value = "text/html,application/xhtml+xml,*/*;q=0.8";
+
+/* What handle_request looks up on every request, hits and misses alike */
+static char *lookups[] = {
+   "Connection", "Content-Length", "Transfer-Encoding", "Accept-Encoding",
+   "If-None-Match"
+};
+
+#define NUM_HEADERS (sizeof(header_names) / sizeof(header_names[0]))
+#define NUM_LOOKUPS (sizeof(lookups) / sizeof(lookups[0]))
+
+static double bench_legacy() {
+   struct legacy_hashtable *table;
+   unsigned iteration, index, found = 0;
+   double start = bench_now();
+   for (iteration = 0; iteration < ITERATIONS; iteration++) {
+      table = legacy_create_hashtable();
+      for (index = 0; index < NUM_HEADERS; index++) {
+         legacy_set(table, header_names[index], header_value,
+            strlen(header_value) + 1);
+      }
+      for (index = 0; index < NUM_LOOKUPS; index++) {
+         found += legacy_get(table, lookups[index]) != NULL;
+      }
+      legacy_free_hashtable(table);
+   }
+   return found > 0 ? (bench_now() - start) / ITERATIONS : 0;
+}
+
+static double bench_current(struct arena *arena) {
+   struct hashtable *table;
+   unsigned iteration, index, found = 0;
+   double start = bench_now();
+   for (iteration = 0; iteration < ITERATIONS; iteration++) {
+      table = create_hashtable_in(arena, HASHTABLE_CASELESS);
+      for (index = 0; index < NUM_HEADERS; index++) {
+         set(table, header_names[index], header_value,
+            strlen(header_value) + 1);
+      }
+      for (index = 0; index < NUM_LOOKUPS; index++) {
+         found += get(table, lookups[index]) != NULL;
+      }
+      if (arena != NULL) {
+         arena_reset(arena);
+      }
+      else {
+         free_hashtable(table);
+      }
+   }
+   return found > 0 ? (bench_now() - start) / ITERATIONS : 0;
+}
+
+int main(int argc, char *argv[]) {
+   struct arena arena;
+   init_arena(&arena, 4096);
+   bench_report("hashtable/legacy", "ns_per_request", bench_legacy());
+   bench_report("hashtable/malloc", "ns_per_request", bench_current(NULL));
+   bench_report("hashtable/arena", "ns_per_request", bench_current(&arena));
+   free_arena(&arena);
+   return EXIT_SUCCESS;
+}
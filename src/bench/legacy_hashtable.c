@@ -0,0 +1,152 @@
+/*
+ * The hash table as it was before being rebuilt on open addressing, kept only
+ *    so the benchmarks can compare against it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <math.h>
+
+#include "legacy_hashtable.h"
+
+#define DEFAULT_CAPACITY 100
+#define RESIZE_THRESHOLD 0.6
+#define RESIZE_SCALING_FACTOR 10
+
+static unsigned hash(char *key) {
+   int len = strlen(key);
+   unsigned hash = 0;
+   while (len-- > 0) {
+      hash += (unsigned) floor(pow(key[len], len));
+   }
+   return hash;
+}
+
+static unsigned double_hash(char *key) {
+   int len = strlen(key);
+   unsigned hash = 0;
+   while (len-- > 0) {
+      hash += (unsigned) floor(pow(key[len], len + 1));
+   }
+   return hash;
+}
+
+static void free_hashentry(struct legacy_hashentry *entry) {
+   free(entry->key);
+   free(entry->val);
+   free(entry);
+}
+
+static void expand_table(struct legacy_hashtable *table) {
+   unsigned old_capacity = table->capacity;
+   struct legacy_hashentry **old_entries = *table->entries;
+   struct legacy_hashentry *entry = **table->entries;
+   size_t new_entry_space;
+   int entry_index;
+   table->capacity *= RESIZE_SCALING_FACTOR;
+   new_entry_space = table->capacity * sizeof(struct legacy_hashentry *);
+   *table->entries = malloc(new_entry_space);
+   memset(*table->entries, 0, new_entry_space);
+   for (entry_index = 0; entry_index < old_capacity; entry_index++) {
+      if (entry->key != NULL) {
+         legacy_set(table, entry->key, entry->val, entry->val_size);
+         free_hashentry(entry);
+      }
+      entry += 1;
+   }
+   free(old_entries);
+}
+
+static struct legacy_hashentry *check_valid_entry(
+   struct legacy_hashtable *table, char *key, unsigned hash) {
+   if (table->size > RESIZE_THRESHOLD * table->capacity) {
+      expand_table(table);
+   }
+   if ((*table->entries)[hash] == NULL) {
+      (*table->entries)[hash] = malloc(sizeof(struct legacy_hashentry));
+      memset((*table->entries)[hash], 0, sizeof(struct legacy_hashentry));
+      table->size += 1;
+      return (*table->entries)[hash];
+   }
+   if (strcmp((*table->entries)[hash]->key, key) == 0) {
+      return (*table->entries)[hash];
+   }
+   hash = (hash + double_hash(key)) % table->capacity;
+   return check_valid_entry(table, key, hash);
+}
+
+static struct legacy_hashentry *find_entry(struct legacy_hashtable *table,
+   char *key) {
+   unsigned hash_val;
+   struct legacy_hashentry *entry;
+   hash_val = hash(key);
+   hash_val %= table->capacity;
+   entry = check_valid_entry(table, key, hash_val);
+   return entry;
+}
+
+static struct legacy_hashentry *lookup_entry(
+   struct legacy_hashtable *table, char *key) {
+   unsigned hash_val = hash(key) % table->capacity, probes;
+   struct legacy_hashentry *entry;
+   for (probes = 0; probes < table->capacity; probes++) {
+      entry = (*table->entries)[hash_val];
+      if (entry == NULL) {
+         return NULL;
+      }
+      if (strcmp(entry->key, key) == 0) {
+         return entry;
+      }
+      hash_val = (hash_val + double_hash(key)) % table->capacity;
+   }
+   return NULL;
+}
+
+struct legacy_hashtable *legacy_create_hashtable() {
+   struct legacy_hashtable *table = malloc(sizeof(struct legacy_hashtable));
+   size_t entry_space = DEFAULT_CAPACITY * sizeof(struct legacy_hashentry *);
+   table->size = 0;
+   table->capacity = DEFAULT_CAPACITY;
+   table->entries = malloc(sizeof(struct legacy_hashentry **));
+   *table->entries = malloc(entry_space);
+   memset(*table->entries, 0, entry_space);
+   return table;
+}
+
+void legacy_set(struct legacy_hashtable *table, char *key, void *val,
+   size_t val_size) {
+   struct legacy_hashentry *found = find_entry(table, key);
+   if (found->key == NULL) {
+      found->key = malloc((strlen(key) + 1) * sizeof(char));
+      strcpy(found->key, key);
+   }
+   if (found->val != NULL) {
+      free(found->val);
+   }
+   found->val = malloc(val_size);
+   memcpy(found->val, val, val_size);
+   found->val_size = val_size;
+}
+
+void *legacy_get(struct legacy_hashtable *table, char *key) {
+   struct legacy_hashentry *found = lookup_entry(table, key);
+   if (found == NULL) {
+      return NULL;
+   }
+   return found->val;
+}
+
+void legacy_free_hashtable(struct legacy_hashtable *table) {
+   struct legacy_hashentry *current;
+   while (table->capacity-- > 0) {
+      current = (*table->entries)[table->capacity];
+      if (current != NULL) {
+         free_hashentry(current);
+      }
+   }
+   free(*table->entries);
+   free(table->entries);
+   free(table);
+}
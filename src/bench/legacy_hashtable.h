@@ -0,0 +1,22 @@
+#ifndef LEGACY_HASHTABLE_H
+#define LEGACY_HASHTABLE_H
+
+#include <sys/types.h>
+
+struct legacy_hashentry {
+   char *key;
+   void *val;
+   size_t val_size;
+};
+
+struct legacy_hashtable {
+   struct legacy_hashentry ***entries;
+   unsigned size, capacity;
+};
+
+struct legacy_hashtable *legacy_create_hashtable();
+void legacy_set(struct legacy_hashtable *, char *, void *, size_t);
+void *legacy_get(struct legacy_hashtable *, char *);
+void legacy_free_hashtable(struct legacy_hashtable *);
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * loadgen.c
+ * A closed-loop HTTP load generator. Every client sends a request, waits for
+ *    the whole response and immediately sends the next one, either on the same
+ *    connection (-k) or on a new one. Throughput and latency percentiles are
+ *    reported as JSON lines.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+
+#define RECV_LEN 65536
+#define MAX_EVENTS 256
+
+struct client {
+   int fd;
+   char request[512];
+   size_t request_len, sent;
+   char *head;
+   size_t received;
+   long body_left;
+   int closing;
+   double start;
+};
+
+struct loadgen {
+   struct sockaddr_in addr;
+   int epoll_fd, keep_alive;
+   char *path;
+   unsigned *latencies;
+   size_t num_latencies, latencies_size;
+   unsigned long errors, non_2xx;
+};
+
+static void usage(char *program) {
+   fprintf(stderr, "Usage: %s [-a address] [-p port] [-c connections] "
+      "[-d seconds] [-u path] [-n name] [-k]\n", program);
+   exit(EXIT_FAILURE);
+}
+
+static void record(struct loadgen *gen, double latency) {
+   if (gen->num_latencies == gen->latencies_size) {
+      gen->latencies_size = gen->latencies_size ? gen->latencies_size * 2
+         : 4096;
+      gen->latencies = realloc(gen->latencies,
+         gen->latencies_size * sizeof(unsigned));
+      if (gen->latencies == NULL) {
+         perror("realloc");
+         exit(EXIT_FAILURE);
+      }
+   }
+   gen->latencies[gen->num_latencies++] = (unsigned) (latency / 1000);
+}
+
+static int compare_unsigned(const void *a, const void *b) {
+   unsigned first = *(const unsigned *) a, second = *(const unsigned *) b;
+   return first < second ? -1 : first > second;
+}
+
+static double percentile(struct loadgen *gen, double fraction) {
+   size_t index = (size_t) (fraction * gen->num_latencies);
+   if (gen->num_latencies == 0) {
+      return 0;
+   }
+   if (index >= gen->num_latencies) {
+      index = gen->num_latencies - 1;
+   }
+   return gen->latencies[index];
+}
+
+static void watch(struct loadgen *gen, struct client *client, int op,
+   unsigned events) {
+   struct epoll_event event;
+   memset(&event, 0, sizeof(event));
+   event.events = events;
+   event.data.ptr = client;
+   if (epoll_ctl(gen->epoll_fd, op, client->fd, &event) < 0) {
+      perror("epoll_ctl");
+      exit(EXIT_FAILURE);
+   }
+}
+
+/* Open a new connection for the client and start sending its request */
+static void connect_client(struct loadgen *gen, struct client *client) {
+   int option = 1;
+   client->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+   if (client->fd < 0) {
+      perror("socket");
+      exit(EXIT_FAILURE);
+   }
+   setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &option, sizeof(option));
+   if (connect(client->fd, (struct sockaddr *) &gen->addr,
+      sizeof(gen->addr)) < 0 && errno != EINPROGRESS) {
+      perror("connect");
+      exit(EXIT_FAILURE);
+   }
+   watch(gen, client, EPOLL_CTL_ADD, EPOLLOUT);
+}
+
+static void start_request(struct loadgen *gen, struct client *client) {
+   client->sent = client->received = 0;
+   client->body_left = -1;
+   client->closing = 0;
+   client->start = bench_now();
+   if (client->fd < 0) {
+      connect_client(gen, client);
+   }
+   else {
+      watch(gen, client, EPOLL_CTL_MOD, EPOLLOUT);
+   }
+}
+
+static void restart_client(struct loadgen *gen, struct client *client) {
+   close(client->fd);
+   client->fd = -1;
+   start_request(gen, client);
+}
+
+static void send_request(struct loadgen *gen, struct client *client) {
+   ssize_t sent;
+   while (client->sent < client->request_len) {
+      sent = send(client->fd, client->request + client->sent,
+         client->request_len - client->sent, MSG_NOSIGNAL);
+      if (sent < 0) {
+         if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            gen->errors++;
+            restart_client(gen, client);
+         }
+         return;
+      }
+      client->sent += sent;
+   }
+   watch(gen, client, EPOLL_CTL_MOD, EPOLLIN);
+}
+
+/* Find the status and body length once the whole head has arrived */
+static void parse_head(struct loadgen *gen, struct client *client) {
+   char *end, *length;
+   client->head[client->received] = '\0';
+   if ((end = strstr(client->head, "\r\n\r\n")) == NULL) {
+      return;
+   }
+   if (strncmp(client->head + 9, "2", 1) != 0) {
+      gen->non_2xx++;
+   }
+   client->body_left = 0;
+   for (length = client->head; length < end; length++) {
+      if (strncasecmp(length, "\ncontent-length:", 16) == 0) {
+         client->body_left = atol(length + 16);
+      }
+      /* A server shutting down closes after this response */
+      else if (strncasecmp(length, "\nconnection: close", 18) == 0) {
+         client->closing = 1;
+      }
+   }
+   client->body_left -= client->received - (end + 4 - client->head);
+}
+
+static void receive_response(struct loadgen *gen, struct client *client) {
+   char discard[RECV_LEN];
+   ssize_t received;
+   while (1) {
+      if (client->body_left < 0) {
+         received = recv(client->fd, client->head + client->received,
+            RECV_LEN - client->received - 1, 0);
+      }
+      else {
+         received = recv(client->fd, discard, sizeof(discard), 0);
+      }
+      if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+         return;
+      }
+      if (received <= 0) {
+         gen->errors++;
+         restart_client(gen, client);
+         return;
+      }
+      if (client->body_left < 0) {
+         client->received += received;
+         parse_head(gen, client);
+      }
+      else {
+         client->body_left -= received;
+      }
+      if (client->body_left == 0) {
+         record(gen, bench_now() - client->start);
+         if (gen->keep_alive && !client->closing) {
+            start_request(gen, client);
+         }
+         else {
+            restart_client(gen, client);
+         }
+         return;
+      }
+   }
+}
+
+int main(int argc, char *argv[]) {
+   struct loadgen gen;
+   struct client *clients;
+   struct epoll_event events[MAX_EVENTS];
+   char *address = "127.0.0.1", *name = "http", metric[64];
+   int port = 8000, connections = 50, seconds = 5, option, index, ready;
+   double begin, elapsed;
+
+   memset(&gen, 0, sizeof(gen));
+   gen.path = "/index.html";
+   while ((option = getopt(argc, argv, "a:p:c:d:u:n:k")) != -1) {
+      switch (option) {
+         case 'a': address = optarg; break;
+         case 'p': port = atoi(optarg); break;
+         case 'c': connections = atoi(optarg); break;
+         case 'd': seconds = atoi(optarg); break;
+         case 'u': gen.path = optarg; break;
+         case 'n': name = optarg; break;
+         case 'k': gen.keep_alive = 1; break;
+         default: usage(argv[0]);
+      }
+   }
+   if (connections < 1 || seconds < 1) {
+      usage(argv[0]);
+   }
+
+   gen.addr.sin_family = AF_INET;
+   gen.addr.sin_port = htons(port);
+   if (inet_pton(AF_INET, address, &gen.addr.sin_addr) != 1) {
+      usage(argv[0]);
+   }
+   if ((gen.epoll_fd = epoll_create1(0)) < 0) {
+      perror("epoll_create1");
+      return EXIT_FAILURE;
+   }
+
+   clients = calloc(connections, sizeof(struct client));
+   begin = bench_now();
+   for (index = 0; index < connections; index++) {
+      clients[index].fd = -1;
+      clients[index].head = malloc(RECV_LEN);
+      sprintf(clients[index].request, "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+         gen.path, address, gen.keep_alive ? "" : "Connection: close\r\n");
+      clients[index].request_len = strlen(clients[index].request);
+      start_request(&gen, &clients[index]);
+   }
+
+   while ((elapsed = bench_now() - begin) < seconds * 1e9) {
+      ready = epoll_wait(gen.epoll_fd, events, MAX_EVENTS, 100);
+      for (index = 0; index < ready; index++) {
+         if (events[index].events & EPOLLOUT) {
+            send_request(&gen, events[index].data.ptr);
+         }
+         else {
+            receive_response(&gen, events[index].data.ptr);
+         }
+      }
+   }
+
+   qsort(gen.latencies, gen.num_latencies, sizeof(unsigned), compare_unsigned);
+   sprintf(metric, "%s/c%d", name, connections);
+   bench_report(metric, "requests_per_sec", gen.num_latencies / (elapsed / 1e9));
+   bench_report(metric, "p50_us", percentile(&gen, 0.5));
+   bench_report(metric, "p99_us", percentile(&gen, 0.99));
+   bench_report(metric, "p999_us", percentile(&gen, 0.999));
+   bench_report(metric, "errors", gen.errors);
+   bench_report(metric, "non_2xx", gen.non_2xx);
+   return EXIT_SUCCESS;
+}
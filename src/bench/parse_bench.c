@@ -0,0 +1,145 @@
+/*
+ * parse_bench.c
+ * Measures request parsing: parse_request fed through a socketpair like a
+ *    real connection, parse_request alone on an already buffered request, and
+ *    the fdgets and substring utilities against slice_split.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../arena.h"
+#include "../buffer.h"
+#include "../request.h"
+#include "../slice.h"
+#include "../util.h"
+#include "bench.h"
+
+#define ITERATIONS 100000
+
+static char *request;
+static size_t request_len;
+static struct request_limits limits = { 8192, 16384, 100, 1048576 };
+
+static void check(int ok, char *what) {
+   if (!ok) {
+      fprintf(stderr, "parse_bench: %s failed\n", what);
+      exit(EXIT_FAILURE);
+   }
+}
+
+/* Write, read and parse one request per iteration, as a connection would */
+static double bench_socketpair(int *pair) {
+   struct buffer in;
+   struct arena arena;
+   unsigned iteration;
+   double start;
+   init_buffer(&in, 4096, 4096);
+   init_arena(&arena, 4096);
+   start = bench_now();
+   for (iteration = 0; iteration < ITERATIONS; iteration++) {
+      check(write(pair[0], request, request_len) == (ssize_t) request_len,
+         "write");
+      buffer_fill(&in, pair[1]);
+      check(parse_request(&in, &arena, &limits) != NULL, "parse_request");
+      arena_reset(&arena);
+   }
+   start = (bench_now() - start) / ITERATIONS;
+   free_arena(&arena);
+   free_buffer(&in);
+   return start;
+}
+
+/* Parse the same buffered bytes over and over, no system calls involved */
+static double bench_buffered() {
+   struct buffer in;
+   struct arena arena;
+   unsigned iteration;
+   double start;
+   init_buffer(&in, 4096, 4096);
+   init_arena(&arena, 4096);
+   memcpy(in.data, request, request_len);
+   start = bench_now();
+   for (iteration = 0; iteration < ITERATIONS; iteration++) {
+      in.start = 0;
+      in.end = request_len;
+      check(parse_request(&in, &arena, &limits) != NULL, "parse_request");
+      arena_reset(&arena);
+   }
+   start = (bench_now() - start) / ITERATIONS;
+   free_arena(&arena);
+   free_buffer(&in);
+   return start;
+}
+
+/* Read every line of the request with fdgets, one read() per byte */
+static double bench_fdgets(int *pair) {
+   unsigned iteration;
+   char *line;
+   int blank;
+   double start = bench_now();
+   for (iteration = 0; iteration < ITERATIONS / 10; iteration++) {
+      check(write(pair[0], request, request_len) == (ssize_t) request_len,
+         "write");
+      do {
+         line = fdgets(pair[1], '\n');
+         blank = strlen(line) <= 1;
+         free(line);
+      } while (!blank);
+   }
+   return (bench_now() - start) / (ITERATIONS / 10);
+}
+
+/* Split the whole request into lines with substring */
+static double bench_substring() {
+   unsigned iteration;
+   char *input, *line;
+   double start = bench_now();
+   for (iteration = 0; iteration < ITERATIONS; iteration++) {
+      input = malloc(request_len + 1);
+      memcpy(input, request, request_len + 1);
+      while (*input != '\0') {
+         line = substring(&input, '\n');
+         free(line);
+      }
+      free(input);
+   }
+   return (bench_now() - start) / ITERATIONS;
+}
+
+/* Split the whole request into lines with slice_split, copying nothing */
+static double bench_slice_split() {
+   unsigned iteration;
+   struct slice input, line;
+   size_t total = 0;
+   double start = bench_now();
+   for (iteration = 0; iteration < ITERATIONS; iteration++) {
+      input.data = request;
+      input.len = request_len;
+      while (input.len > 0) {
+         line = slice_split(&input, '\n');
+         total += line.len;
+      }
+   }
+   check(total > 0, "slice_split");
+   return (bench_now() - start) / ITERATIONS;
+}
+
+int main(int argc, char *argv[]) {
+   int pair[2];
+   request = bench_browser_request(&request_len);
+   check(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0, "socketpair");
+   bench_report("fdgets", "ns_per_request", bench_fdgets(pair));
+   check(set_nonblocking(pair[1]) == 0, "set_nonblocking");
+   bench_report("parse_request/socketpair", "ns_per_request",
+      bench_socketpair(pair));
+   bench_report("parse_request/buffered", "ns_per_request", bench_buffered());
+   bench_report("substring", "ns_per_request", bench_substring());
+   bench_report("slice_split", "ns_per_request", bench_slice_split());
+   close(pair[0]);
+   close(pair[1]);
+   return EXIT_SUCCESS;
+}
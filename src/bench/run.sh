@@ -0,0 +1,42 @@
+#!/bin/sh
+# Runs the micro benchmarks, then load tests a local server with and without
+# keep-alive and checks its streamed bodies under both event loops. Results are
+# printed as JSON lines tagged with the source version and appended to
+# $BENCH_RESULTS (bench/results.jsonl by default).
+
+set -e
+cd "$(dirname "$0")/.."
+
+RESULTS=${BENCH_RESULTS:-bench/results.jsonl}
+VERSION=$(git describe --always --dirty 2>/dev/null || echo unknown)
+CONNECTIONS=${BENCH_CONNECTIONS:-50}
+SECONDS_PER_RUN=${BENCH_SECONDS:-5}
+
+run() {
+   "$@" | sed "s/^{/{\"version\": \"$VERSION\", /" | tee -a "$RESULTS"
+}
+
+run bench/hashtable_bench
+run bench/parse_bench
+run bench/scan_bench
+
+./server -w "${BENCH_WORKERS:-1}" > /dev/null 2>&1 &
+SERVER=$!
+trap 'kill $SERVER' EXIT
+sleep 1
+
+run bench/loadgen -n http/keepalive -k -c "$CONNECTIONS" -d "$SECONDS_PER_RUN"
+run bench/loadgen -n http/close -c "$CONNECTIONS" -d "$SECONDS_PER_RUN"
+
+# Streamed bodies are checked byte for byte under both event loops
+stream() {
+   kill $SERVER
+   wait $SERVER || true
+   ./server -w 1 -o stream_route=on -o uring="$2" > /dev/null 2>&1 &
+   SERVER=$!
+   sleep 1
+   run bench/stream_bench -n "stream/$1"
+}
+
+stream uring on
+stream epoll off
@@ -0,0 +1,90 @@
+/*
+ * scan_bench.c
+ * Checks every scan implementation the processor supports against the scalar
+ *    one, then measures how many header bytes each validates per cycle on a
+ *    typical browser request. Cycles are TSC reference cycles.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../scan.h"
+#include "../slice.h"
+#include "bench.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() ((double) __rdtsc())
+#define METRIC "bytes_per_cycle"
+#else
+#define CYCLES() bench_now()
+#define METRIC "bytes_per_ns"
+#endif
+
+#define ITERATIONS 200000
+#define CHECK_LEN 200
+
+static char *impl_names[] = { "scan/scalar", "scan/sse42", "scan/avx2" };
+
+static void check(int ok, char *what) {
+   if (!ok) {
+      fprintf(stderr, "scan_bench: %s failed\n", what);
+      exit(EXIT_FAILURE);
+   }
+}
+
+/* Compare both scans with the scalar ones on random bytes of every length */
+static void check_impl(int impl) {
+   char data[CHECK_LEN];
+   size_t len, expect_token, expect_text, index;
+   unsigned round;
+   for (round = 0; round < 2000; round++) {
+      /* Mostly valid bytes, so runs are long enough to cross chunks */
+      for (index = 0; index < CHECK_LEN; index++) {
+         data[index] = rand() % 16 == 0 ? rand() % 256 : 'a' + rand() % 26;
+      }
+      len = rand() % CHECK_LEN;
+      scan_use(SCAN_SCALAR);
+      expect_token = scan_token(data, len);
+      expect_text = scan_text(data, len);
+      scan_use(impl);
+      check(scan_token(data, len) == expect_token, "scan_token");
+      check(scan_text(data, len) == expect_text, "scan_text");
+   }
+}
+
+/* Validate the name and value of every header line, as parse_headers does */
+static double bench_impl(char *request, size_t request_len) {
+   struct slice input, line;
+   size_t bytes = 0, name_len;
+   unsigned iteration;
+   double start = CYCLES();
+   for (iteration = 0; iteration < ITERATIONS; iteration++) {
+      input.data = request;
+      input.len = request_len;
+      slice_split(&input, '\n');
+      while (input.len > 0) {
+         line = slice_split(&input, '\n');
+         name_len = scan_token(line.data, line.len);
+         if (name_len < line.len) {
+            bytes += name_len + 1 + scan_text(line.data + name_len + 1,
+               line.len - name_len - 1);
+         }
+      }
+   }
+   return bytes / (CYCLES() - start);
+}
+
+int main(int argc, char *argv[]) {
+   size_t request_len;
+   char *request = bench_browser_request(&request_len);
+   int impl;
+   for (impl = SCAN_SCALAR; impl <= scan_best(); impl++) {
+      check_impl(impl);
+      scan_use(impl);
+      bench_report(impl_names[impl], METRIC, bench_impl(request,
+         request_len));
+   }
+   return EXIT_SUCCESS;
+}
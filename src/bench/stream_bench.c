@@ -0,0 +1,218 @@
+/*
+ * stream_bench.c
+ * Fetches streamed bodies from a server running with stream_route on, and
+ *    checks every byte on the wire: the chunk framing and last chunk sent to
+ *    HTTP/1.1 clients, the unframed body ended by a close sent to HTTP/1.0
+ *    ones, and a close without the last chunk when a stream is abandoned.
+ *    The rate each body arrives at is reported as JSON lines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+
+#define RECV_LEN 65536
+#define MAX_LINE 1024
+
+/* The bytes /__stream repeats, as the server defines them */
+#define STREAM_PATTERN \
+   "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-\n"
+#define STREAM_PATTERN_LEN 64
+
+struct reader {
+   int fd;
+   char data[RECV_LEN];
+   size_t start, end;
+};
+
+static struct sockaddr_in addr;
+
+static void usage(char *program) {
+   fprintf(stderr, "Usage: %s [-a address] [-p port] [-s bytes] [-n name]\n",
+      program);
+   exit(EXIT_FAILURE);
+}
+
+static void check(int ok, char *what) {
+   if (!ok) {
+      fprintf(stderr, "stream_bench: %s failed\n", what);
+      exit(EXIT_FAILURE);
+   }
+}
+
+static void open_reader(struct reader *reader, const char *request) {
+   reader->start = reader->end = 0;
+   reader->fd = socket(AF_INET, SOCK_STREAM, 0);
+   check(reader->fd >= 0, "socket");
+   check(connect(reader->fd, (struct sockaddr *) &addr, sizeof(addr)) == 0,
+      "connect");
+   check(send(reader->fd, request, strlen(request), MSG_NOSIGNAL) ==
+      (ssize_t) strlen(request), "send");
+}
+
+/* Receive more bytes once all buffered ones are used, 0 at the end */
+static int fill(struct reader *reader) {
+   ssize_t received;
+   if (reader->start < reader->end) {
+      return 1;
+   }
+   reader->start = reader->end = 0;
+   received = recv(reader->fd, reader->data, RECV_LEN, 0);
+   if (received > 0) {
+      reader->end = received;
+   }
+   return received > 0;
+}
+
+/* Read one line without its CRLF, 0 if the stream ends first */
+static int read_line(struct reader *reader, char *line) {
+   size_t len = 0;
+   while (fill(reader)) {
+      line[len] = reader->data[reader->start++];
+      if (line[len] == '\n') {
+         line[len > 0 && line[len - 1] == '\r' ? len - 1 : len] = '\0';
+         return 1;
+      }
+      check(++len < MAX_LINE, "line length");
+   }
+   return 0;
+}
+
+/* Read a 200 response head, telling whether the body is chunked */
+static int read_head(struct reader *reader) {
+   char line[MAX_LINE];
+   int chunked = 0;
+   check(read_line(reader, line) && strstr(line, " 200 ") != NULL, "status");
+   while (read_line(reader, line) && line[0] != '\0') {
+      if (strcasecmp(line, "Transfer-Encoding: chunked") == 0) {
+         chunked = 1;
+      }
+   }
+   return chunked;
+}
+
+/* Compare the next len body bytes with the pattern, 0 if the stream ends */
+static int read_data(struct reader *reader, unsigned long *offset,
+   unsigned long len) {
+   size_t index, available;
+   while (len > 0) {
+      if (!fill(reader)) {
+         return 0;
+      }
+      available = reader->end - reader->start;
+      available = available < len ? available : len;
+      for (index = 0; index < available; index++) {
+         check(reader->data[reader->start + index] ==
+            STREAM_PATTERN[(*offset + index) % STREAM_PATTERN_LEN], "data");
+      }
+      reader->start += available;
+      *offset += available;
+      len -= available;
+   }
+   return 1;
+}
+
+/* Decode a chunked body, 0 if the stream ends before the last chunk */
+static int read_chunked(struct reader *reader, unsigned long *received) {
+   char line[MAX_LINE], *end;
+   unsigned long size;
+   *received = 0;
+   while (read_line(reader, line)) {
+      size = strtoul(line, &end, 16);
+      check(end != line && *end == '\0', "chunk size");
+      if (size == 0) {
+         check(read_line(reader, line) && line[0] == '\0', "last chunk");
+         return 1;
+      }
+      if (!read_data(reader, received, size) || !read_line(reader, line)) {
+         return 0;
+      }
+      check(line[0] == '\0', "chunk end");
+   }
+   return 0;
+}
+
+/* Two bodies on one connection, so the framing has to be exact */
+static double bench_chunked(unsigned long bytes) {
+   struct reader *reader = malloc(sizeof(struct reader));
+   char request[MAX_LINE];
+   unsigned long received;
+   double start = bench_now(), elapsed;
+   sprintf(request, "GET /__stream/%lu HTTP/1.1\r\n\r\n"
+      "GET /__stream/0 HTTP/1.1\r\nConnection: close\r\n\r\n", bytes);
+   open_reader(reader, request);
+   check(read_head(reader), "chunked head");
+   check(read_chunked(reader, &received) && received == bytes, "chunked");
+   elapsed = bench_now() - start;
+   check(read_head(reader), "chunked head");
+   check(read_chunked(reader, &received) && received == 0, "empty chunked");
+   check(!fill(reader), "close");
+   close(reader->fd);
+   free(reader);
+   return bytes / (elapsed / 1e3);
+}
+
+static double bench_close(unsigned long bytes) {
+   struct reader *reader = malloc(sizeof(struct reader));
+   char request[MAX_LINE];
+   unsigned long received = 0;
+   double start = bench_now(), elapsed;
+   sprintf(request, "GET /__stream/%lu HTTP/1.0\r\n\r\n", bytes);
+   open_reader(reader, request);
+   check(!read_head(reader), "unframed head");
+   check(read_data(reader, &received, bytes), "unframed");
+   check(!fill(reader), "close");
+   elapsed = bench_now() - start;
+   close(reader->fd);
+   free(reader);
+   return bytes / (elapsed / 1e3);
+}
+
+/* An abandoned body stops short of the last chunk, and the server closes */
+static void check_abort(unsigned long bytes) {
+   struct reader *reader = malloc(sizeof(struct reader));
+   char request[MAX_LINE];
+   unsigned long received;
+   sprintf(request, "GET /__stream/%lu/abort HTTP/1.1\r\n\r\n", bytes);
+   open_reader(reader, request);
+   check(read_head(reader), "abort head");
+   check(!read_chunked(reader, &received) && received <= bytes, "abort");
+   close(reader->fd);
+   free(reader);
+}
+
+int main(int argc, char *argv[]) {
+   char *address = "127.0.0.1", *name = "stream", metric[64];
+   unsigned long bytes = 64 * 1024 * 1024;
+   int port = 8000, option;
+
+   while ((option = getopt(argc, argv, "a:p:s:n:")) != -1) {
+      switch (option) {
+         case 'a': address = optarg; break;
+         case 'p': port = atoi(optarg); break;
+         case 's': bytes = strtoul(optarg, NULL, 10); break;
+         case 'n': name = optarg; break;
+         default: usage(argv[0]);
+      }
+   }
+
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+      usage(argv[0]);
+   }
+
+   sprintf(metric, "%s/chunked", name);
+   bench_report(metric, "mb_per_sec", bench_chunked(bytes));
+   sprintf(metric, "%s/close", name);
+   bench_report(metric, "mb_per_sec", bench_close(bytes));
+   check_abort(bytes);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,241 @@
+/*
+ * buffer.c
+ * Buffers bytes read from a file descriptor and splits them into tokens.
+ *    Functions are prototyped in buffer.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "util.h"
+
+/* Never issue a read smaller than this */
+#define MIN_READ_LEN 1024
+
+/*
+ * Prepares an empty buffer.
+ * Params:
+ *    struct buffer *buf: The buffer to be initialized
+ *    size_t size: The initial capacity of the buffer
+ *    size_t max_size: The capacity the buffer may grow to, at least size
+ */
+void init_buffer(struct buffer *buf, size_t size, size_t max_size) {
+
+   buf->data = malloc(size * sizeof(char));
+   buf->start = buf->end = 0;
+   buf->size = size;
+   buf->max_size = max_size;
+
+}
+
+/*
+ * Frees the memory held by a buffer.
+ * Params:
+ *    struct buffer *buf: The buffer to be freed
+ */
+void free_buffer(struct buffer *buf) {
+
+   free(buf->data);
+   buf->data = NULL;
+   buf->start = buf->end = buf->size = buf->max_size = 0;
+
+}
+
+/*
+ * Makes room for at least MIN_READ_LEN more bytes at the end of the buffer,
+ *    first by dropping consumed bytes and then by growing, as far as its
+ *    maximum size allows.
+ * Params:
+ *    struct buffer *buf: The buffer to make room in
+ */
+static void reserve_space(struct buffer *buf) {
+
+   size_t size = buf->size;
+
+   if (buf->size - buf->end >= MIN_READ_LEN) {
+      return;
+   }
+
+   /* Move unconsumed bytes to the front */
+   if (buf->start > 0) {
+      memmove(buf->data, buf->data + buf->start, buf->end - buf->start);
+      buf->end -= buf->start;
+      buf->start = 0;
+   }
+
+   /* Current memory allocation is still too full, resize */
+   while (size - buf->end < MIN_READ_LEN && size < buf->max_size) {
+      size *= 2;
+   }
+
+   if (size > buf->max_size) {
+      size = buf->max_size;
+   }
+
+   if (size != buf->size) {
+      buf->size = size;
+      buf->data = realloc(buf->data, buf->size * sizeof(char));
+   }
+
+}
+
+/*
+ * Reads everything currently available on a file descriptor into the buffer,
+ *    in reads as large as the free space allows.
+ * Params:
+ *    struct buffer *buf: The buffer to read into
+ *    int fd: The non-blocking file descriptor to read from
+ * Returns:
+ *    int result: IO_AGAIN once fd is drained, IO_FULL if the buffer is full
+ *       before that, IO_EOF or IO_ERROR
+ */
+int buffer_fill(struct buffer *buf, int fd) {
+
+   ssize_t received;
+
+   while (1) {
+
+      reserve_space(buf);
+      if (buf->end == buf->size) {
+         return IO_FULL;
+      }
+
+      received = read(fd, buf->data + buf->end, buf->size - buf->end);
+
+      if (received > 0) {
+         buf->end += received;
+      }
+      else if (received == 0) {
+         return IO_EOF;
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+         return IO_AGAIN;
+      }
+      else if (errno != EINTR) {
+         return IO_ERROR;
+      }
+
+   }
+
+}
+
+/*
+ * Makes room at the end of the buffer for bytes received some other way,
+ *    such as by the kernel on its own.
+ * Params:
+ *    struct buffer *buf: The buffer to receive into
+ *    size_t *len: Filled with the number of bytes that fit, 0 if the
+ *       buffer is full
+ * Returns:
+ *    char *space: Where the bytes go, counted once passed to buffer_commit
+ */
+char *buffer_reserve(struct buffer *buf, size_t *len) {
+
+   reserve_space(buf);
+   *len = buf->size - buf->end;
+
+   return buf->data + buf->end;
+
+}
+
+/*
+ * Adds bytes received into reserved space to the buffered input.
+ * Params:
+ *    struct buffer *buf: The buffer received into
+ *    size_t len: The number of bytes received
+ */
+void buffer_commit(struct buffer *buf, size_t len) {
+
+   buf->end += len;
+
+}
+
+/*
+ * Finds the next line of input, if its line feed has been received yet. The
+ *    line is not copied and nothing is consumed from the buffer.
+ * Params:
+ *    struct buffer *buf: The buffer to scan
+ *    size_t *pos: Where the line starts, moved past its line feed
+ *    struct slice *line: Set to the line, without its CRLF or LF ending
+ * Returns:
+ *    int complete: 1 if a whole line was found, 0 if more input is needed
+ */
+int buffer_line(struct buffer *buf, size_t *pos, struct slice *line) {
+
+   char *begin = buf->data + *pos, *found;
+
+   /* Scan all buffered bytes at once rather than one read per character */
+   found = memchr(begin, '\n', buf->end - *pos);
+
+   if (found == NULL) {
+      return 0;
+   }
+
+   line->data = begin;
+   line->len = found - begin;
+   *pos += line->len + 1;
+
+   if (line->len > 0 && begin[line->len - 1] == '\r') {
+      line->len--;
+   }
+
+   return 1;
+
+}
+
+/*
+ * Marks everything before a position as consumed.
+ * Params:
+ *    struct buffer *buf: The buffer to consume from
+ *    size_t pos: The position of the first byte still needed
+ */
+void buffer_consume(struct buffer *buf, size_t pos) {
+
+   buf->start = pos;
+
+   /* Everything was consumed, start over at the front */
+   if (buf->start == buf->end) {
+      buf->start = buf->end = 0;
+   }
+
+}
+
+/*
+ * Gives back the memory of a buffer that grew, once it is empty again.
+ * Params:
+ *    struct buffer *buf: The buffer to shrink
+ *    size_t size: The capacity to shrink it to
+ */
+void buffer_trim(struct buffer *buf, size_t size) {
+
+   if (buf->start == buf->end && buf->size > size) {
+      buf->data = realloc(buf->data, size * sizeof(char));
+      buf->size = size;
+      buf->start = buf->end = 0;
+   }
+
+}
@@ -0,0 +1,128 @@
+/*
+ * buffer.h
+ * Makes available the input buffer and tokenizer used to read requests.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <sys/types.h>
+
+#include "slice.h"
+
+/* Results of a non-blocking read or write */
+#define IO_AGAIN  0
+#define IO_DONE   1
+#define IO_EOF    2
+#define IO_ERROR  3
+#define IO_FULL   4
+
+/*
+ * Bytes received but not yet consumed lie between start and end of data.
+ *    Requests are parsed into slices of data, so it only ever moves while
+ *    buffer_fill or buffer_reserve make room. It never grows past max_size.
+ */
+struct buffer {
+   char *data;
+   size_t start, end, size, max_size;
+};
+
+/*
+ * Prepares an empty buffer.
+ * Params:
+ *    struct buffer *buf: The buffer to be initialized
+ *    size_t size: The initial capacity of the buffer
+ *    size_t max_size: The capacity the buffer may grow to, at least size
+ */
+void init_buffer(struct buffer *, size_t, size_t);
+
+/*
+ * Frees the memory held by a buffer.
+ * Params:
+ *    struct buffer *buf: The buffer to be freed
+ */
+void free_buffer(struct buffer *);
+
+/*
+ * Reads everything currently available on a file descriptor into the buffer,
+ *    in reads as large as the free space allows.
+ * Params:
+ *    struct buffer *buf: The buffer to read into
+ *    int fd: The non-blocking file descriptor to read from
+ * Returns:
+ *    int result: IO_AGAIN once fd is drained, IO_FULL if the buffer is full
+ *       before that, IO_EOF or IO_ERROR
+ */
+int buffer_fill(struct buffer *, int);
+
+/*
+ * Makes room at the end of the buffer for bytes received some other way,
+ *    such as by the kernel on its own.
+ * Params:
+ *    struct buffer *buf: The buffer to receive into
+ *    size_t *len: Filled with the number of bytes that fit, 0 if the
+ *       buffer is full
+ * Returns:
+ *    char *space: Where the bytes go, counted once passed to buffer_commit
+ */
+char *buffer_reserve(struct buffer *, size_t *);
+
+/*
+ * Adds bytes received into reserved space to the buffered input.
+ * Params:
+ *    struct buffer *buf: The buffer received into
+ *    size_t len: The number of bytes received
+ */
+void buffer_commit(struct buffer *, size_t);
+
+/*
+ * Finds the next line of input, if its line feed has been received yet. The
+ *    line is not copied and nothing is consumed from the buffer.
+ * Params:
+ *    struct buffer *buf: The buffer to scan
+ *    size_t *pos: Where the line starts, moved past its line feed
+ *    struct slice *line: Set to the line, without its CRLF or LF ending
+ * Returns:
+ *    int complete: 1 if a whole line was found, 0 if more input is needed
+ */
+int buffer_line(struct buffer *, size_t *, struct slice *);
+
+/*
+ * Marks everything before a position as consumed.
+ * Params:
+ *    struct buffer *buf: The buffer to consume from
+ *    size_t pos: The position of the first byte still needed
+ */
+void buffer_consume(struct buffer *, size_t);
+
+/*
+ * Gives back the memory of a buffer that grew, once it is empty again.
+ * Params:
+ *    struct buffer *buf: The buffer to shrink
+ *    size_t size: The capacity to shrink it to
+ */
+void buffer_trim(struct buffer *, size_t);
+
+#endif
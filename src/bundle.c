@@ -0,0 +1,248 @@
+/*
+ * bundle.c
+ * Maps a packed bundle of static assets and looks assets up in its sorted
+ *    index. Functions are prototyped in bundle.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bundle.h"
+#include "util.h"
+
+/*
+ * Checks that a string of a bundle lies inside it, '\0' included.
+ * Params:
+ *    struct bundle *bundle: The bundle holding the string
+ *    unsigned int offset: Where the string starts
+ * Returns:
+ *    int valid: 1 if the string is whole, 0 otherwise
+ */
+static int valid_string(struct bundle *bundle, unsigned int offset) {
+
+   return offset < bundle->size &&
+      memchr(bundle->map + offset, '\0', bundle->size - offset) != NULL;
+
+}
+
+/*
+ * Checks that an entity tag of a bundle is quoted and short enough.
+ * Params:
+ *    const char *etag: The entity tag
+ * Returns:
+ *    int valid: 1 if the tag can be served, 0 otherwise
+ */
+static int valid_etag(const char *etag) {
+
+   size_t len = strlen(etag);
+
+   return len >= 2 && len <= BUNDLE_MAX_ETAG && etag[0] == '"' &&
+      etag[len - 1] == '"';
+
+}
+
+/*
+ * Checks every record of a bundle, so lookups can trust them. The urls must
+ *    be sorted for the binary search.
+ * Params:
+ *    struct bundle *bundle: The bundle to check
+ * Returns:
+ *    int valid: 1 if the bundle is well formed, 0 otherwise
+ */
+static int valid_bundle(struct bundle *bundle) {
+
+   struct bundle_record *record;
+   unsigned index;
+
+   for (index = 0; index < bundle->count; index++) {
+
+      record = &bundle->records[index];
+
+      if (!valid_string(bundle, record->url) ||
+         !valid_string(bundle, record->type) ||
+         !valid_string(bundle, record->etag) ||
+         record->data > bundle->size ||
+         record->length > bundle->size - record->data ||
+         !valid_etag(bundle->map + record->etag)) {
+         return 0;
+      }
+
+      if (index > 0 && strcmp(bundle->map + record[-1].url,
+         bundle->map + record->url) >= 0) {
+         return 0;
+      }
+
+   }
+
+   return 1;
+
+}
+
+/*
+ * Maps a bundle into memory read-only and checks that it is well formed.
+ * Params:
+ *    const char *path: The bundle file
+ * Returns:
+ *    struct bundle *bundle: The mapped bundle, or NULL with errno set
+ */
+struct bundle *open_bundle(const char *path) {
+
+   struct bundle *bundle;
+   struct bundle_header *header;
+   struct stat info;
+   int fd;
+
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+      return NULL;
+   }
+
+   if (fstat(fd, &info) < 0) {
+      close(fd);
+      return NULL;
+   }
+
+   bundle = malloc(sizeof(struct bundle));
+   bundle->size = info.st_size;
+   bundle->device = info.st_dev;
+   bundle->inode = info.st_ino;
+
+   /* The mapping outlives the descriptor and is shared through the page
+    * cache by every worker */
+   bundle->map = mmap(NULL, bundle->size > 0 ? bundle->size : 1, PROT_READ,
+      MAP_SHARED, fd, 0);
+   close(fd);
+
+   if (bundle->map == MAP_FAILED) {
+      free(bundle);
+      return NULL;
+   }
+
+   header = (struct bundle_header *) bundle->map;
+   bundle->records = (struct bundle_record *) (bundle->map +
+      sizeof(struct bundle_header));
+
+   if (bundle->size < sizeof(struct bundle_header) ||
+      memcmp(header->magic, BUNDLE_MAGIC, BUNDLE_MAGIC_LEN) != 0 ||
+      header->count > (bundle->size - sizeof(struct bundle_header)) /
+         sizeof(struct bundle_record)) {
+      close_bundle(bundle);
+      errno = EINVAL;
+      return NULL;
+   }
+
+   bundle->count = header->count;
+
+   if (!valid_bundle(bundle)) {
+      close_bundle(bundle);
+      errno = EINVAL;
+      return NULL;
+   }
+
+   return bundle;
+
+}
+
+/*
+ * Unmaps a bundle.
+ * Params:
+ *    struct bundle *bundle: The bundle to close
+ */
+void close_bundle(struct bundle *bundle) {
+
+   munmap(bundle->map, bundle->size > 0 ? bundle->size : 1);
+   free(bundle);
+
+}
+
+/*
+ * Tells whether the file at the path of a bundle was replaced since it was
+ *    mapped, as packing a bundle anew does by renaming over it.
+ * Params:
+ *    struct bundle *bundle: The mapped bundle
+ *    const char *path: The path it was mapped from
+ * Returns:
+ *    int replaced: 1 if another file is at the path, 0 if it is the same
+ *       file or none can be found
+ */
+int bundle_replaced(struct bundle *bundle, const char *path) {
+
+   struct stat info;
+
+   if (stat(path, &info) < 0) {
+      return 0;
+   }
+
+   return info.st_dev != bundle->device || info.st_ino != bundle->inode;
+
+}
+
+/*
+ * Finds an asset in a bundle by binary search of its sorted records.
+ * Params:
+ *    struct bundle *bundle: The bundle to search
+ *    const char *url: The url of the asset
+ *    struct bundle_asset *asset: Filled with the asset if found
+ * Returns:
+ *    int found: 1 if the asset is in the bundle, 0 otherwise
+ */
+int bundle_find(struct bundle *bundle, const char *url,
+   struct bundle_asset *asset) {
+
+   struct bundle_record *record;
+   unsigned low = 0, high = bundle->count, middle;
+   int order;
+
+   while (low < high) {
+
+      middle = low + (high - low) / 2;
+      record = &bundle->records[middle];
+      order = strcmp(url, bundle->map + record->url);
+
+      if (order == 0) {
+         asset->url = bundle->map + record->url;
+         asset->type = bundle->map + record->type;
+         asset->etag = bundle->map + record->etag;
+         asset->data = bundle->map + record->data;
+         asset->length = record->length;
+         asset->mtime = record->mtime;
+         return 1;
+      }
+
+      if (order < 0) {
+         high = middle;
+      }
+      else {
+         low = middle + 1;
+      }
+
+   }
+
+   return 0;
+
+}
@@ -0,0 +1,118 @@
+/*
+ * bundle.h
+ * Makes available read-only access to a packed bundle of static assets.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+/* First bytes of every bundle, the digit is the format version */
+#define BUNDLE_MAGIC "WEBCPAK1"
+#define BUNDLE_MAGIC_LEN 8
+
+/* Longest entity tag, leaving room for the name of a coding in ETAG_LEN */
+#define BUNDLE_MAX_ETAG 64
+
+/*
+ * A bundle starts with this header, followed by the records of its assets
+ *    sorted by url, then the strings and bytes they point to. Offsets count
+ *    from the start of the file and strings end in '\0'. Every field is 32
+ *    bits in host byte order, bundles are built where they are served.
+ */
+struct bundle_header {
+   char magic[BUNDLE_MAGIC_LEN];
+   unsigned int count, reserved;
+};
+
+struct bundle_record {
+   unsigned int url, type, etag;
+   unsigned int data, length, mtime;
+};
+
+/*
+ * An asset found in a bundle. The strings and bytes point into the mapping.
+ */
+struct bundle_asset {
+   const char *url, *type, *etag;
+   const char *data;
+   size_t length;
+   time_t mtime;
+};
+
+/*
+ * A bundle mapped into memory, shared by every process serving from it,
+ *    along with the file it was mapped from.
+ */
+struct bundle {
+   char *map;
+   size_t size;
+   unsigned count;
+   struct bundle_record *records;
+   dev_t device;
+   ino_t inode;
+};
+
+/*
+ * Maps a bundle into memory read-only and checks that it is well formed.
+ * Params:
+ *    const char *path: The bundle file
+ * Returns:
+ *    struct bundle *bundle: The mapped bundle, or NULL with errno set
+ */
+struct bundle *open_bundle(const char *);
+
+/*
+ * Unmaps a bundle.
+ * Params:
+ *    struct bundle *bundle: The bundle to close
+ */
+void close_bundle(struct bundle *);
+
+/*
+ * Tells whether the file at the path of a bundle was replaced since it was
+ *    mapped, as packing a bundle anew does by renaming over it.
+ * Params:
+ *    struct bundle *bundle: The mapped bundle
+ *    const char *path: The path it was mapped from
+ * Returns:
+ *    int replaced: 1 if another file is at the path, 0 if it is the same
+ *       file or none can be found
+ */
+int bundle_replaced(struct bundle *, const char *);
+
+/*
+ * Finds an asset in a bundle by binary search of its sorted records.
+ * Params:
+ *    struct bundle *bundle: The bundle to search
+ *    const char *url: The url of the asset
+ *    struct bundle_asset *asset: Filled with the asset if found
+ * Returns:
+ *    int found: 1 if the asset is in the bundle, 0 otherwise
+ */
+int bundle_find(struct bundle *, const char *, struct bundle_asset *);
+
+#endif
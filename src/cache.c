@@ -0,0 +1,774 @@
+/*
+ * cache.c
+ * Keeps recently served static assets in memory, invalidated through inotify
+ *    and evicted least recently used first. Prototyped in cache.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include "cache.h"
+#include "util.h"
+
+#define DEFAULT_BUCKETS 64
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | \
+   IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#define EVENT_BUFFER_LEN (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+/* Compression is paid once per asset, so favour size over speed */
+#define GZIP_LEVEL 9
+#define BROTLI_QUALITY 9
+
+static const char *encoding_names[NUM_ENCODINGS] = { NULL, "gzip", "br" };
+
+/*
+ * Hashes a url with 32-bit FNV-1a.
+ * Params:
+ *    char *url: The url to hash
+ * Returns:
+ *    unsigned hash: The hash of the url
+ */
+static unsigned hash_url(char *url) {
+
+   unsigned hash = 2166136261u;
+
+   while (*url != '\0') {
+      hash = (hash ^ (unsigned char) *url++) * 16777619u;
+   }
+
+   return hash;
+
+}
+
+/*
+ * Frees a single entry and everything it holds.
+ * Params:
+ *    struct cache_entry *entry: The entry to be freed
+ */
+static void free_entry(struct cache_entry *entry) {
+
+   int encoding;
+
+   for (encoding = 0; encoding < NUM_ENCODINGS; encoding++) {
+      if (encoding != ENCODING_IDENTITY || !entry->borrowed) {
+         free(entry->variants[encoding].body);
+      }
+      free(entry->variants[encoding].headers);
+   }
+
+   free(entry->url);
+   free(entry);
+
+}
+
+/*
+ * Finds the bucket slot pointing at the entry for a url.
+ * Params:
+ *    struct cache *cache: The cache to search
+ *    char *url: The url to find
+ * Returns:
+ *    struct cache_entry **slot: The slot holding the entry, or the empty slot
+ *       at the end of the chain if there is none
+ */
+static struct cache_entry **find_slot(struct cache *cache, char *url) {
+
+   struct cache_entry **slot;
+
+   slot = &cache->buckets[hash_url(url) & (cache->num_buckets - 1)];
+   while (*slot != NULL && strcmp((*slot)->url, url) != 0) {
+      slot = &(*slot)->chain;
+   }
+
+   return slot;
+
+}
+
+/*
+ * Unlinks an entry from the recency list.
+ * Params:
+ *    struct cache *cache: The cache holding the entry
+ *    struct cache_entry *entry: The entry to unlink
+ */
+static void unlink_entry(struct cache *cache, struct cache_entry *entry) {
+
+   if (entry->newer != NULL) {
+      entry->newer->older = entry->older;
+   }
+   else {
+      cache->newest = entry->older;
+   }
+
+   if (entry->older != NULL) {
+      entry->older->newer = entry->newer;
+   }
+   else {
+      cache->oldest = entry->newer;
+   }
+
+   entry->newer = entry->older = NULL;
+
+}
+
+/*
+ * Makes an entry the most recently used one.
+ * Params:
+ *    struct cache *cache: The cache holding the entry
+ *    struct cache_entry *entry: The entry that was used
+ */
+static void touch_entry(struct cache *cache, struct cache_entry *entry) {
+
+   if (cache->newest == entry) {
+      return;
+   }
+
+   if (entry->newer != NULL || entry->older != NULL || cache->oldest == entry) {
+      unlink_entry(cache, entry);
+   }
+
+   entry->older = cache->newest;
+   if (cache->newest != NULL) {
+      cache->newest->newer = entry;
+   }
+   cache->newest = entry;
+
+   if (cache->oldest == NULL) {
+      cache->oldest = entry;
+   }
+
+}
+
+/*
+ * Removes an entry from the cache, freeing it unless a connection still uses
+ *    it.
+ * Params:
+ *    struct cache *cache: The cache holding the entry
+ *    struct cache_entry *entry: The entry to remove
+ */
+static void remove_entry(struct cache *cache, struct cache_entry *entry) {
+
+   *find_slot(cache, entry->url) = entry->chain;
+   unlink_entry(cache, entry);
+   cache->size -= entry->size;
+   cache->num_entries--;
+
+   entry->stale = 1;
+   if (entry->refs == 0) {
+      free_entry(entry);
+   }
+
+}
+
+/*
+ * Removes every entry from the cache.
+ * Params:
+ *    struct cache *cache: The cache to empty
+ */
+static void remove_all(struct cache *cache) {
+
+   while (cache->oldest != NULL) {
+      remove_entry(cache, cache->oldest);
+   }
+
+}
+
+/*
+ * Doubles the number of buckets once the chains get long.
+ * Params:
+ *    struct cache *cache: The cache to grow
+ */
+static void expand_buckets(struct cache *cache) {
+
+   struct cache_entry **old_buckets = cache->buckets, *entry, *next;
+   unsigned old_num_buckets = cache->num_buckets, index;
+
+   cache->num_buckets *= 2;
+   cache->buckets = malloc(cache->num_buckets * sizeof(struct cache_entry *));
+   memset(cache->buckets, 0, cache->num_buckets * sizeof(struct cache_entry *));
+
+   for (index = 0; index < old_num_buckets; index++) {
+      for (entry = old_buckets[index]; entry != NULL; entry = next) {
+         next = entry->chain;
+         entry->chain = NULL;
+         *find_slot(cache, entry->url) = entry;
+      }
+   }
+
+   free(old_buckets);
+
+}
+
+/*
+ * Watches the directory holding a url for changes, unless it already is.
+ *    Called before the file is opened, so any change after that invalidates
+ *    what is read from it.
+ * Params:
+ *    struct cache *cache: The cache to invalidate on changes
+ *    char *url: The url of a file about to be opened
+ */
+void cache_watch(struct cache *cache, char *url) {
+
+   char *prefix, *path;
+   size_t prefix_len = strrchr(url, '/') - url;
+   int wd, index;
+
+   prefix = malloc((prefix_len + 1) * sizeof(char));
+   memcpy(prefix, url, prefix_len);
+   prefix[prefix_len] = '\0';
+
+   path = malloc((strlen(cache->root) + 1) * sizeof(char));
+   strcpy(path, cache->root);
+   append_string(&path, prefix);
+
+   wd = inotify_add_watch(cache->inotify_fd, path, WATCH_MASK);
+   free(path);
+
+   /* Adding an existing watch hands back the same descriptor */
+   for (index = 0; index < cache->num_watches; index++) {
+      if (cache->watches[index].wd == wd) {
+         break;
+      }
+   }
+
+   if (wd < 0 || index < cache->num_watches) {
+      free(prefix);
+      return;
+   }
+
+   cache->watches = realloc(cache->watches,
+      (cache->num_watches + 1) * sizeof(struct cache_watch));
+   cache->watches[cache->num_watches].wd = wd;
+   cache->watches[cache->num_watches].prefix = prefix;
+   cache->num_watches++;
+
+}
+
+/*
+ * Stops watching every directory, they are watched again as files are cached.
+ * Params:
+ *    struct cache *cache: The cache to stop watching for
+ */
+static void remove_watches(struct cache *cache) {
+
+   while (cache->num_watches > 0) {
+      cache->num_watches--;
+      inotify_rm_watch(cache->inotify_fd,
+         cache->watches[cache->num_watches].wd);
+      free(cache->watches[cache->num_watches].prefix);
+   }
+
+}
+
+/*
+ * Creates an empty cache of the files below a document root, watching the
+ *    root for changes.
+ * Params:
+ *    char *root: The directory static files are served from
+ *    size_t capacity: The most body bytes the cache may hold
+ *    size_t max_entry_size: The largest file that is cached
+ * Returns:
+ *    struct cache *cache: The new cache
+ */
+struct cache *create_cache(char *root, size_t capacity, size_t max_entry_size) {
+
+   struct cache *cache = malloc(sizeof(struct cache));
+   memset(cache, 0, sizeof(struct cache));
+
+   cache->root = malloc((strlen(root) + 1) * sizeof(char));
+   strcpy(cache->root, root);
+   cache->capacity = capacity;
+   cache->max_entry_size = max_entry_size;
+
+   cache->num_buckets = DEFAULT_BUCKETS;
+   cache->buckets = malloc(cache->num_buckets * sizeof(struct cache_entry *));
+   memset(cache->buckets, 0, cache->num_buckets * sizeof(struct cache_entry *));
+
+   /* Without change notifications nothing could be cached safely */
+   if ((cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+      report_errno();
+   }
+
+   return cache;
+
+}
+
+/*
+ * Frees a cache along with every entry no connection is still using.
+ * Params:
+ *    struct cache *cache: The cache to be freed
+ */
+void free_cache(struct cache *cache) {
+
+   remove_all(cache);
+   remove_watches(cache);
+   close(cache->inotify_fd);
+
+   free(cache->watches);
+   free(cache->buckets);
+   free(cache->root);
+   free(cache);
+
+}
+
+/*
+ * Changes how much a cache may hold, evicting the least recently used assets
+ *    at once if it shrank.
+ * Params:
+ *    struct cache *cache: The cache to resize
+ *    size_t capacity: The most body bytes the cache may hold
+ *    size_t max_entry_size: The largest file that is cached from now on
+ */
+void cache_resize(struct cache *cache, size_t capacity,
+   size_t max_entry_size) {
+
+   cache->capacity = capacity;
+   cache->max_entry_size = max_entry_size;
+
+   while (cache->oldest != NULL && cache->size > cache->capacity) {
+      remove_entry(cache, cache->oldest);
+   }
+
+}
+
+/*
+ * Finds the cached asset for a url. The entry is held until it is passed to
+ *    cache_release.
+ * Params:
+ *    struct cache *cache: The cache to search
+ *    char *url: The url of the asset, relative to the document root
+ * Returns:
+ *    struct cache_entry *entry: The asset, or NULL if it isn't cached
+ */
+struct cache_entry *cache_acquire(struct cache *cache, char *url) {
+
+   struct cache_entry *entry = *find_slot(cache, url);
+
+   if (entry != NULL) {
+      touch_entry(cache, entry);
+      entry->refs++;
+   }
+
+   return entry;
+
+}
+
+/*
+ * Decides whether a media type is text that is worth compressing.
+ * Params:
+ *    const char *type: The media type of an asset
+ * Returns:
+ *    int compressible: 1 if the asset should be compressed, 0 otherwise
+ */
+static int is_compressible(const char *type) {
+
+   return strncmp(type, "text/", 5) == 0 || strstr(type, "javascript") != NULL
+      || strstr(type, "json") != NULL || strstr(type, "xml") != NULL;
+
+}
+
+/*
+ * Compresses bytes in the gzip format.
+ * Params:
+ *    const char *body: The bytes to compress
+ *    size_t len: The number of bytes
+ *    size_t *out_len: Filled with the length of the compressed bytes
+ * Returns:
+ *    char *out: The compressed bytes, or NULL if compression failed
+ */
+static char *gzip_compress(const char *body, size_t len, size_t *out_len) {
+
+   z_stream stream;
+   char *out;
+
+   memset(&stream, 0, sizeof(z_stream));
+
+   /* 16 added to the window bits asks for a gzip header and trailer */
+   if (deflateInit2(&stream, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+      Z_DEFAULT_STRATEGY) != Z_OK) {
+      return NULL;
+   }
+
+   *out_len = deflateBound(&stream, len);
+   out = malloc(*out_len);
+   stream.next_in = (Bytef *) body;
+   stream.avail_in = len;
+   stream.next_out = (Bytef *) out;
+   stream.avail_out = *out_len;
+
+   if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+      deflateEnd(&stream);
+      free(out);
+      return NULL;
+   }
+
+   *out_len = stream.total_out;
+   deflateEnd(&stream);
+   return out;
+
+}
+
+/*
+ * Compresses bytes in the brotli format, if the server was built with it.
+ * Params:
+ *    const char *body: The bytes to compress
+ *    size_t len: The number of bytes
+ *    size_t *out_len: Filled with the length of the compressed bytes
+ * Returns:
+ *    char *out: The compressed bytes, or NULL if compression failed
+ */
+static char *brotli_compress(const char *body, size_t len, size_t *out_len) {
+
+#ifdef HAVE_BROTLI
+   char *out;
+
+   *out_len = BrotliEncoderMaxCompressedSize(len);
+   if (*out_len == 0) {
+      return NULL;
+   }
+   out = malloc(*out_len);
+
+   if (!BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW,
+      BROTLI_MODE_TEXT, len, (const uint8_t *) body, out_len,
+      (uint8_t *) out)) {
+      free(out);
+      return NULL;
+   }
+
+   return out;
+#else
+   return NULL;
+#endif
+
+}
+
+/*
+ * Stores one coding of an asset along with its entity headers.
+ * Params:
+ *    struct cache_entry *entry: The entry the asset belongs to
+ *    int encoding: The content coding of body
+ *    char *body: The coded bytes, now owned by the entry
+ *    size_t len: The number of coded bytes
+ *    const char *type: The media type of the asset
+ *    const char *etag: The quoted entity tag of the uncompressed bytes
+ *    int vary: 1 if the asset is negotiated by Accept-Encoding, 0 otherwise
+ */
+static void add_variant(struct cache_entry *entry, int encoding, char *body,
+   size_t len, const char *type, const char *etag, int vary) {
+
+   struct cache_variant *variant = &entry->variants[encoding];
+   char headers[512], date[HTTP_DATE_LEN];
+
+   sprintf(headers, "Content-Length: %lu\r\nContent-Type: %s\r\n"
+      "Accept-Ranges: bytes\r\n", (unsigned long) len, type);
+   if (encoding_names[encoding] != NULL) {
+      sprintf(headers + strlen(headers), "Content-Encoding: %s\r\n",
+         encoding_names[encoding]);
+   }
+
+   /* Every coding is a representation of its own with its own tag, the
+    * name of the coding goes inside the quotes */
+   sprintf(variant->etag, "%.*s%s\"", (int) strlen(etag) - 1, etag,
+      encoding_names[encoding] != NULL ? encoding_names[encoding] : "");
+   format_http_date(date, sizeof(date), entry->mtime);
+   variant->validators_offset = strlen(headers);
+   sprintf(headers + variant->validators_offset,
+      "ETag: %s\r\nLast-Modified: %s\r\n", variant->etag, date);
+   if (vary) {
+      strcat(headers, "Vary: Accept-Encoding\r\n");
+   }
+
+   variant->body = body;
+   variant->body_len = len;
+   variant->headers_len = strlen(headers);
+   variant->headers = malloc(variant->headers_len * sizeof(char));
+   memcpy(variant->headers, headers, variant->headers_len);
+   entry->size += len;
+
+}
+
+/*
+ * Adds the compressed codings of an asset that turn out smaller than it.
+ * Params:
+ *    struct cache_entry *entry: The entry holding the identity coding
+ *    const char *type: The media type of the asset
+ *    const char *etag: The quoted entity tag of the uncompressed bytes
+ */
+static void add_compressed_variants(struct cache_entry *entry,
+   const char *type, const char *etag) {
+
+   struct cache_variant *identity = &entry->variants[ENCODING_IDENTITY];
+   char *body;
+   size_t len;
+   int encoding;
+
+   for (encoding = ENCODING_GZIP; encoding < NUM_ENCODINGS; encoding++) {
+
+      if (encoding == ENCODING_GZIP) {
+         body = gzip_compress(identity->body, identity->body_len, &len);
+      }
+      else {
+         body = brotli_compress(identity->body, identity->body_len, &len);
+      }
+
+      if (body != NULL && len < identity->body_len) {
+         add_variant(entry, encoding, body, len, type, etag, 1);
+      }
+      else {
+         free(body);
+      }
+
+   }
+
+}
+
+/*
+ * Builds an entry around the uncompressed bytes of an asset, compressing
+ *    text in every coding that makes it smaller.
+ * Params:
+ *    char *url: The url of the asset, relative to the document root
+ *    char *body: The uncompressed bytes
+ *    size_t len: The number of bytes
+ *    const char *type: The media type of the asset
+ *    const char *etag: The quoted entity tag of the bytes
+ *    time_t mtime: When the asset was last modified
+ *    int compress: 1 if compressed codings should be made, 0 otherwise
+ * Returns:
+ *    struct cache_entry *entry: The new entry, not yet in any cache
+ */
+static struct cache_entry *create_entry(char *url, char *body, size_t len,
+   const char *type, const char *etag, time_t mtime, int compress) {
+
+   struct cache_entry *entry = malloc(sizeof(struct cache_entry));
+   int compressible = compress && is_compressible(type);
+
+   memset(entry, 0, sizeof(struct cache_entry));
+   entry->mtime = mtime;
+   entry->url = malloc((strlen(url) + 1) * sizeof(char));
+   strcpy(entry->url, url);
+
+   add_variant(entry, ENCODING_IDENTITY, body, len, type, etag,
+      compressible);
+   if (compressible) {
+      add_compressed_variants(entry, type, etag);
+   }
+
+   return entry;
+
+}
+
+/*
+ * Adds a new entry to a cache, evicting the least recently used assets to
+ *    make room, and holds it for the caller.
+ * Params:
+ *    struct cache *cache: The cache to add the entry to
+ *    struct cache_entry *entry: The entry to add
+ * Returns:
+ *    struct cache_entry *entry: The entry, held until cache_release
+ */
+static struct cache_entry *insert_entry(struct cache *cache,
+   struct cache_entry *entry) {
+
+   /* Evict the least recently used assets until the new one fits */
+   while (cache->oldest != NULL &&
+      cache->size + entry->size > cache->capacity) {
+      remove_entry(cache, cache->oldest);
+   }
+
+   if (cache->num_entries >= cache->num_buckets) {
+      expand_buckets(cache);
+   }
+
+   *find_slot(cache, entry->url) = entry;
+   touch_entry(cache, entry);
+   cache->size += entry->size;
+   cache->num_entries++;
+
+   entry->refs++;
+   return entry;
+
+}
+
+/*
+ * Reads an opened static file into the cache, evicting the least recently
+ *    used assets to make room. Its directory must have been watched with
+ *    cache_watch before the file was opened. Text is compressed once here,
+ *    in every coding that makes it smaller. The entry is held until it is
+ *    passed to cache_release.
+ * Params:
+ *    struct cache *cache: The cache to add the asset to
+ *    char *url: The url of the asset, relative to the document root
+ *    int fd: The open file of the asset
+ *    struct stat *info: The status of the open file
+ * Returns:
+ *    struct cache_entry *entry: The asset, or NULL if it can't be cached
+ */
+struct cache_entry *cache_load(struct cache *cache, char *url, int fd,
+   struct stat *info) {
+
+   size_t length = info->st_size, received_len = 0;
+   ssize_t received;
+   char *body, etag[ETAG_LEN];
+
+   if (length > cache->max_entry_size || length > cache->capacity) {
+      return NULL;
+   }
+
+   body = malloc(length > 0 ? length : 1);
+
+   while (received_len < length) {
+
+      received = read(fd, body + received_len, length - received_len);
+
+      if (received == 0) {
+         break;
+      }
+      else if (received < 0 && errno != EINTR) {
+         free(body);
+         return NULL;
+      }
+      else if (received > 0) {
+         received_len += received;
+      }
+
+   }
+
+   format_etag(etag, info);
+   return insert_entry(cache, create_entry(url, body, received_len,
+      mime_type(url), etag, info->st_mtime, 1));
+
+}
+
+/*
+ * Adds an asset whose bytes stay in memory owned by someone else, such as a
+ *    mapped bundle, for as long as the cache exists. Only its compressed
+ *    codings, made here for text no larger than the largest cached file,
+ *    count towards the capacity. The entry is held until it is passed to
+ *    cache_release.
+ * Params:
+ *    struct cache *cache: The cache to add the asset to
+ *    char *url: The url of the asset, relative to the document root
+ *    const char *body: The uncompressed bytes of the asset
+ *    size_t len: The number of bytes
+ *    const char *type: The media type of the asset
+ *    const char *etag: The quoted strong entity tag of the bytes
+ *    time_t mtime: When the asset was last modified
+ * Returns:
+ *    struct cache_entry *entry: The asset
+ */
+struct cache_entry *cache_load_memory(struct cache *cache, char *url,
+   const char *body, size_t len, const char *type, const char *etag,
+   time_t mtime) {
+
+   struct cache_entry *entry = create_entry(url, (char *) body, len, type,
+      etag, mtime, len <= cache->max_entry_size);
+
+   entry->borrowed = 1;
+   entry->size -= len;
+
+   return insert_entry(cache, entry);
+
+}
+
+/*
+ * Releases an entry returned by cache_acquire or cache_load.
+ * Params:
+ *    struct cache_entry *entry: The entry no longer in use
+ */
+void cache_release(struct cache_entry *entry) {
+
+   /* The entry was dropped from the cache while in use */
+   if (--entry->refs == 0 && entry->stale) {
+      free_entry(entry);
+   }
+
+}
+
+/*
+ * Drops every entry whose file changed, as reported by inotify.
+ * Params:
+ *    struct cache *cache: The cache to invalidate entries in
+ */
+void cache_process_events(struct cache *cache) {
+
+   char events[EVENT_BUFFER_LEN], *url, *position;
+   struct inotify_event *event;
+   struct cache_entry *entry;
+   ssize_t received;
+   int index;
+
+   while ((received = read(cache->inotify_fd, events, sizeof(events))) > 0 ||
+      (received < 0 && errno == EINTR)) {
+
+      for (position = events; position < events + received;
+         position += sizeof(struct inotify_event) + event->len) {
+
+         event = (struct inotify_event *) position;
+
+         for (index = 0; index < cache->num_watches; index++) {
+            if (cache->watches[index].wd == event->wd) {
+               break;
+            }
+         }
+
+         /* Events were lost, a directory moved or a watch went away on its
+          * own, trust nothing. Watches removed here only report back */
+         if (event->mask & (IN_Q_OVERFLOW | IN_ISDIR | IN_DELETE_SELF |
+            IN_MOVE_SELF) ||
+            (event->mask & IN_IGNORED && index < cache->num_watches)) {
+            remove_all(cache);
+            remove_watches(cache);
+            continue;
+         }
+
+         if (index == cache->num_watches || event->len == 0) {
+            continue;
+         }
+
+         /* Rebuild the url of the changed file and drop it */
+         url = malloc((strlen(cache->watches[index].prefix) + 2) *
+            sizeof(char));
+         sprintf(url, "%s/", cache->watches[index].prefix);
+         append_string(&url, event->name);
+
+         if ((entry = *find_slot(cache, url)) != NULL) {
+            remove_entry(cache, entry);
+         }
+
+         free(url);
+
+      }
+
+   }
+
+}
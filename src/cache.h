@@ -0,0 +1,189 @@
+/*
+ * cache.h
+ * Makes available the in-memory cache of static assets.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Content codings an asset may be cached in, identity always is */
+#define ENCODING_IDENTITY 0
+#define ENCODING_GZIP     1
+#define ENCODING_BROTLI   2
+#define NUM_ENCODINGS     3
+
+/* Room for a quoted entity tag along with its '\0' */
+#define ETAG_LEN          80
+
+/*
+ * The bytes of an asset in one content coding, with its entity headers
+ *    already serialized. The headers from validators_offset on are the ones
+ *    repeated in a 304 response. Codings that weren't worth storing have no
+ *    body.
+ */
+struct cache_variant {
+   char *body;
+   size_t body_len;
+   char *headers;
+   size_t headers_len, validators_offset;
+   char etag[ETAG_LEN];
+};
+
+/*
+ * A cached static asset. Entries dropped from the cache while connections are
+ *    still sending them are freed once the last connection releases them.
+ *    Borrowed entries don't own their uncompressed bytes.
+ */
+struct cache_entry {
+   char *url;
+   struct cache_variant variants[NUM_ENCODINGS];
+   size_t size;
+   time_t mtime;
+   int refs, stale, borrowed;
+   struct cache_entry *chain;
+   struct cache_entry *newer, *older;
+};
+
+struct cache_watch {
+   int wd;
+   char *prefix;
+};
+
+struct cache {
+   char *root;
+   struct cache_entry **buckets;
+   unsigned num_buckets, num_entries;
+   struct cache_entry *newest, *oldest;
+   size_t size, capacity, max_entry_size;
+   int inotify_fd;
+   struct cache_watch *watches;
+   int num_watches;
+};
+
+/*
+ * Creates an empty cache of the files below a document root, watching the
+ *    root for changes.
+ * Params:
+ *    char *root: The directory static files are served from
+ *    size_t capacity: The most body bytes the cache may hold
+ *    size_t max_entry_size: The largest file that is cached
+ * Returns:
+ *    struct cache *cache: The new cache
+ */
+struct cache *create_cache(char *, size_t, size_t);
+
+/*
+ * Frees a cache along with every entry no connection is still using.
+ * Params:
+ *    struct cache *cache: The cache to be freed
+ */
+void free_cache(struct cache *);
+
+/*
+ * Changes how much a cache may hold, evicting the least recently used assets
+ *    at once if it shrank.
+ * Params:
+ *    struct cache *cache: The cache to resize
+ *    size_t capacity: The most body bytes the cache may hold
+ *    size_t max_entry_size: The largest file that is cached from now on
+ */
+void cache_resize(struct cache *, size_t, size_t);
+
+/*
+ * Finds the cached asset for a url. The entry is held until it is passed to
+ *    cache_release.
+ * Params:
+ *    struct cache *cache: The cache to search
+ *    char *url: The url of the asset, relative to the document root
+ * Returns:
+ *    struct cache_entry *entry: The asset, or NULL if it isn't cached
+ */
+struct cache_entry *cache_acquire(struct cache *, char *);
+
+/*
+ * Watches the directory holding a url for changes, unless it already is.
+ *    Called before the file is opened, so any change after that invalidates
+ *    what is read from it.
+ * Params:
+ *    struct cache *cache: The cache to invalidate on changes
+ *    char *url: The url of a file about to be opened
+ */
+void cache_watch(struct cache *, char *);
+
+/*
+ * Reads an opened static file into the cache, evicting the least recently
+ *    used assets to make room. Its directory must have been watched with
+ *    cache_watch before the file was opened. Text is compressed once here,
+ *    in every coding that makes it smaller. The entry is held until it is
+ *    passed to cache_release.
+ * Params:
+ *    struct cache *cache: The cache to add the asset to
+ *    char *url: The url of the asset, relative to the document root
+ *    int fd: The open file of the asset
+ *    struct stat *info: The status of the open file
+ * Returns:
+ *    struct cache_entry *entry: The asset, or NULL if it can't be cached
+ */
+struct cache_entry *cache_load(struct cache *, char *, int, struct stat *);
+
+/*
+ * Adds an asset whose bytes stay in memory owned by someone else, such as a
+ *    mapped bundle, for as long as the cache exists. Only its compressed
+ *    codings, made here for text no larger than the largest cached file,
+ *    count towards the capacity. The entry is held until it is passed to
+ *    cache_release.
+ * Params:
+ *    struct cache *cache: The cache to add the asset to
+ *    char *url: The url of the asset, relative to the document root
+ *    const char *body: The uncompressed bytes of the asset
+ *    size_t len: The number of bytes
+ *    const char *type: The media type of the asset
+ *    const char *etag: The quoted strong entity tag of the bytes
+ *    time_t mtime: When the asset was last modified
+ * Returns:
+ *    struct cache_entry *entry: The asset
+ */
+struct cache_entry *cache_load_memory(struct cache *, char *, const char *,
+   size_t, const char *, const char *, time_t);
+
+/*
+ * Releases an entry returned by cache_acquire or cache_load.
+ * Params:
+ *    struct cache_entry *entry: The entry no longer in use
+ */
+void cache_release(struct cache_entry *);
+
+/*
+ * Drops every entry whose file changed, as reported by inotify.
+ * Params:
+ *    struct cache *cache: The cache to invalidate entries in
+ */
+void cache_process_events(struct cache *);
+
+#endif
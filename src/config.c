@@ -1,6 +1,6 @@
 /*
  * config.c
- * Sets the default configuration of a server.
+ * Reads the settings of the server and sets up its listening sockets.
  *
  * Author:   Brandon M. Kelley
  * Date:     May 8, 2016
@@ -24,7 +24,14 @@
  * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
@@ -32,80 +39,668 @@
 #include "util.h"
 
 #define PROTOCOL 0
-#define PORT 8000
+#define MAX_CONFIG_LINE 1024
+
+/* Kinds of values a setting takes */
+#define TYPE_INT     0
+#define TYPE_SIZE    1
+#define TYPE_FLAG    2
+#define TYPE_STRING  3
+#define TYPE_ADDRESS 4
+#define TYPE_POLICY  5
+
+/* Every setting, where it is kept and the values it takes. Workers pick up
+ *    the settings marked restart only when they are replaced, the others
+ *    change in place */
+static const struct setting {
+   const char *name;
+   int type;
+   size_t offset;
+   unsigned long min, max;
+   int restart;
+} settings[] = {
+   { "listen", TYPE_ADDRESS, offsetof(struct config, address), 0, 0, 1 },
+   { "port", TYPE_INT, offsetof(struct config, port), 1, 65535, 1 },
+   { "backlog", TYPE_INT, offsetof(struct config, backlog), 1, 65535, 0 },
+   { "workers", TYPE_INT, offsetof(struct config, workers), 1, MAX_WORKERS,
+      0 },
+   { "uring", TYPE_FLAG, offsetof(struct config, uring), 0, 1, 1 },
+   { "buffer_size", TYPE_SIZE, offsetof(struct config, buffer_size), 256,
+      16 * 1024 * 1024, 0 },
+   { "max_request_line", TYPE_SIZE, offsetof(struct config, max_line), 64,
+      1024 * 1024, 0 },
+   { "max_header_bytes", TYPE_SIZE,
+      offsetof(struct config, max_header_bytes), 64, 1024 * 1024, 0 },
+   { "max_headers", TYPE_INT, offsetof(struct config, max_headers), 1,
+      10000, 0 },
+   { "max_request_body", TYPE_SIZE, offsetof(struct config, max_body), 0,
+      0x7fffffffUL, 0 },
+   { "memory_budget", TYPE_SIZE, offsetof(struct config, memory_budget), 0,
+      (unsigned long) -1, 0 },
+   { "cache_capacity", TYPE_SIZE, offsetof(struct config, cache_capacity), 0,
+      (unsigned long) -1, 0 },
+   { "cache_max_entry", TYPE_SIZE, offsetof(struct config, cache_max_entry),
+      0, (unsigned long) -1, 0 },
+   { "header_timeout", TYPE_INT,
+      offsetof(struct config, timeouts) + DEADLINE_HEADER * sizeof(int), 1,
+      86400, 0 },
+   { "body_timeout", TYPE_INT,
+      offsetof(struct config, timeouts) + DEADLINE_BODY * sizeof(int), 1,
+      86400, 0 },
+   { "idle_timeout", TYPE_INT,
+      offsetof(struct config, timeouts) + DEADLINE_IDLE * sizeof(int), 1,
+      86400, 0 },
+   { "write_timeout", TYPE_INT,
+      offsetof(struct config, timeouts) + DEADLINE_WRITE * sizeof(int), 1,
+      86400, 0 },
+   { "root", TYPE_STRING, offsetof(struct config, root), 1, 0, 0 },
+   { "access_log", TYPE_STRING, offsetof(struct config, log), 0, 0, 1 },
+   { "log_block", TYPE_FLAG, offsetof(struct config, log_block), 0, 1, 1 },
+   { "bundle", TYPE_STRING, offsetof(struct config, bundle), 0, 0, 1 },
+   { "stream_route", TYPE_FLAG, offsetof(struct config, stream_route), 0, 1,
+      0 },
+   { "cache_control", TYPE_POLICY, offsetof(struct config, cache_control), 0,
+      0, 0 }
+};
+
+#define NUM_SETTINGS ((int) (sizeof(settings) / sizeof(settings[0])))
+
+/*
+ * Give the static files below a url prefix their own Cache-Control policy,
+ *    replacing the one the prefix had.
+ * Params:
+ *    struct cache_policies *policies: The policies to change
+ *    const char *prefix: The url prefix, starting with /
+ *    const char *policy: The policy, - to drop that of the prefix
+ * Returns:
+ *    const char *error: What is wrong with the policy, or NULL if it was set
+ */
+static const char *set_cache_policy(struct cache_policies *policies,
+   const char *prefix, const char *policy) {
+
+   int index;
+
+   if (prefix[0] != '/') {
+      return "expected a url prefix and a policy";
+   }
+
+   if (strlen(prefix) >= CONFIG_STRING_LEN ||
+      strlen(policy) >= CONFIG_STRING_LEN) {
+      return "too long";
+   }
+
+   for (index = 0; index < policies->count &&
+      strcmp(policies->policies[index].prefix, prefix) != 0; index++);
+
+   /* Dropping one moves the last into its place */
+   if (strcmp(policy, "-") == 0) {
+      if (index < policies->count) {
+         policies->policies[index] = policies->policies[--policies->count];
+      }
+      return NULL;
+   }
+
+   if (index == MAX_CACHE_POLICIES) {
+      return "too many policies";
+   }
+
+   if (index == policies->count) {
+      policies->count++;
+   }
+
+   strcpy(policies->policies[index].prefix, prefix);
+   strcpy(policies->policies[index].policy, policy);
+   return NULL;
+
+}
+
+/*
+ * Fill in the settings the server runs with when nothing else is given.
+ * Params:
+ *    struct config *config: The settings to be filled
+ */
+static void config_defaults(struct config *config) {
+
+   long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+   memset(config, 0, sizeof(struct config));
+
+   /* Listen on every address, with one worker per online core */
+   strcpy(config->address, "0.0.0.0");
+   config->port = 8000;
+   config->backlog = 10;
+   config->workers = cores < 1 ? 1 : cores > MAX_WORKERS ? MAX_WORKERS
+      : (int) cores;
+   config->uring = 1;
+
+   /* Larger requests get a 414, 431 or 413, and connections between
+    * requests wait for the rest to fit in the memory budget */
+   config->buffer_size = 4096;
+   config->max_line = 8192;
+   config->max_header_bytes = 16 * 1024;
+   config->max_headers = 100;
+   config->max_body = 1024 * 1024;
+   config->memory_budget = 64 * 1024 * 1024;
+
+   config->cache_capacity = 64 * 1024 * 1024;
+   config->cache_max_entry = 1024 * 1024;
+
+   /* Seconds each deadline of a connection allows */
+   config->timeouts[DEADLINE_HEADER] = 10;
+   config->timeouts[DEADLINE_BODY] = 10;
+   config->timeouts[DEADLINE_IDLE] = 15;
+   config->timeouts[DEADLINE_WRITE] = 30;
+
+   /* Serve the static directory, logging to stdout */
+   strcpy(config->root, "static");
+
+   /* Without max-age clients revalidate every time, which costs a 304 at
+    * most. Versioned assets never change */
+   set_cache_policy(&config->cache_control, "/", "no-cache");
+   set_cache_policy(&config->cache_control, "/assets/",
+      "public, max-age=31536000, immutable");
+
+}
+
+/*
+ * Parse a size, optionally followed by k, m or g for a multiple of 1024.
+ * Params:
+ *    const char *text: The size to parse
+ *    unsigned long *size: Filled with the size
+ * Returns:
+ *    int result: 0 on success, -1 if the text isn't a size
+ */
+static int parse_size(const char *text, unsigned long *size) {
+
+   unsigned long scale = 1;
+   char *end;
+
+   if (!isdigit((unsigned char) text[0])) {
+      return -1;
+   }
+
+   errno = 0;
+   *size = strtoul(text, &end, 10);
+
+   switch (tolower((unsigned char) *end)) {
+      case 'g':
+         scale *= 1024;
+      case 'm':
+         scale *= 1024;
+      case 'k':
+         scale *= 1024;
+         end++;
+   }
+
+   if (errno != 0 || *end != '\0' || *size > (unsigned long) -1 / scale) {
+      return -1;
+   }
+
+   *size *= scale;
+   return 0;
+
+}
+
+/*
+ * Change one setting.
+ * Params:
+ *    struct config *config: The settings to change
+ *    const char *name: The name of the setting
+ *    const char *value: Its new value, - to turn a string setting off
+ * Returns:
+ *    const char *error: What is wrong with the setting, or NULL if it was
+ *       changed
+ */
+static const char *config_set(struct config *config, const char *name,
+   const char *value) {
+
+   const struct setting *setting = settings;
+   char *field, prefix[CONFIG_STRING_LEN];
+   unsigned long number;
+   struct in_addr address;
+   size_t prefix_len;
+
+   while (setting < settings + NUM_SETTINGS && strcmp(setting->name, name)) {
+      setting++;
+   }
+
+   if (setting == settings + NUM_SETTINGS) {
+      return "unknown setting";
+   }
+
+   field = (char *) config + setting->offset;
+
+   switch (setting->type) {
+
+      case TYPE_FLAG:
+         if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0) {
+            return "expected on or off";
+         }
+         *(int *) field = strcmp(value, "on") == 0;
+         break;
+
+      case TYPE_INT:
+      case TYPE_SIZE:
+         if (parse_size(value, &number) < 0 ||
+            (setting->type == TYPE_INT && !isdigit((unsigned char)
+            value[strlen(value) - 1]))) {
+            return "expected a number";
+         }
+         if (number < setting->min || number > setting->max) {
+            return "out of range";
+         }
+         if (setting->type == TYPE_INT) {
+            *(int *) field = (int) number;
+         }
+         else {
+            *(size_t *) field = number;
+         }
+         break;
+
+      /* The url prefix comes first, the policy is the rest of the value */
+      case TYPE_POLICY:
+         prefix_len = strcspn(value, " \t");
+         if (prefix_len >= CONFIG_STRING_LEN) {
+            return "too long";
+         }
+         memcpy(prefix, value, prefix_len);
+         prefix[prefix_len] = '\0';
+         for (value += prefix_len; isspace((unsigned char) *value); value++);
+         if (*value == '\0') {
+            return "expected a url prefix and a policy";
+         }
+         return set_cache_policy((struct cache_policies *) field, prefix,
+            value);
+
+      default:
+         if (strcmp(value, "-") == 0) {
+            value = "";
+         }
+         if (strlen(value) < setting->min) {
+            return "can't be turned off";
+         }
+         if (strlen(value) >= CONFIG_STRING_LEN) {
+            return "too long";
+         }
+         if (setting->type == TYPE_ADDRESS &&
+            inet_pton(AF_INET, value, &address) != 1) {
+            return "expected an IPv4 address";
+         }
+         strcpy(field, value);
+
+   }
+
+   return NULL;
+
+}
+
+/*
+ * Read the settings of a configuration file, one name and value per line.
+ *    Anything after a # is a comment.
+ * Params:
+ *    struct config *config: The settings to change
+ *    const char *path: The file to read
+ * Returns:
+ *    int errors: The number of mistakes found and reported
+ */
+static int read_config_file(struct config *config, const char *path) {
+
+   FILE *file = fopen(path, "r");
+   char line[MAX_CONFIG_LINE], *name, *value, *end;
+   const char *error;
+   int number = 0, errors = 0;
+
+   if (file == NULL) {
+      fprintf(stderr, "Can't read config %s: %s\n", path, strerror(errno));
+      return 1;
+   }
+
+   while (fgets(line, sizeof(line), file) != NULL) {
+
+      number++;
+
+      if (strchr(line, '\n') == NULL && !feof(file)) {
+         fprintf(stderr, "%s:%d: line too long\n", path, number);
+         errors++;
+         break;
+      }
+
+      /* Drop the comment, then split off the name at the first space */
+      if ((end = strchr(line, '#')) != NULL) {
+         *end = '\0';
+      }
+
+      for (name = line; isspace((unsigned char) *name); name++);
+      for (value = name; *value != '\0' && !isspace((unsigned char) *value);
+         value++);
+
+      if (*name == '\0') {
+         continue;
+      }
+
+      if (*value != '\0') {
+         *value++ = '\0';
+      }
+
+      /* The value is the rest of the line, trimmed */
+      for (; isspace((unsigned char) *value); value++);
+      for (end = value + strlen(value); end > value &&
+         isspace((unsigned char) end[-1]); end--);
+      *end = '\0';
+
+      if (*value == '\0') {
+         error = "missing value";
+      }
+      else {
+         error = config_set(config, name, value);
+      }
+
+      if (error != NULL) {
+         fprintf(stderr, "%s:%d: %s: %s\n", path, number, name, error);
+         errors++;
+      }
+
+   }
+
+   fclose(file);
+   return errors;
+
+}
+
+/*
+ * Reads the settings from their source, on top of the defaults. Every
+ *    mistake found is reported.
+ * Params:
+ *    struct config *config: Filled with the settings, left alone on failure
+ *    const struct config_source *source: Where to read the settings from
+ * Returns:
+ *    int result: 0 on success, -1 if the settings are invalid
+ */
+int load_config(struct config *config, const struct config_source *source) {
+
+   struct config fresh;
+   const char *error;
+   int index, errors = 0;
+
+   config_defaults(&fresh);
+
+   if (source->path != NULL) {
+      errors += read_config_file(&fresh, source->path);
+   }
+
+   /* The command line has the last word */
+   for (index = 0; index < source->num_overrides; index++) {
+      error = config_set(&fresh, source->overrides[index][0],
+         source->overrides[index][1]);
+      if (error != NULL) {
+         fprintf(stderr, "Option %s: %s\n", source->overrides[index][0],
+            error);
+         errors++;
+      }
+   }
+
+   if (errors > 0) {
+      return -1;
+   }
+
+   memcpy(config, &fresh, sizeof(struct config));
+   return 0;
+
+}
+
+/*
+ * Tell how many bytes a setting takes up in the settings.
+ * Params:
+ *    const struct setting *setting: The setting
+ * Returns:
+ *    size_t size: The size of its field
+ */
+static size_t setting_size(const struct setting *setting) {
+
+   if (setting->type == TYPE_SIZE) {
+      return sizeof(size_t);
+   }
+
+   if (setting->type == TYPE_POLICY) {
+      return sizeof(struct cache_policies);
+   }
+
+   return setting->type == TYPE_INT || setting->type == TYPE_FLAG ?
+      sizeof(int) : CONFIG_STRING_LEN;
+
+}
+
+/*
+ * Tells whether settings differ in any way that only workers started after
+ *    the change can take up.
+ * Params:
+ *    const struct config *old: The settings running workers started with
+ *    const struct config *new: The settings just read
+ * Returns:
+ *    int restart: 1 if the workers have to be replaced, 0 otherwise
+ */
+int config_restart_needed(const struct config *old, const struct config *new) {
+
+   int index;
+
+   for (index = 0; index < NUM_SETTINGS; index++) {
+      if (settings[index].restart && memcmp((char *) old +
+         settings[index].offset, (char *) new + settings[index].offset,
+         setting_size(&settings[index])) != 0) {
+         return 1;
+      }
+   }
+
+   return 0;
+
+}
+
+/*
+ * Copies the settings a running worker can change in place.
+ * Params:
+ *    struct config *config: The settings to update
+ *    const struct config *fresh: The settings just read
+ */
+void config_apply(struct config *config, const struct config *fresh) {
+
+   int index;
+
+   for (index = 0; index < NUM_SETTINGS; index++) {
+      if (!settings[index].restart) {
+         memcpy((char *) config + settings[index].offset,
+            (char *) fresh + settings[index].offset,
+            setting_size(&settings[index]));
+      }
+   }
+
+}
 
 /*
  * Configure the server socket to listen for IP requests.
  * Params:
  *    int *svr_socket: The socket that identifies the internet connection
+ * Returns:
+ *    int result: 0 on success, -1 on failure with errno set
  */
-static void set_socket_options(int *svr_socket) {
+static int set_socket_options(int *svr_socket) {
 
    /* Basically just the boolean value of true */
    int set_option = 1;
 
    /* Try to create an IP socket */
-   *svr_socket = socket(AF_INET, SOCK_STREAM, PROTOCOL);
-
-   if (*svr_socket < 1) {
-      report_errno();
+   if ((*svr_socket = socket(AF_INET, SOCK_STREAM, PROTOCOL)) < 0) {
+      return -1;
    }
 
-   /* Try to configure IP socket to reuse addresses */
-   set_option = setsockopt(*svr_socket, SOL_SOCKET, SO_REUSEADDR, &set_option,
-      sizeof(int));
-
-   if (set_option < 0) {
-      report_errno();
+   /* Try to configure IP socket to reuse addresses, and let every worker
+    * bind its own socket to the same port */
+   if (setsockopt(*svr_socket, SOL_SOCKET, SO_REUSEADDR, &set_option,
+      sizeof(int)) < 0 || setsockopt(*svr_socket, SOL_SOCKET, SO_REUSEPORT,
+      &set_option, sizeof(int)) < 0) {
+      return -1;
    }
 
+   return 0;
+
 }
 
 /*
  * Populate address struct with internet socket settings.
  * Params:
  *    struct sockaddr_in *addr: the struct containing settings, to be filled
+ *    const struct config *config: The settings holding the address and port
  */
-static void set_addr_options(struct sockaddr_in *addr) {
+static void set_addr_options(struct sockaddr_in *addr,
+   const struct config *config) {
 
-   /* Listens for IP from any address on PORT */
+   /* Listens for IP on the configured address and port */
+   memset(addr, 0, sizeof(struct sockaddr_in));
    addr->sin_family = AF_INET;
-   addr->sin_addr.s_addr = INADDR_ANY;
-   addr->sin_port = htons(PORT);
+   inet_pton(AF_INET, config->address, &addr->sin_addr);
+   addr->sin_port = htons(config->port);
 
 }
 
 /*
  * Binds the address settings established in set_addr_options to the server
- *    socket established in set_socket_options.
+ *    socket established in set_socket_options, and starts listening.
  * Params:
  *    struct svr_info *svr: The struct holding the socket and address settings
+ *    int backlog: The most connections waiting to be accepted
+ * Returns:
+ *    int result: 0 on success, -1 on failure with errno set
  */
-static void bind_server(struct svr_info *svr) {
+static int bind_server(struct svr_info *svr, int backlog) {
 
    /* Try to bind the address settings to the server socket */
    socklen_t addr_len = sizeof(svr->addr);
-   int result = bind(svr->socket, (struct sockaddr *) &svr->addr, addr_len);
 
-   if (result < 0) {
-      report_errno();
+   if (bind(svr->socket, (struct sockaddr *) &svr->addr, addr_len) < 0 ||
+      set_nonblocking(svr->socket) < 0 || listen(svr->socket, backlog) < 0) {
+      return -1;
    }
 
-   /* Print a message to the console */
-   printf("Server root bound to localhost:%d/\n", PORT);
+   return 0;
 
 }
 
 /*
- * Configure the server with default settings.
+ * Configure a server to listen on the address and port of the settings.
  * Params:
  *    struct svr_info *svr: The server to be configured
+ *    const struct config *config: The settings to listen with
+ * Returns:
+ *    int result: 0 on success, -1 if the server can't listen
  */
-void config_server(struct svr_info *svr) {
+int config_server(struct svr_info *svr, const struct config *config) {
 
    /* Configure and bind server */
-   set_socket_options(&svr->socket);
-   set_addr_options(&svr->addr);
-   bind_server(svr);
+   set_addr_options(&svr->addr, config);
+
+   if (set_socket_options(&svr->socket) < 0 ||
+      bind_server(svr, config->backlog) < 0) {
+      fprintf(stderr, "Can't listen on %s:%d: %s\n", config->address,
+         config->port, strerror(errno));
+      if (svr->socket >= 0) {
+         close(svr->socket);
+      }
+      return -1;
+   }
+
+   return 0;
+
+}
+
+/*
+ * Configure a set of servers sharing the same port, one for each worker.
+ * Params:
+ *    struct svr_info *svrs: The servers to be configured
+ *    int count: The number of servers in svrs
+ *    const struct config *config: The settings to listen with
+ * Returns:
+ *    int result: 0 on success, -1 if any server can't listen, with none
+ *       of them left open
+ */
+int config_servers(struct svr_info *svrs, int count,
+   const struct config *config) {
+
+   int index;
+
+   for (index = 0; index < count; index++) {
+      if (config_server(&svrs[index], config) < 0) {
+         while (index-- > 0) {
+            close(svrs[index].socket);
+         }
+         return -1;
+      }
+   }
+
+   /* Print a message to the console */
+   printf("Server root bound to %s:%d/\n", config->address, config->port);
+   return 0;
+
+}
+
+/*
+ * Takes over a listening socket inherited from a previous master, if it
+ *    listens on the address and port of the settings.
+ * Params:
+ *    struct svr_info *svr: The server to be configured
+ *    int socket: The inherited socket
+ *    const struct config *config: The settings to listen with
+ * Returns:
+ *    int result: 0 on success, -1 if the socket doesn't fit the settings
+ */
+int config_adopt(struct svr_info *svr, int socket,
+   const struct config *config) {
+
+   struct sockaddr_in bound;
+   socklen_t bound_len = sizeof(bound);
+
+   set_addr_options(&svr->addr, config);
+
+   if (getsockname(socket, (struct sockaddr *) &bound, &bound_len) < 0 ||
+      bound.sin_family != AF_INET || bound.sin_port != svr->addr.sin_port ||
+      bound.sin_addr.s_addr != svr->addr.sin_addr.s_addr) {
+      return -1;
+   }
+
+   /* Listening again on the socket only changes its backlog */
+   if (set_nonblocking(socket) < 0 || listen(socket, config->backlog) < 0) {
+      return -1;
+   }
+
+   svr->socket = socket;
+   return 0;
+
+}
+
+/*
+ * Finds the Cache-Control policy for a static file.
+ * Params:
+ *    const struct config *config: The settings holding the policies
+ *    const char *url: The url of the file
+ * Returns:
+ *    const char *policy: The policy of the longest matching url prefix, or
+ *       NULL if no prefix matches
+ */
+const char *config_cache_control(const struct config *config,
+   const char *url) {
+
+   const struct cache_policy *policies = config->cache_control.policies;
+   const char *policy = NULL;
+   size_t prefix_len, best_len = 0;
+   int index;
+
+   for (index = 0; index < config->cache_control.count; index++) {
+      prefix_len = strlen(policies[index].prefix);
+      if (prefix_len >= best_len &&
+         strncmp(url, policies[index].prefix, prefix_len) == 0) {
+         policy = policies[index].policy;
+         best_len = prefix_len;
+      }
+   }
+
+   return policy;
 
 }
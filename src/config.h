@@ -3,18 +3,136 @@
 
 #include <netinet/in.h>
 
+#include "metrics.h"
 #include "request.h"
 
+/* Room for a string setting along with its '\0' */
+#define CONFIG_STRING_LEN 256
+
+/* Command line flags given on top of the configuration file */
+#define MAX_OVERRIDES 32
+
+/* The most worker processes the server runs at once */
+#define MAX_WORKERS 64
+
+/* The most url prefixes given their own Cache-Control policy */
+#define MAX_CACHE_POLICIES 32
+
 struct svr_info {
    int socket;
    struct sockaddr_in addr;
 };
 
 /*
- * Configure the server with default settings.
+ * The Cache-Control policy sent with static files below a url prefix.
+ */
+struct cache_policy {
+   char prefix[CONFIG_STRING_LEN], policy[CONFIG_STRING_LEN];
+};
+
+struct cache_policies {
+   int count;
+   struct cache_policy policies[MAX_CACHE_POLICIES];
+};
+
+/*
+ * The settings of the server. Empty strings stand for settings that are off.
+ */
+struct config {
+   char address[CONFIG_STRING_LEN];
+   int port, backlog, workers, uring, log_block, stream_route;
+   size_t buffer_size, max_line, max_header_bytes, max_body, memory_budget;
+   int max_headers;
+   size_t cache_capacity, cache_max_entry;
+   int timeouts[NUM_DEADLINES];
+   char root[CONFIG_STRING_LEN], log[CONFIG_STRING_LEN];
+   char bundle[CONFIG_STRING_LEN];
+   struct cache_policies cache_control;
+};
+
+/*
+ * Where the settings are read from: a file, if any, then name and value
+ *    pairs given on the command line that take precedence over it.
+ */
+struct config_source {
+   const char *path;
+   int num_overrides;
+   const char *overrides[MAX_OVERRIDES][2];
+};
+
+/*
+ * Reads the settings from their source, on top of the defaults. Every
+ *    mistake found is reported.
+ * Params:
+ *    struct config *config: Filled with the settings, left alone on failure
+ *    const struct config_source *source: Where to read the settings from
+ * Returns:
+ *    int result: 0 on success, -1 if the settings are invalid
+ */
+int load_config(struct config *, const struct config_source *);
+
+/*
+ * Tells whether settings differ in any way that only workers started after
+ *    the change can take up.
+ * Params:
+ *    const struct config *old: The settings running workers started with
+ *    const struct config *new: The settings just read
+ * Returns:
+ *    int restart: 1 if the workers have to be replaced, 0 otherwise
+ */
+int config_restart_needed(const struct config *, const struct config *);
+
+/*
+ * Copies the settings a running worker can change in place.
+ * Params:
+ *    struct config *config: The settings to update
+ *    const struct config *fresh: The settings just read
+ */
+void config_apply(struct config *, const struct config *);
+
+/*
+ * Configure a server to listen on the address and port of the settings.
  * Params:
  *    struct svr_info *svr: The server to be configured
+ *    const struct config *config: The settings to listen with
+ * Returns:
+ *    int result: 0 on success, -1 if the server can't listen
+ */
+int config_server(struct svr_info *, const struct config *);
+
+/*
+ * Configure a set of servers sharing the same port, one for each worker.
+ * Params:
+ *    struct svr_info *svrs: The servers to be configured
+ *    int count: The number of servers in svrs
+ *    const struct config *config: The settings to listen with
+ * Returns:
+ *    int result: 0 on success, -1 if any server can't listen, with none
+ *       of them left open
+ */
+int config_servers(struct svr_info *, int, const struct config *);
+
+/*
+ * Takes over a listening socket inherited from a previous master, if it
+ *    listens on the address and port of the settings.
+ * Params:
+ *    struct svr_info *svr: The server to be configured
+ *    int socket: The inherited socket
+ *    const struct config *config: The settings to listen with
+ * Returns:
+ *    int result: 0 on success, -1 if the socket doesn't fit the settings
+ */
+int config_adopt(struct svr_info *, int, const struct config *);
+
+/*
+ * Finds the Cache-Control policy for a static file.
+ * Params:
+ *    const struct config *config: The settings holding the policies
+ *    const char *url: The url of the file
+ * Returns:
+ *    const char *policy: The policy of the longest matching url prefix, or
+ *       NULL if no prefix matches
  */
-void config_server(struct svr_info *);
+const char *config_cache_control(const struct config *, const char *);
 
 #endif
@@ -0,0 +1,145 @@
+/*
+ * connection.c
+ * Tracks the input, request and response of a single non-blocking client
+ *    connection. Functions are prototyped in connection.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "connection.h"
+#include "util.h"
+
+/*
+ * Allocates the state for a newly accepted connection.
+ * Params:
+ *    int socket: The non-blocking socket of the connection
+ *    size_t buffer_size: The memory the connection starts with, and goes
+ *       back to between requests
+ *    size_t max_input: The most input buffered for the connection at once
+ * Returns:
+ *    struct connection *conn: The new connection, waiting for a request
+ */
+struct connection *create_connection(int socket, size_t buffer_size,
+   size_t max_input) {
+
+   struct connection *conn = malloc(sizeof(struct connection));
+   memset(conn, 0, sizeof(struct connection));
+
+   conn->socket = socket;
+   conn->state = CONN_READING;
+   conn->buffer_size = buffer_size;
+   init_timer(&conn->timer, conn);
+   init_buffer(&conn->in, buffer_size, max_input);
+   init_arena(&conn->arena, buffer_size);
+
+   return conn;
+
+}
+
+/*
+ * Closes the socket of a connection and frees all memory it uses.
+ * Params:
+ *    struct connection *conn: The connection to be completely freed
+ */
+void free_connection(struct connection *conn) {
+
+   close(conn->socket);
+   connection_reset(conn);
+
+   free_buffer(&conn->in);
+   free_arena(&conn->arena);
+   free(conn);
+
+}
+
+/*
+ * Forgets the request and response just completed, releasing their memory
+ *    at once but keeping any input already received for the next request.
+ * Params:
+ *    struct connection *conn: The connection to be reused
+ */
+void connection_reset(struct connection *conn) {
+
+   if (conn->res != NULL) {
+      release_response(conn->res);
+      conn->res = NULL;
+   }
+
+   conn->req = NULL;
+   arena_reset(&conn->arena);
+   buffer_trim(&conn->in, conn->buffer_size);
+   free_buffer(&conn->body);
+   conn->state = CONN_READING;
+
+}
+
+/*
+ * Adds a connection at the back of a list.
+ * Params:
+ *    struct conn_list *list: The list to add to
+ *    struct connection *conn: The connection to add
+ */
+void conn_list_push(struct conn_list *list, struct connection *conn) {
+
+   conn->prev = list->tail;
+   conn->next = NULL;
+
+   if (list->tail != NULL) {
+      list->tail->next = conn;
+   }
+   else {
+      list->head = conn;
+   }
+
+   list->tail = conn;
+
+}
+
+/*
+ * Removes a connection from a list.
+ * Params:
+ *    struct conn_list *list: The list holding the connection
+ *    struct connection *conn: The connection to remove
+ */
+void conn_list_remove(struct conn_list *list, struct connection *conn) {
+
+   if (conn->prev != NULL) {
+      conn->prev->next = conn->next;
+   }
+   else {
+      list->head = conn->next;
+   }
+
+   if (conn->next != NULL) {
+      conn->next->prev = conn->prev;
+   }
+   else {
+      list->tail = conn->prev;
+   }
+
+   conn->prev = conn->next = NULL;
+
+}
@@ -0,0 +1,122 @@
+/*
+ * connection.h
+ * Makes available the per-connection state used by the event loop.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "arena.h"
+#include "buffer.h"
+#include "request.h"
+#include "response.h"
+#include "timer.h"
+
+enum conn_state {
+   CONN_READING,
+   CONN_WRITING,
+   CONN_CLOSING,
+   CONN_CLOSED
+};
+
+struct connection {
+   int socket;
+   enum conn_state state;
+   struct buffer in;
+   struct arena arena;
+   struct request *req;
+   struct response *res;
+   int keep_alive;
+   size_t body_left;
+   int chunked;
+   struct chunked_decoder decoder;
+   struct buffer body;
+   int pending;
+   struct msghdr message;
+   struct iovec iov[MAX_IOV];
+   struct timer timer;
+   int deadline;
+   size_t buffer_size, memory, received, moved;
+   int parked;
+   double request_started, send_started;
+   char address[INET6_ADDRSTRLEN];
+   struct connection *prev, *next;
+};
+
+/*
+ * Connections in the order they were added.
+ */
+struct conn_list {
+   struct connection *head, *tail;
+};
+
+/*
+ * Allocates the state for a newly accepted connection.
+ * Params:
+ *    int socket: The non-blocking socket of the connection
+ *    size_t buffer_size: The memory the connection starts with, and goes
+ *       back to between requests
+ *    size_t max_input: The most input buffered for the connection at once
+ * Returns:
+ *    struct connection *conn: The new connection, waiting for a request
+ */
+struct connection *create_connection(int, size_t, size_t);
+
+/*
+ * Closes the socket of a connection and frees all memory it uses.
+ * Params:
+ *    struct connection *conn: The connection to be completely freed
+ */
+void free_connection(struct connection *);
+
+/*
+ * Forgets the request and response just completed, releasing their memory
+ *    at once but keeping any input already received for the next request.
+ * Params:
+ *    struct connection *conn: The connection to be reused
+ */
+void connection_reset(struct connection *);
+
+/*
+ * Adds a connection at the back of a list.
+ * Params:
+ *    struct conn_list *list: The list to add to
+ *    struct connection *conn: The connection to add
+ */
+void conn_list_push(struct conn_list *, struct connection *);
+
+/*
+ * Removes a connection from a list.
+ * Params:
+ *    struct conn_list *list: The list holding the connection
+ *    struct connection *conn: The connection to remove
+ */
+void conn_list_remove(struct conn_list *, struct connection *);
+
+#endif
@@ -28,154 +28,1932 @@
  * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <math.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
+#include "accesslog.h"
+#include "bundle.h"
+#include "cache.h"
 #include "config.h"
+#include "connection.h"
+#include "metrics.h"
 #include "request.h"
 #include "response.h"
+#include "router.h"
+#include "timer.h"
+#include "uring.h"
 #include "util.h"
+#include "worker.h"
 
-#define SIZE_BACKLOG 10
+#define MAX_EVENTS 64
+#define MAX_RANGES 16
+#define TIMER_TICK_MS 250
+#define LOG_RING_SIZE (1024 * 1024)
+#define MAX_RECORD_LEN 2048
+#define MAX_LOG_URL 1024
+#define MAX_LOG_TOKEN 16
+#define URING_ENTRIES 1024
+#define METRICS_URL "/__metrics"
+#define STREAM_URL "/__stream/:bytes"
+#define STREAM_ABORT_URL "/__stream/:bytes/abort"
+#define STREAM_PATTERN \
+   "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-\n"
+#define STREAM_PATTERN_LEN 64
+#define STREAM_BLOCK_LEN 16384
+#define MAX_ALLOW_LEN 128
+#define METRICS_TYPE "text/plain; version=0.0.4"
+#define ERROR_PAGE "\n<html><h2>Error: %d</h2><p>%s</p></html>\n\n"
+#define LISTENERS_ENV "WEBC_LISTENERS"
+
+/* Where the settings come from, and the ones in effect. Workers change those
+ *    they can in place when the master passes a hangup on */
+static const struct config_source *source;
+static struct config settings;
+
+/* The largest requests answered, the rest get a 414, 431 or 413 */
+static struct request_limits limits;
+
+/* The listening sockets of the master, one for each worker */
+static struct svr_info *svrs;
+static int num_svrs;
+
+/* The command line the server was started with, to start an upgrade with,
+ *    and the master this one upgrades, if any */
+static char **arguments;
+static pid_t upgraded_master;
+
+/* Routes of the server, compiled once before the workers start */
+static struct router *router;
+
+/* Hot static assets of this worker */
+static struct cache *assets;
+
+/* The bundle static assets are served from instead of files, if any */
+static struct bundle *bundle;
+
+/* Connections of this worker waiting for memory to be released before they
+ *    read any more, longest waiting first */
+static struct conn_list parked;
+
+/* Deadlines of the open connections of this worker */
+static struct timer_wheel deadlines;
+
+/* What a ring completion is for, kept in the low bits of its user data
+ *    next to the connection it belongs to, if any */
+#define OP_ACCEPT 0
+#define OP_NOTIFY 1
+#define OP_TICK   2
+#define OP_RECV   3
+#define OP_SEND   4
+#define OP_POLL   5
+#define OP_CANCEL 6
+#define OP_MASK   7
+
+/* Whether workers use io_uring, and the ring of this worker if so */
+static int use_uring;
+static struct uring ring;
+
+/* Counters and histograms of all workers, and the slot of this one */
+static struct metrics *metrics;
+static struct worker_metrics *stats;
+
+/* Memory the connections of the other workers held at the last tick */
+static unsigned long shared_memory;
+
+/* Where this worker logs finished requests */
+static struct access_log *access_log;
+
+/* Set once the worker is asked to shut down, to finish up, or to reread its
+ *    settings */
+static volatile sig_atomic_t stopping = 0, draining = 0, reloading = 0;
+
+/*
+ * Show information about the WebC license
+ */
+static void output_license() {
+
+   printf("\nWebC - a basic web server written in c.\n");
+   printf("Copyright (C) 2016 Brandon M. Kelley\n\n");
+
+}
+
+/*
+ * Reopen the access log of a worker, once it was rotated, and have it reread
+ *    its settings.
+ * Params:
+ *    int signum: The signal received
+ */
+static void handle_hangup(int signum) {
+   access_log_reopen(access_log);
+   reloading = 1;
+}
+
+/*
+ * Stop a worker from accepting connections, so it exits once those it has
+ *    are done with.
+ * Params:
+ *    int signum: The signal received
+ */
+static void handle_drain(int signum) {
+   draining = 1;
+}
+
+/*
+ * Stop the event loop of a worker, so it can flush its log before exiting.
+ * Params:
+ *    int signum: The signal received
+ */
+static void handle_stop(int signum) {
+   stopping = 1;
+}
+
+/*
+ * Limit how much of a request line field goes into a log record.
+ * Params:
+ *    struct slice field: The field to be logged
+ *    size_t max: The most bytes logged
+ * Returns:
+ *    int len: The length to print the field with
+ */
+static int log_len(struct slice field, size_t max) {
+
+   return field.len < max ? field.len : max;
+
+}
+
+/*
+ * Queue an access log record for a finished or abandoned response, with the
+ *    bytes sent and the seconds since the request was parsed.
+ * Params:
+ *    struct connection *conn: The connection holding the response
+ */
+static void log_access(struct connection *conn) {
+
+   static char record[MAX_RECORD_LEN], now[HTTP_DATE_LEN];
+   static time_t formatted = -1;
+   struct request *req = conn->req;
+   time_t seconds = time(NULL);
+   int len;
+
+   /* The timestamp only changes once a second */
+   if (seconds != formatted) {
+      strftime(now, sizeof(now), "%d/%b/%Y:%H:%M:%S +0000", gmtime(&seconds));
+      formatted = seconds;
+   }
+
+   len = sprintf(record, "%s - - [%s] \"%.*s %.*s %.*s\" %d %lu %.6f\n",
+      conn->address, now, log_len(req->type, MAX_LOG_TOKEN), req->type.data,
+      log_len(req->url, MAX_LOG_URL), req->url.data,
+      log_len(req->version, MAX_LOG_TOKEN), req->version.data,
+      conn->res->status_code, (unsigned long) conn->res->bytes_sent,
+      metrics_now() - conn->request_started);
+
+   if (!access_log_write(access_log, record, len)) {
+      stats->log_dropped++;
+   }
+
+}
+
+/*
+ * Decide whether the connection outlives the current request, and say so in
+ *    the Connection header of the response.
+ * Params:
+ *    struct connection *conn: The connection holding the current request
+ */
+static void set_connection_header(struct connection *conn) {
+
+   /* The stream isn't read any further past a request that is malformed
+    * or over the limits. A finishing worker closes connections as soon as
+    * it can, and a streamed body that isn't chunked ends with the
+    * connection */
+   conn->keep_alive = conn->req->error == 0 && !draining &&
+      request_keep_alive(conn->req) &&
+      (conn->res->produce == NULL || conn->res->chunked);
+
+   if (!conn->keep_alive) {
+      response_set_header(conn->res, "Connection", "close");
+   }
+   else if (slice_equals(conn->req->version, "HTTP/1.0")) {
+      response_set_header(conn->res, "Connection", "keep-alive");
+   }
+
+}
+
+/*
+ * Choose the content coding to send an asset in, the one the client wants
+ *    most among those cached. Compressed codings win ties, brotli first.
+ * Params:
+ *    struct request *req: The request asking for the asset
+ *    struct cache_entry *asset: The asset to be sent
+ * Returns:
+ *    int encoding: The chosen ENCODING_* value
+ */
+static int choose_encoding(struct request *req, struct cache_entry *asset) {
+
+   static char *names[NUM_ENCODINGS] = { "identity", "gzip", "br" };
+   int encoding, quality, best = ENCODING_IDENTITY, best_quality;
+
+   best_quality = request_encoding_quality(req, names[ENCODING_IDENTITY]);
+
+   for (encoding = ENCODING_GZIP; encoding < NUM_ENCODINGS; encoding++) {
+
+      if (asset->variants[encoding].body == NULL) {
+         continue;
+      }
+
+      quality = request_encoding_quality(req, names[encoding]);
+      if (quality > 0 && quality >= best_quality) {
+         best = encoding;
+         best_quality = quality;
+      }
+
+   }
+
+   return best;
+
+}
+
+/*
+ * Answer a request with an error page.
+ * Params:
+ *    struct response *response: The response to fill in
+ *    int status: The status code of the error
+ */
+static void set_error(struct response *response, int status) {
+
+   const char *text = status_text(status);
+   char *page = arena_alloc(response->arena, sizeof(ERROR_PAGE) + strlen(text));
+
+   response->status_code = status;
+   response_set_header(response, "Content-Type", "text/html");
+   response_set_body(response, page, sprintf(page, ERROR_PAGE, status, text));
+
+}
+
+/*
+ * Answer with the metrics of every worker, added up on demand.
+ * Params:
+ *    struct connection *conn: The connection holding the request
+ *    struct route_match *match: The route the request took
+ */
+static void serve_metrics(struct connection *conn, struct route_match *match) {
+
+   struct response *response = conn->res;
+   size_t text_len;
+   char *text = metrics_format(metrics, &conn->arena, &text_len);
+
+   response->status_code = 200;
+   response_set_header(response, "Content-Type", METRICS_TYPE);
+   response_set_header(response, "Cache-Control", "no-store");
+   response_set_body(response, text, text_len);
+
+}
+
+/*
+ * Where a streamed test body is up to.
+ */
+struct stream_state {
+   unsigned long written, total;
+   int abort;
+};
+
+/*
+ * Write the next part of a test body, which repeats the same 64 bytes.
+ * Params:
+ *    struct response *response: The response streaming the body
+ *    void *state: The stream_state of the body
+ * Returns:
+ *    int result: 1 while bytes are left, then 0, or -1 to abandon the body
+ *       instead of ending it
+ */
+static int produce_stream(struct response *response, void *state) {
+
+   static char block[STREAM_BLOCK_LEN + STREAM_PATTERN_LEN];
+   struct stream_state *stream = state;
+   unsigned long left = stream->total - stream->written;
+   size_t index;
+
+   if (block[0] == '\0') {
+      for (index = 0; index < sizeof(block); index++) {
+         block[index] = STREAM_PATTERN[index % STREAM_PATTERN_LEN];
+      }
+   }
+
+   if (left == 0) {
+      return stream->abort ? -1 : 0;
+   }
+
+   stream->written += response_write(response,
+      block + stream->written % STREAM_PATTERN_LEN,
+      left < STREAM_BLOCK_LEN ? left : STREAM_BLOCK_LEN);
+   return 1;
+
+}
+
+/*
+ * Stream a body of as many bytes as the path asks for, so benchmarks can
+ *    drive streaming on the wire.
+ * Params:
+ *    struct connection *conn: The connection holding the request
+ *    struct route_match *match: The route the request took
+ *    int abort: Whether to abandon the response instead of ending it
+ */
+static void start_stream(struct connection *conn, struct route_match *match,
+   int abort) {
+
+   struct response *response = conn->res;
+   struct slice bytes = route_param(match, "bytes");
+   char *digits = arena_strndup(&conn->arena, bytes.data, bytes.len), *end;
+   unsigned long total = strtoul(digits, &end, 10);
+   struct stream_state *stream;
+
+   /* The route is only there for benchmarks that turned it on */
+   if (!settings.stream_route || !isdigit((unsigned char) digits[0]) ||
+      *end != '\0') {
+      set_error(response, 404);
+      return;
+   }
+
+   stream = arena_alloc(&conn->arena, sizeof(struct stream_state));
+   stream->written = 0;
+   stream->total = total;
+   stream->abort = abort;
+
+   response->status_code = 200;
+   response_set_header(response, "Content-Type", "application/octet-stream");
+   response_set_header(response, "Cache-Control", "no-store");
+   response_set_stream(response, produce_stream, stream);
+
+}
+
+/*
+ * Answer with a streamed test body.
+ * Params:
+ *    struct connection *conn: The connection holding the request
+ *    struct route_match *match: The route the request took
+ */
+static void serve_stream(struct connection *conn, struct route_match *match) {
+
+   start_stream(conn, match, 0);
+
+}
+
+/*
+ * Answer with a streamed test body that is abandoned instead of ended.
+ * Params:
+ *    struct connection *conn: The connection holding the request
+ *    struct route_match *match: The route the request took
+ */
+static void serve_aborted_stream(struct connection *conn,
+   struct route_match *match) {
+
+   start_stream(conn, match, 1);
+
+}
+
+/*
+ * Answer with the static asset named by the path of a request, from the
+ *    cache, the bundle or the static directory.
+ * Params:
+ *    struct connection *conn: The connection holding the request
+ *    struct route_match *match: The route the request took
+ */
+static void serve_static(struct connection *conn, struct route_match *match) {
+
+   struct request *req = conn->req;
+   struct response *response = conn->res;
+   struct cache_entry *asset;
+   struct cache_variant *identity;
+   struct bundle_asset packed;
+   struct byte_range ranges[MAX_RANGES];
+   char *dir, etag[ETAG_LEN], date[HTTP_DATE_LEN];
+   const char *policy;
+   struct stat info;
+   int static_fd = -1, encoding, count;
+   double started = metrics_now();
+   char *url = arena_strndup(&conn->arena, match->path.data, match->path.len);
+
+   if (strcmp(url, "/") == 0) {
+      url = "/index.html";
+   }
+
+   /* Never let a url climb out of the static directory */
+   if (url[0] != '/' || strstr(url, "/..") != NULL) {
+      asset = NULL;
+   }
+
+   /* Fast path: the asset is already in memory */
+   else if ((asset = cache_acquire(assets, url)) == NULL && bundle != NULL) {
+
+      /* A bundle holds every asset, no need to look at the filesystem */
+      if (bundle_find(bundle, url, &packed)) {
+         asset = cache_load_memory(assets, url, packed.data, packed.length,
+            packed.type, packed.etag, packed.mtime);
+      }
+
+   }
+
+   else if (asset == NULL) {
+
+      dir = arena_alloc(&conn->arena,
+         (strlen(settings.root) + strlen(url) + 1) * sizeof(char));
+      strcpy(dir, settings.root);
+      strcat(dir, url);
+      cache_watch(assets, url);
+      static_fd = open(dir, O_RDONLY);
+
+      /* Only regular files are served, their length comes from the inode */
+      if (static_fd >= 0 && (fstat(static_fd, &info) < 0 ||
+         !S_ISREG(info.st_mode))) {
+         close(static_fd);
+         static_fd = -1;
+      }
+
+      /* Small files are kept for next time, large ones are streamed */
+      if (static_fd >= 0 &&
+         (asset = cache_load(assets, url, static_fd, &info)) != NULL) {
+         close(static_fd);
+         static_fd = -1;
+      }
+
+   }
+
+   metrics_observe(stats, STAGE_LOOKUP, started);
+
+   if (asset != NULL) {
+      encoding = choose_encoding(req, asset);
+      identity = &asset->variants[ENCODING_IDENTITY];
+      if (request_not_modified(req, asset->variants[encoding].etag,
+         asset->mtime)) {
+         response_set_not_modified(response, asset, encoding);
+      }
+
+      /* Ranges are always taken from the uncompressed bytes */
+      else if ((count = request_ranges(req, identity->body_len,
+         identity->etag, asset->mtime, ranges, MAX_RANGES)) >= 0) {
+         response_set_asset(response, asset, ENCODING_IDENTITY);
+         response_set_ranges(response, ranges, count, identity->body_len,
+            mime_type(url));
+      }
+
+      else {
+         response->status_code = 200;
+         response_set_asset(response, asset, encoding);
+      }
+   }
+
+   else if (static_fd >= 0) {
+      format_etag(etag, &info);
+      format_http_date(date, sizeof(date), info.st_mtime);
+      response_set_header(response, "ETag", etag);
+      response_set_header(response, "Last-Modified", date);
+      if (request_not_modified(req, etag, info.st_mtime)) {
+         response->status_code = 304;
+         close(static_fd);
+      }
+      else {
+         response->status_code = 200;
+         response_set_header(response, "Accept-Ranges", "bytes");
+         response_set_header(response, "Content-Type",
+            (char *) mime_type(url));
+         response_set_file(response, static_fd, 0, info.st_size);
+         if ((count = request_ranges(req, info.st_size, etag, info.st_mtime,
+            ranges, MAX_RANGES)) >= 0) {
+            response_set_ranges(response, ranges, count, info.st_size,
+               mime_type(url));
+         }
+      }
+   }
+
+   else {
+      set_error(response, 404);
+   }
+
+   /* Found files carry the caching policy of their url, 304s included */
+   if (response->status_code != 404 && response->status_code != 416 &&
+      (policy = config_cache_control(&settings, url)) != NULL) {
+      response_set_header(response, "Cache-Control", (char *) policy);
+   }
+
+}
+
+/*
+ * Route a complete request to its handler and lay out the response.
+ * Params:
+ *    struct connection *conn: The connection holding the request
+ */
+static void handle_request(struct connection *conn) {
+
+   struct request *req = conn->req;
+   struct route_match match;
+   char allow[MAX_ALLOW_LEN];
+   int result;
+
+   /* Only the path is routed, the query string is left out */
+   struct slice query = req->url, path = slice_split(&query, '?');
+
+   conn->res = create_response(&conn->arena, req);
+   result = router_match(router, req->type, path, &match);
+
+   if (req->error != 0) {
+      set_error(conn->res, req->error);
+   }
+   else if (result == ROUTE_FOUND) {
+      match.handler(conn, &match);
+   }
+   else if (result == ROUTE_NO_METHOD) {
+      set_error(conn->res, 405);
+      route_allow(&match, allow, sizeof(allow));
+      response_set_header(conn->res, "Allow", allow);
+   }
+   else {
+      set_error(conn->res, 404);
+   }
+
+   metrics_count_response(stats, conn->res->status_code);
+   set_connection_header(conn);
+   response_serialize(conn->res);
+
+}
+
+/*
+ * Close a connection and forget about it. With a ring operation still in
+ *    flight the memory is only freed once that operation completes, shutting
+ *    the socket down makes sure it does.
+ * Params:
+ *    struct connection *conn: The connection to be closed
+ */
+static void close_connection(struct connection *conn) {
+
+   timer_cancel(&conn->timer);
+   stats->connections_active--;
+   stats->connection_memory -= conn->memory;
+
+   if (conn->parked) {
+      conn_list_remove(&parked, conn);
+      stats->connections_parked--;
+   }
+
+   if (conn->pending > 0) {
+      shutdown(conn->socket, SHUT_RDWR);
+      conn->state = CONN_CLOSED;
+      return;
+   }
+
+   free_connection(conn);
+
+}
+
+/*
+ * Read the monotonic clock in ticks of the deadline wheel.
+ * Returns:
+ *    unsigned long tick: The current tick
+ */
+static unsigned long current_tick() {
+
+   return (unsigned long) (metrics_now() * 1000 / TIMER_TICK_MS);
+
+}
+
+/*
+ * Close a connection that missed its deadline, counting which one.
+ * Params:
+ *    struct timer *timer: The deadline timer of the connection
+ */
+static void expire_connection(struct timer *timer) {
+
+   struct connection *conn = timer->data;
+
+   stats->timeouts[conn->deadline]++;
+   close_connection(conn);
+
+}
+
+/*
+ * Close every connection whose deadline has passed.
+ */
+static void expire_deadlines() {
+
+   timer_advance(&deadlines, current_tick(), expire_connection);
+
+}
+
+/*
+ * Start a deadline of a connection, replacing the one it had.
+ * Params:
+ *    struct connection *conn: The connection to set the deadline of
+ *    int deadline: The DEADLINE_* to start
+ */
+static void set_deadline(struct connection *conn, int deadline) {
+
+   conn->deadline = deadline;
+   timer_schedule(&deadlines, &conn->timer,
+      current_tick() + settings.timeouts[deadline] * 1000 / TIMER_TICK_MS);
+
+}
+
+/*
+ * Write the numeric host of a client address, for logging.
+ * Params:
+ *    struct sockaddr_storage *address: The address of the client
+ *    char *host: Filled with the host, at least INET6_ADDRSTRLEN long
+ */
+static void format_address(struct sockaddr_storage *address, char *host) {
+
+   if (address->ss_family == AF_INET6) {
+      inet_ntop(AF_INET6, &((struct sockaddr_in6 *) address)->sin6_addr, host,
+         INET6_ADDRSTRLEN);
+   }
+   else if (address->ss_family == AF_INET) {
+      inet_ntop(AF_INET, &((struct sockaddr_in *) address)->sin_addr, host,
+         INET6_ADDRSTRLEN);
+   }
+   else {
+      strcpy(host, "-");
+   }
+
+}
+
+/*
+ * Start tracking a newly accepted connection.
+ * Params:
+ *    int socket: The non-blocking socket of the connection
+ *    struct sockaddr_storage *address: The address of the client
+ * Returns:
+ *    struct connection *conn: The new connection, waiting for a request
+ */
+static struct connection *open_connection(int socket,
+   struct sockaddr_storage *address) {
+
+   /* Room for the largest head accepted and its line endings, so a full
+    * input always holds either a whole head or one over the limits */
+   size_t max_input = limits.max_line + limits.max_header_bytes + 4;
+   struct connection *conn = create_connection(socket,
+      settings.buffer_size < max_input ? settings.buffer_size : max_input,
+      max_input);
+
+   format_address(address, conn->address);
+   set_deadline(conn, DEADLINE_HEADER);
+   stats->connections_accepted++;
+   stats->connections_active++;
+
+   return conn;
+
+}
+
+/*
+ * Accept every pending connection on the listening socket and register them
+ *    with the event loop.
+ * Params:
+ *    int epoll_fd: The event loop to add new connections to
+ *    struct svr_info *svr: The IP socket and address settings
+ */
+static void accept_connections(int epoll_fd, struct svr_info *svr) {
+
+   struct epoll_event event;
+   struct connection *conn;
+   struct sockaddr_storage address;
+   socklen_t address_len;
+   int request_socket;
+   double started;
+
+   while (1) {
+
+      /* Try to accept a new incoming connection */
+      started = metrics_now();
+      address_len = sizeof(address);
+      request_socket = accept4(svr->socket, (struct sockaddr *) &address,
+         &address_len, SOCK_NONBLOCK);
+
+      if (request_socket < 0) {
+         if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+         }
+         if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("accept failed");
+         }
+         return;
+      }
+
+      /* Watch the connection for both directions, edge-triggered */
+      conn = open_connection(request_socket, &address);
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+      event.data.ptr = conn;
+
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, request_socket, &event) < 0) {
+         perror("epoll_ctl failed");
+         close_connection(conn);
+      }
+      else {
+         metrics_observe(stats, STAGE_ACCEPT, started);
+      }
+
+   }
+
+}
+
+/*
+ * Tell whether a connection is still reading the body of its request.
+ * Params:
+ *    struct connection *conn: The connection to check
+ * Returns:
+ *    int in_body: 1 if more of the body is to come, 0 otherwise
+ */
+static int in_body(struct connection *conn) {
+
+   return conn->body_left > 0 || conn->chunked;
+
+}
+
+/*
+ * Get ready to read the body following the request head just parsed. A
+ *    body of known length gets exactly the memory it needs, a chunked one
+ *    grows its memory as chunks arrive, up to the largest body accepted.
+ * Params:
+ *    struct connection *conn: The connection holding the request
+ */
+static void start_body(struct connection *conn) {
+
+   long body_len = request_content_length(conn->req);
+   size_t size = conn->buffer_size;
+
+   if (conn->req->error != 0) {
+      return;
+   }
+
+   conn->chunked = request_chunked(conn->req);
+   conn->body_left = body_len > 0 ? body_len : 0;
+
+   if (conn->chunked) {
+      size = size < (size_t) limits.max_body ? size : limits.max_body;
+      init_buffer(&conn->body, size, limits.max_body);
+      init_chunked_decoder(&conn->decoder, limits.max_body);
+   }
+   else if (conn->body_left > 0) {
+      init_buffer(&conn->body, conn->body_left, conn->body_left);
+   }
+
+}
+
+/*
+ * Copy body bytes of a request out of the input.
+ * Params:
+ *    struct connection *conn: The connection reading the body
+ *    char *data: The body bytes
+ *    size_t len: The number of bytes at data, no more than the body holds
+ */
+static void append_body(struct connection *conn, char *data, size_t len) {
+
+   size_t room;
+   char *space;
+
+   while (len > 0) {
+      space = buffer_reserve(&conn->body, &room);
+      room = room < len ? room : len;
+      memcpy(space, data, room);
+      buffer_commit(&conn->body, room);
+      data += room;
+      len -= room;
+   }
+
+}
+
+/*
+ * Take whatever is buffered of the body of the current request, decoding
+ *    it if it is chunked.
+ * Params:
+ *    struct connection *conn: The connection reading the body
+ * Returns:
+ *    int done: 1 once the body has arrived or was rejected, with the
+ *       request's body or error set, 0 if more of it is to come
+ */
+static int read_body(struct connection *conn) {
+
+   size_t available = conn->in.end - conn->in.start, used;
+   struct slice data;
+   int result;
+
+   available = available < conn->body_left ? available : conn->body_left;
+   append_body(conn, conn->in.data + conn->in.start, available);
+   buffer_consume(&conn->in, conn->in.start + available);
+   conn->body_left -= available;
+   conn->received += available;
+
+   while (conn->chunked) {
+      result = chunked_decode(&conn->decoder, conn->in.data + conn->in.start,
+         conn->in.end - conn->in.start, &used, &data);
+      if (result == CHUNKED_ERROR || result == CHUNKED_TOO_LARGE) {
+         conn->req->error = result == CHUNKED_ERROR ? 400 : 413;
+         conn->chunked = 0;
+         return 1;
+      }
+      buffer_consume(&conn->in, conn->in.start + used);
+      conn->received += used;
+      if (result == CHUNKED_DATA) {
+         append_body(conn, data.data, data.len);
+      }
+      else if (result == CHUNKED_DONE) {
+         conn->chunked = 0;
+      }
+      else {
+         return 0;
+      }
+   }
+
+   if (conn->body_left > 0) {
+      return 0;
+   }
+
+   conn->req->body.data = conn->body.data;
+   conn->req->body.len = conn->body.end;
+   return 1;
+
+}
+
+/*
+ * Parse the next request already buffered on a connection, along with all
+ *    of its body.
+ * Params:
+ *    struct connection *conn: The connection to parse from
+ * Returns:
+ *    int found: 1 with conn->req set, 0 if more input is needed
+ */
+static int next_request(struct connection *conn) {
+
+   double started;
+
+   /* Only attempts that find a whole request head count as parsing */
+   if (conn->req == NULL) {
+      started = metrics_now();
+      conn->req = parse_request(&conn->in, &conn->arena, &limits);
+      if (conn->req == NULL) {
+         return 0;
+      }
+      metrics_observe(stats, STAGE_PARSE, started);
+      conn->request_started = started;
+      start_body(conn);
+   }
+
+   return read_body(conn);
+
+}
+
+/*
+ * Take note of the memory the connections of the other workers hold, which
+ *    counts towards the budget along with that of this worker. Adding it up
+ *    from their metrics between events, rather than sharing a counter every
+ *    change goes through, keeps the workers from contending over it.
+ */
+static void share_budget() {
+
+   shared_memory = metrics_connection_memory(metrics) -
+      stats->connection_memory;
+
+}
+
+/*
+ * Tell whether a connection has to wait for memory to be released before
+ *    reading. Past the budget of all workers only connections between
+ *    requests wait, those partway through one may finish it so their memory
+ *    can be released.
+ * Params:
+ *    struct connection *conn: The connection about to read, or NULL for any
+ *       connection between requests
+ * Returns:
+ *    int over: 1 if the connection has to wait, 0 otherwise
+ */
+static int over_budget(struct connection *conn) {
+
+   return shared_memory + stats->connection_memory >
+      settings.memory_budget && (conn == NULL ||
+      (conn->req == NULL && conn->in.start == conn->in.end));
+
+}
+
+/*
+ * Stop reading from a connection until memory is released.
+ * Params:
+ *    struct connection *conn: The connection to park
+ */
+static void park_connection(struct connection *conn) {
+
+   if (!conn->parked) {
+      conn->parked = 1;
+      conn_list_push(&parked, conn);
+      stats->connections_parked++;
+   }
+
+}
+
+/*
+ * Take the connection that has waited longest off the parked list, once
+ *    memory has been released.
+ * Returns:
+ *    struct connection *conn: The connection to resume, or NULL if none may
+ */
+static struct connection *unpark_connection() {
+
+   struct connection *conn = parked.head;
+
+   if (conn == NULL || over_budget(NULL)) {
+      return NULL;
+   }
+
+   conn_list_remove(&parked, conn);
+   conn->parked = 0;
+   stats->connections_parked--;
+
+   return conn;
+
+}
+
+/*
+ * Find the next request on a connection, reading from the socket only when
+ *    the buffered input runs out.
+ * Params:
+ *    struct connection *conn: The connection to read from
+ * Returns:
+ *    int result: IO_DONE with conn->req set, IO_AGAIN, IO_EOF or IO_ERROR
+ */
+static int read_request(struct connection *conn) {
+
+   int result;
+
+   /* Pipelined requests may already be waiting in the buffer */
+   while (!next_request(conn)) {
+
+      if (over_budget(conn)) {
+         park_connection(conn);
+         return IO_AGAIN;
+      }
+
+      /* Otherwise drain the socket and try again. Only reading a body
+       * makes room in a full input, a head never fills it */
+      result = buffer_fill(&conn->in, conn->socket);
+      if (result != IO_FULL || !in_body(conn)) {
+         return next_request(conn) ? IO_DONE :
+            result == IO_FULL ? IO_ERROR : result;
+      }
+
+   }
+
+   return IO_DONE;
+
+}
+
+/*
+ * Respond to the request just parsed on a connection.
+ * Params:
+ *    struct connection *conn: The connection holding the request
+ */
+static void start_response(struct connection *conn) {
+
+   handle_request(conn);
+   conn->send_started = metrics_now();
+   conn->state = CONN_WRITING;
+
+}
+
+/*
+ * Send as much of the current response as the socket will take right now.
+ * Params:
+ *    struct connection *conn: The connection to send on
+ * Returns:
+ *    int result: IO_DONE, IO_AGAIN or IO_ERROR
+ */
+static int send_response(struct connection *conn) {
+
+   size_t sent = conn->res->bytes_sent;
+   int result = response_send(conn->res, conn->socket);
+
+   stats->bytes_sent += conn->res->bytes_sent - sent;
+   return result;
+
+}
+
+/*
+ * Log a response that was sent or abandoned, then get the connection ready
+ *    for its next request or to be closed.
+ * Params:
+ *    struct connection *conn: The connection holding the response
+ *    int result: IO_DONE if the whole response was sent, else IO_ERROR
+ */
+static void finish_response(struct connection *conn, int result) {
+
+   if (result == IO_DONE) {
+      metrics_observe(stats, STAGE_SEND, conn->send_started);
+   }
+
+   log_access(conn);
+
+   /* Waiting for the next request is on the idle deadline, until it starts */
+   if (result == IO_DONE && conn->keep_alive) {
+      connection_reset(conn);
+      set_deadline(conn, DEADLINE_IDLE);
+   }
+   else {
+      conn->state = CONN_CLOSING;
+   }
+
+}
 
 /*
- * Show information about the WebC license
+ * Count the memory a connection holds now towards the budget, and move its
+ *    deadline along if it made progress. Bodies and responses get a fresh
+ *    deadline only when bytes of them moved, not on any event, and a request
+ *    head has to arrive whole within its deadline from the first byte, so
+ *    trickling bytes in doesn't hold the connection open.
+ * Params:
+ *    struct connection *conn: The connection an event occurred on
  */
-static void output_license() {
+static void touch_connection(struct connection *conn) {
 
-   printf("\nWebC - a basic web server written in c.\n");
-   printf("Copyright (C) 2016 Brandon M. Kelley\n\n");
+   size_t memory = conn->in.size + conn->arena.allocated + conn->body.size;
+   size_t moved = conn->state == CONN_WRITING ? conn->res->bytes_sent :
+      conn->received;
+   int progress = moved != conn->moved;
+
+   stats->connection_memory += memory - conn->memory;
+   conn->memory = memory;
+   conn->moved = moved;
+
+   if (conn->state == CONN_WRITING) {
+      if (progress || conn->deadline != DEADLINE_WRITE) {
+         set_deadline(conn, DEADLINE_WRITE);
+      }
+   }
+   else if (in_body(conn)) {
+      if (progress || conn->deadline != DEADLINE_BODY) {
+         set_deadline(conn, DEADLINE_BODY);
+      }
+   }
+
+   /* The header deadline keeps running from the first byte of the head */
+   else if (conn->in.end > conn->in.start) {
+      if (conn->deadline != DEADLINE_HEADER) {
+         set_deadline(conn, DEADLINE_HEADER);
+      }
+   }
 
 }
 
 /*
- * Read in a request from the IP socket and parse it.
+ * Advance the state machine of a connection after an event on its socket,
+ *    answering every complete request in order until it has to wait.
  * Params:
- *    int *request_socket: The socket opened by an incoming request
- *    struct svr_info svr: The IP socket and address settings
+ *    struct connection *conn: The connection the event occurred on
+ *    unsigned events: The epoll events reported for the socket
+ */
+static void process_connection(struct connection *conn, unsigned events) {
+
+   int result;
+
+   if (events & EPOLLERR) {
+      conn->state = CONN_CLOSING;
+   }
+
+   while (conn->state != CONN_CLOSING) {
+
+      /* Read until the whole request head has arrived, then respond to it */
+      if (conn->state == CONN_READING) {
+
+         result = read_request(conn);
+
+         if (result == IO_DONE) {
+            start_response(conn);
+         }
+         else if (result == IO_AGAIN) {
+            break;
+         }
+         else {
+            conn->state = CONN_CLOSING;
+         }
+
+      }
+
+      /* Send as much of the response as the socket will take right now */
+      if (conn->state == CONN_WRITING) {
+
+         if ((result = send_response(conn)) == IO_AGAIN) {
+            break;
+         }
+
+         finish_response(conn, result);
+
+      }
+
+   }
+
+   /* Closing the socket also removes it from the event loop */
+   if (conn->state == CONN_CLOSING) {
+      close_connection(conn);
+      return;
+   }
+
+   /* The deadline only moves along if the event made progress */
+   touch_connection(conn);
+
+}
+
+/*
+ * Set the limits requests are checked against from the settings.
+ */
+static void set_limits() {
+
+   limits.max_line = settings.max_line;
+   limits.max_header_bytes = settings.max_header_bytes;
+   limits.max_headers = settings.max_headers;
+   limits.max_body = (long) settings.max_body;
+
+}
+
+/*
+ * Reread the settings of a worker after a hangup, changing those it can in
+ *    place. Open connections are kept, a new document root comes with a new
+ *    cache.
  * Returns:
- *    struct request *parsed_request: The parsed request
+ *    int replaced: 1 if the cache was replaced, 0 otherwise
+ */
+static int reload_settings() {
+
+   struct config fresh;
+   int moved;
+
+   if (load_config(&fresh, source) < 0) {
+      fprintf(stderr, "Worker %d keeps its settings\n", (int) getpid());
+      return 0;
+   }
+
+   moved = strcmp(fresh.root, settings.root) != 0;
+   config_apply(&settings, &fresh);
+   set_limits();
+
+   if (!moved) {
+      cache_resize(assets, settings.cache_capacity, settings.cache_max_entry);
+      return 0;
+   }
+
+   /* Assets still being sent are freed once their connections are done */
+   free_cache(assets);
+   assets = create_cache(settings.root, settings.cache_capacity,
+      settings.cache_max_entry);
+   return 1;
+
+}
+
+/*
+ * Register a file descriptor with the epoll event loop, edge-triggered.
+ * Params:
+ *    int epoll_fd: The event loop
+ *    int fd: The file descriptor to watch for input
+ *    void *ptr: What the events report the file descriptor as
  */
-static struct request *receive_request(int *request_socket,
-   struct svr_info svr) {
+static void watch_epoll(int epoll_fd, int fd, void *ptr) {
+
+   struct epoll_event event;
 
-   socklen_t addr_len = sizeof(svr.addr);
-   struct request *parsed_request;
+   memset(&event, 0, sizeof(event));
+   event.events = EPOLLIN | EPOLLET;
+   event.data.ptr = ptr;
 
-   /* Try to listen for requests */
-   if (listen(svr.socket, SIZE_BACKLOG) < 0) {
+   if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
       report_errno();
    }
 
-   /* Try to accept a new incoming request */
-   *request_socket = accept(svr.socket, (struct sockaddr *) &svr.addr,
-      &addr_len);
+}
+
+/*
+ * Run the epoll event loop of a worker, processing readiness events on its
+ *    own listening socket and the connections accepted from it.
+ * Params:
+ *    struct svr_info *svr: The IP socket and address settings of the worker
+ */
+static void serve_epoll(struct svr_info *svr) {
+
+   struct epoll_event events[MAX_EVENTS];
+   struct connection *conn;
+   int epoll_fd, num_events, event_index, listening = 1;
 
-   if (*request_socket < 0) {
+   /* Register the listening socket with the event loop, and the static
+    * asset cache's change notifications as well */
+   if ((epoll_fd = epoll_create1(0)) < 0) {
       report_errno();
    }
 
-   /* Parse the request, log and return */
-   parsed_request = parse_request(*request_socket);
+   watch_epoll(epoll_fd, svr->socket, svr);
+   watch_epoll(epoll_fd, assets->inotify_fd, assets);
 
-   return parsed_request;
+   /* Loop until told to stop, or until a finishing worker is done with its
+    * connections, processing events as they occur */
+   while (!stopping && !(draining && stats->connections_active == 0)) {
+
+      /* The notifications of a replaced cache went away with it */
+      if (reloading) {
+         reloading = 0;
+         if (reload_settings()) {
+            watch_epoll(epoll_fd, assets->inotify_fd, assets);
+         }
+      }
+
+      /* Connections already waiting are accepted before letting go of the
+       * listening socket */
+      if (draining && listening) {
+         listening = 0;
+         accept_connections(epoll_fd, svr);
+         epoll_ctl(epoll_fd, EPOLL_CTL_DEL, svr->socket, NULL);
+         close(svr->socket);
+      }
+
+      /* Wake up at least once a tick to close connections past their
+       * deadline */
+      num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, TIMER_TICK_MS);
+
+      if (num_events < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         report_errno();
+      }
+
+      for (event_index = 0; event_index < num_events; event_index++) {
+
+         if (events[event_index].data.ptr == svr) {
+            accept_connections(epoll_fd, svr);
+         }
+         else if (events[event_index].data.ptr == assets) {
+            cache_process_events(assets);
+         }
+         else {
+            process_connection(events[event_index].data.ptr,
+               events[event_index].events);
+         }
+
+      }
+
+      expire_deadlines();
+      share_budget();
+
+      /* Parked connections carry on once enough memory was released */
+      while ((conn = unpark_connection()) != NULL) {
+         process_connection(conn, EPOLLIN);
+      }
+
+   }
 
 }
 
 /*
- * Respond to a received request.
+ * Queue an operation on the ring, tagging it with what it is for.
  * Params:
- *    int socket: The current request socket
- *    struct request *request: the current request data
+ *    int opcode: The IORING_OP_* to perform
+ *    int fd: The file descriptor it works on
+ *    struct connection *conn: The connection it is for, or NULL
+ *    int op: The OP_* value passed back with its completion
+ * Returns:
+ *    struct io_uring_sqe *sqe: The queued entry, to fill in the rest of
  */
-static void handle_request(int socket, struct request *req) {
+static struct io_uring_sqe *queue_op(int opcode, int fd,
+   struct connection *conn, int op) {
 
-   struct response *response = create_response();
-   char *dir = malloc(7 * sizeof(char));
-   char *static_html, *dynamic_content_len;
-   int static_fd, static_len, static_len_len;
+   struct io_uring_sqe *sqe = uring_sqe(&ring);
 
-   char *url;
-   if (req->url[1] == '\0') {
-      url = "/index.html";
+   sqe->opcode = opcode;
+   sqe->fd = fd;
+   sqe->user_data = (unsigned long) conn | op;
+
+   /* Connections only wait on the ring after an operation completed */
+   if (conn != NULL) {
+      conn->pending++;
+      touch_connection(conn);
+   }
+
+   return sqe;
+
+}
+
+/*
+ * Queue the operations that watch the listening socket, the cache and the
+ *    clock. Multishot ones stay armed until the kernel says otherwise.
+ * Params:
+ *    struct svr_info *svr: The listening socket to accept from
+ *    int op: Which of OP_ACCEPT, OP_NOTIFY or OP_TICK to queue
+ */
+static void queue_watch(struct svr_info *svr, int op) {
+
+   static struct __kernel_timespec tick = { 0, TIMER_TICK_MS * 1000000L };
+   struct io_uring_sqe *sqe;
+
+   if (op == OP_ACCEPT) {
+      sqe = queue_op(IORING_OP_ACCEPT, svr->socket, NULL, OP_ACCEPT);
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      sqe->accept_flags = SOCK_NONBLOCK;
+   }
+   else if (op == OP_NOTIFY) {
+      sqe = queue_op(IORING_OP_POLL_ADD, assets->inotify_fd, NULL, OP_NOTIFY);
+      sqe->poll32_events = POLLIN;
+      sqe->len = IORING_POLL_ADD_MULTI;
    }
    else {
-      url = req->url;
+      sqe = queue_op(IORING_OP_TIMEOUT, -1, NULL, OP_TICK);
+      sqe->addr = (unsigned long) &tick;
+      sqe->len = 1;
+   }
+
+}
+
+/*
+ * Cancel a watch queued with queue_watch. It completes without being rearmed
+ *    unless queue_watch is told to rearm it.
+ * Params:
+ *    int op: Which of OP_ACCEPT or OP_NOTIFY to cancel
+ */
+static void cancel_watch(int op) {
+
+   struct io_uring_sqe *sqe = queue_op(IORING_OP_ASYNC_CANCEL, -1, NULL,
+      OP_CANCEL);
+
+   sqe->addr = op;
+
+}
+
+/*
+ * Queue whatever a connection needs next: a receive into its input buffer
+ *    while waiting for a request, a send of the memory segments of its
+ *    response, or a wait for room to sendfile more of a file into. Requests
+ *    already buffered are answered right away.
+ * Params:
+ *    struct connection *conn: The connection to move along
+ */
+static void advance_connection(struct connection *conn) {
+
+   struct io_uring_sqe *sqe;
+   size_t len;
+   char *space;
+   int count, more, result;
+
+   while (conn->state != CONN_CLOSING) {
+
+      if (conn->state == CONN_READING) {
+
+         if (next_request(conn)) {
+            start_response(conn);
+            continue;
+         }
+
+         if (over_budget(conn)) {
+            park_connection(conn);
+            return;
+         }
+
+         /* Only reading a body makes room in a full input, a head never
+          * fills it */
+         space = buffer_reserve(&conn->in, &len);
+         if (len == 0) {
+            conn->state = CONN_CLOSING;
+            continue;
+         }
+
+         sqe = queue_op(IORING_OP_RECV, conn->socket, conn, OP_RECV);
+         sqe->addr = (unsigned long) space;
+         sqe->len = len;
+         return;
+
+      }
+
+      /* Memory segments go out through the ring, gathered like sendmsg */
+      if ((count = response_iov(conn->res, conn->iov, MAX_IOV, &more)) > 0) {
+         memset(&conn->message, 0, sizeof(conn->message));
+         conn->message.msg_iov = conn->iov;
+         conn->message.msg_iovlen = count;
+         sqe = queue_op(IORING_OP_SENDMSG, conn->socket, conn, OP_SEND);
+         sqe->addr = (unsigned long) &conn->message;
+         sqe->len = 1;
+         sqe->msg_flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+         return;
+      }
+
+      /* File ranges are sendfile'd directly until the socket is full */
+      if ((result = send_response(conn)) == IO_AGAIN) {
+         sqe = queue_op(IORING_OP_POLL_ADD, conn->socket, conn, OP_POLL);
+         sqe->poll32_events = POLLOUT;
+         return;
+      }
+
+      finish_response(conn, result);
+
+   }
+
+   close_connection(conn);
+
+}
+
+/*
+ * Handle the completion of an operation queued for a connection.
+ * Params:
+ *    struct connection *conn: The connection the operation was for
+ *    int op: The OP_* value it was queued with
+ *    int res: The result of the operation, a negated errno on failure
+ */
+static void complete_connection_op(struct connection *conn, int op, int res) {
+
+   conn->pending--;
+
+   /* The connection was closed while the operation was in flight */
+   if (conn->state == CONN_CLOSED) {
+      free_connection(conn);
+      return;
+   }
+
+   if (op == OP_RECV && res > 0) {
+      buffer_commit(&conn->in, res);
    }
+   else if (op == OP_SEND && res >= 0) {
+      response_advance(conn->res, res);
+      stats->bytes_sent += res;
+   }
+   else if (op == OP_SEND) {
+      finish_response(conn, IO_ERROR);
+   }
+   else if (op == OP_RECV) {
+      conn->state = CONN_CLOSING;
+   }
+
+   advance_connection(conn);
+
+}
+
+/*
+ * Stop accepting connections on the ring, taking those already waiting on
+ *    the listening socket before letting go of it.
+ * Params:
+ *    struct svr_info *svr: The listening socket to stop accepting from
+ */
+static void stop_accepting(struct svr_info *svr) {
+
+   struct sockaddr_storage address;
+   socklen_t address_len = sizeof(address);
+   int request_socket;
+
+   cancel_watch(OP_ACCEPT);
+
+   while ((request_socket = accept4(svr->socket, (struct sockaddr *) &address,
+      &address_len, SOCK_NONBLOCK)) >= 0 || errno == EINTR) {
+      if (request_socket >= 0) {
+         advance_connection(open_connection(request_socket, &address));
+      }
+      address_len = sizeof(address);
+   }
+
+   close(svr->socket);
+
+}
+
+/*
+ * Run the io_uring event loop of a worker. Operations for every connection
+ *    are queued on one ring and submitted together with a single system call
+ *    per pass, which also collects everything that completed.
+ * Params:
+ *    struct svr_info *svr: The IP socket and address settings of the worker
+ */
+static void serve_uring(struct svr_info *svr) {
+
+   struct io_uring_cqe *cqe;
+   struct connection *conn;
+   struct sockaddr_storage address;
+   socklen_t address_len;
+   unsigned long user_data;
+   unsigned flags;
+   int res, op, listening = 1;
+   long paused = -1;
+   double started;
+
+   queue_watch(svr, OP_ACCEPT);
+   queue_watch(svr, OP_NOTIFY);
+   queue_watch(svr, OP_TICK);
+
+   /* Loop until told to stop, or until a finishing worker is done with its
+    * connections, submitting and completing operations in batches */
+   while (!stopping && !(draining && stats->connections_active == 0)) {
+
+      /* The notifications of a replaced cache are rearmed for the new one
+       * once cancelled */
+      if (reloading) {
+         reloading = 0;
+         if (reload_settings()) {
+            cancel_watch(OP_NOTIFY);
+         }
+      }
+
+      if (draining && listening) {
+         listening = 0;
+         stop_accepting(svr);
+      }
+
+      /* Accepts paused for lack of file descriptors resume once a
+       * connection closed, or a tick later for those used elsewhere */
+      if (paused >= 0 && listening && stats->connections_active < paused) {
+         paused = -1;
+         queue_watch(svr, OP_ACCEPT);
+      }
+
+      uring_submit(&ring, 1);
+
+      while ((cqe = uring_cqe(&ring)) != NULL) {
+
+         user_data = cqe->user_data;
+         res = cqe->res;
+         flags = cqe->flags;
+         uring_cqe_seen(&ring);
+
+         conn = (struct connection *) (user_data & ~(unsigned long) OP_MASK);
+         op = user_data & OP_MASK;
 
-   response->initial_request = req;
+         if (conn != NULL) {
+            complete_connection_op(conn, op, res);
+            continue;
+         }
 
-   strcpy(dir, "static");
-   append_string(&dir, url);
-   static_fd = open(dir, O_RDONLY);
+         if (op == OP_ACCEPT && res >= 0) {
+            started = metrics_now();
+            address_len = sizeof(address);
+            if (getpeername(res, (struct sockaddr *) &address,
+               &address_len) < 0) {
+               address.ss_family = AF_UNSPEC;
+            }
+            advance_connection(open_connection(res, &address));
+            metrics_observe(stats, STAGE_ACCEPT, started);
+         }
+         else if (op == OP_NOTIFY) {
+            cache_process_events(assets);
+         }
+         else if (op == OP_ACCEPT && (res == -EMFILE || res == -ENFILE) &&
+            paused < 0) {
+            paused = stats->connections_active;
+            if (flags & IORING_CQE_F_MORE) {
+               cancel_watch(OP_ACCEPT);
+            }
+         }
+         else if (op == OP_TICK) {
+            expire_deadlines();
+            share_budget();
+            if (paused >= 0) {
+               paused = stats->connections_active + 1;
+            }
+         }
 
-   if (static_fd > 0) {
-      response->status_code = 200;
-      static_html = fdgets(static_fd, EOF);
-      static_len = strlen(static_html);
-      static_len_len = ceil(log(static_len) / log(10));
-      dynamic_content_len = malloc((18 + static_len_len) * sizeof(char));
-      sprintf(dynamic_content_len, "Content-length: %d\n", static_len);
-      write(socket, "HTTP/1.1 200 OK\n", 17);
-      write(socket, dynamic_content_len, 17 + static_len_len);
-      write(socket, "Content-Type: text/html\n\n", 25);
-      write(socket, static_html, static_len);
-      free(static_html);
-      free(dynamic_content_len);
-      close(static_fd);
+         /* Rearm watches that the kernel stopped, and the one-shot tick,
+          * but not the accepts of a finishing or paused worker */
+         if (!(flags & IORING_CQE_F_MORE) && op != OP_CANCEL &&
+            (op != OP_ACCEPT || (listening && paused < 0))) {
+            queue_watch(svr, op);
+         }
+
+      }
+
+      /* Parked connections carry on once enough memory was released */
+      while ((conn = unpark_connection()) != NULL) {
+         advance_connection(conn);
+      }
+
+   }
+
+}
+
+/*
+ * Run the request-handling loop of a worker, on its own listening socket and
+ *    the connections accepted from it.
+ * Params:
+ *    int index: The index of the listening socket of the worker
+ *    int slot: The slot of the worker, selecting its metrics
+ */
+static void serve_forever(int index, int slot) {
+
+   struct svr_info *svr = &svrs[index];
+   sigset_t quit;
+   int other;
+
+   /* The worker only keeps its own listening socket */
+   for (other = 0; other < num_svrs; other++) {
+      if (other != index) {
+         close(svrs[other].socket);
+      }
    }
 
+   /* Connections of a worker that died before this one went with it */
+   stats = &metrics->workers[slot];
+   stats->connections_active = 0;
+   stats->connections_parked = 0;
+   stats->connection_memory = 0;
+   share_budget();
+
+   /* Finished requests are logged from a ring, written out by a thread */
+   access_log = open_access_log(settings.log[0] != '\0' ? settings.log : NULL,
+      LOG_RING_SIZE, settings.log_block ? LOG_FULL_BLOCK : LOG_FULL_DROP);
+   signal(SIGHUP, handle_hangup);
+   signal(SIGQUIT, handle_drain);
+   signal(SIGTERM, handle_stop);
+   signal(SIGINT, handle_stop);
+
+   /* The master held back being told to finish up until now */
+   sigemptyset(&quit);
+   sigaddset(&quit, SIGQUIT);
+   sigprocmask(SIG_UNBLOCK, &quit, NULL);
+
+   assets = create_cache(settings.root, settings.cache_capacity,
+      settings.cache_max_entry);
+   init_timer_wheel(&deadlines, current_tick());
+
+   if (use_uring && uring_init(&ring, URING_ENTRIES) == 0) {
+      serve_uring(svr);
+   }
    else {
-      response->status_code = 404;
-      write(socket, "HTTP/1.1 404 Not Found\n", 16);
-      write(socket, "Content-Type: text/html\n\n", 25);
-      write(socket, "\n<html><h2>Error: 404</h2><p>Page not found</p></html>\n\n", 56);
+      serve_epoll(svr);
+   }
+
+   /* Open connections are simply dropped, but what they logged is kept */
+   close_access_log(access_log);
+
+}
+
+/*
+ * Decide whether workers use io_uring, if the settings ask for it and the
+ *    kernel has the features needed.
+ */
+static void probe_uring() {
+
+   struct uring probe;
+
+   use_uring = 0;
+
+   if (settings.uring && uring_init(&probe, 1) == 0) {
+      uring_free(&probe);
+      use_uring = 1;
+   }
+
+}
+
+/*
+ * Reread the settings in the master after a hangup. Sockets are only bound
+ *    anew when the address changes, otherwise they are added or closed as the
+ *    number of workers changes. Invalid settings leave everything as it was.
+ * Params:
+ *    int *count: The number of listening sockets, updated
+ * Returns:
+ *    int reload: RELOAD_RESTART if the workers have to be replaced, or
+ *       RELOAD_IN_PLACE if they can reread the settings themselves
+ */
+static int reload_servers(int *count) {
+
+   struct config fresh;
+   struct svr_info *fresh_svrs;
+   struct bundle *fresh_bundle = bundle;
+   int index, kept, restart;
+
+   if (load_config(&fresh, source) < 0) {
+      fprintf(stderr, "Keeping the settings in effect\n");
+      return RELOAD_IN_PLACE;
+   }
+
+   /* A new bundle is mapped first, one that can't be changes nothing. The
+    * same path may hold a new bundle, packing one renames it into place */
+   if (strcmp(fresh.bundle, settings.bundle) != 0 ||
+      (bundle != NULL && bundle_replaced(bundle, fresh.bundle))) {
+      fresh_bundle = NULL;
+      if (fresh.bundle[0] != '\0' &&
+         (fresh_bundle = open_bundle(fresh.bundle)) == NULL) {
+         fprintf(stderr, "Can't serve bundle %s: ", fresh.bundle);
+         perror(NULL);
+         return RELOAD_IN_PLACE;
+      }
+   }
+
+   /* Sockets are kept for as long as the address stays the same */
+   kept = strcmp(fresh.address, settings.address) != 0 ||
+      fresh.port != settings.port ? 0 : num_svrs;
+   kept = kept < fresh.workers ? kept : fresh.workers;
+
+   fresh_svrs = malloc(fresh.workers * sizeof(struct svr_info));
+   memcpy(fresh_svrs, svrs, kept * sizeof(struct svr_info));
+
+   if (fresh.workers > kept &&
+      config_servers(fresh_svrs + kept, fresh.workers - kept, &fresh) < 0) {
+      free(fresh_svrs);
+      if (fresh_bundle != bundle && fresh_bundle != NULL) {
+         close_bundle(fresh_bundle);
+      }
+      return RELOAD_IN_PLACE;
+   }
+
+   /* Listening again on a socket only changes its backlog */
+   for (index = 0; index < kept; index++) {
+      listen(fresh_svrs[index].socket, fresh.backlog);
+   }
+
+   /* Workers of the sockets let go of keep their own until they are done */
+   for (index = kept; index < num_svrs; index++) {
+      close(svrs[index].socket);
+   }
+
+   free(svrs);
+   svrs = fresh_svrs;
+   num_svrs = fresh.workers;
+
+   /* Workers serve the bundle mapped when they were started */
+   restart = config_restart_needed(&settings, &fresh) ||
+      fresh_bundle != bundle;
+
+   if (fresh_bundle != bundle) {
+      if (bundle != NULL) {
+         close_bundle(bundle);
+      }
+      bundle = fresh_bundle;
+   }
+
+   *count = num_svrs;
+
+   if (restart) {
+      settings = fresh;
+      set_limits();
+      probe_uring();
+      printf("Settings reloaded, replacing the workers\n");
+      return RELOAD_RESTART;
+   }
+
+   settings = fresh;
+   set_limits();
+   printf("Settings reloaded\n");
+   return RELOAD_IN_PLACE;
+
+}
+
+/*
+ * Start the server binary again as a new master, handing it the listening
+ *    sockets through the environment. Once it serves on them it tells this
+ *    master to quit, if it can't start this master simply carries on.
+ * Params:
+ *    const sigset_t *mask: The signal mask the new master starts with
+ */
+static void upgrade_server(const sigset_t *mask) {
+
+   char inherited[MAX_WORKERS * 12], *position = inherited;
+   int index;
+   pid_t pid;
+
+   for (index = 0; index < num_svrs; index++) {
+      position += sprintf(position, index > 0 ? ",%d" : "%d",
+         svrs[index].socket);
    }
 
-   log_response(response);
-   free_response(response);
+   /* Don't let the child inherit and repeat unflushed output */
+   fflush(stdout);
+   fflush(stderr);
 
-   free(dir);
+   if ((pid = fork()) != 0) {
+      printf("Starting upgraded master %d\n", (int) pid);
+      return;
+   }
+
+   setenv(LISTENERS_ENV, inherited, 1);
+   sigprocmask(SIG_SETMASK, mask, NULL);
+   execvp(arguments[0], arguments);
+
+   perror("Can't start the upgraded server");
+   _exit(EXIT_FAILURE);
+
+}
+
+/*
+ * Take over the listening sockets handed down by the master this one
+ *    upgrades, as many as there are workers. The others are closed, as are
+ *    those no longer on the address of the settings.
+ * Returns:
+ *    int adopted: The number of sockets taken over, the first ones of svrs
+ */
+static int adopt_servers() {
+
+   char *inherited = getenv(LISTENERS_ENV), *next;
+   int adopted = 0, socket;
+
+   if (inherited == NULL) {
+      return 0;
+   }
+
+   while ((socket = strtol(inherited, &next, 10)) >= 0 && next != inherited) {
+      if (adopted < num_svrs &&
+         config_adopt(&svrs[adopted], socket, &settings) == 0) {
+         adopted++;
+      }
+      else {
+         close(socket);
+      }
+      inherited = *next == ',' ? next + 1 : next;
+   }
+
+   /* Workers and later upgrades must not take the list for theirs */
+   unsetenv(LISTENERS_ENV);
+   upgraded_master = getppid();
+
+   printf("Took over %d listening sockets from master %d\n", adopted,
+      (int) upgraded_master);
+   return adopted;
 
 }
 
 /*
  * Run the web server.
+ * Params:
+ *    const struct config_source *config: Where the settings are read from,
+ *       again on every hangup
+ *    char *argv[]: The command line, to start an upgraded server with
  * Returns:
  *    int result: Exit code of the server
  */
-int run_server() {
+int run_server(const struct config_source *config, char *argv[]) {
 
-   struct svr_info svr;
-   int request_socket;
-   struct request *incoming_request;
+   int index, adopted;
 
    /* Show license information */
    output_license();
 
-   /* Set up server for listening */
-   config_server(&svr);
-   printf("Server is now listening\n\n");
+   /* A client hanging up mid-response must not kill the server */
+   signal(SIGPIPE, SIG_IGN);
 
-   /* Loop forever, processing requests as they occur */
-   while (1) {
+   source = config;
+   arguments = argv;
+
+   if (load_config(&settings, source) < 0) {
+      return EXIT_FAILURE;
+   }
+
+   set_limits();
+
+   /* Mapped once here, every worker shares the bundle's pages */
+   if (settings.bundle[0] != '\0' &&
+      (bundle = open_bundle(settings.bundle)) == NULL) {
+      fprintf(stderr, "Can't serve bundle %s: ", settings.bundle);
+      perror(NULL);
+      return EXIT_FAILURE;
+   }
 
-      /* Parse incoming request */
-      incoming_request = receive_request(&request_socket, svr);
+   /* Workers record metrics where the master and each other can read them,
+    * with room for workers finishing up next to those replacing them */
+   metrics = create_metrics(2 * MAX_WORKERS);
+
+   /* Static files answer whatever no other route does */
+   router = create_router();
+   router_add(router, "GET", METRICS_URL, serve_metrics);
+   router_add(router, "HEAD", METRICS_URL, serve_metrics);
+   router_add(router, "GET", STREAM_URL, serve_stream);
+   router_add(router, "GET", STREAM_ABORT_URL, serve_aborted_stream);
+   router_add(router, "GET", "/*path", serve_static);
+   router_add(router, "HEAD", "/*path", serve_static);
+
+   /* Set up one listening socket for each worker, taking over those of the
+    * master this one upgrades */
+   num_svrs = settings.workers;
+   svrs = malloc(num_svrs * sizeof(struct svr_info));
+   adopted = adopt_servers();
+
+   if (config_servers(svrs + adopted, num_svrs - adopted, &settings) < 0) {
+      return EXIT_FAILURE;
+   }
+
+   /* Fall back to epoll on kernels without the io_uring features needed */
+   probe_uring();
+
+   printf("Server is now listening with %s\n",
+      use_uring ? "io_uring" : "epoll");
+
+   /* The upgraded master finishes up, connections arriving meanwhile wait
+    * for the new workers on the shared sockets */
+   if (upgraded_master > 1) {
+      kill(upgraded_master, SIGQUIT);
+   }
 
-      /* Decide how to respond to request and then free it*/
-      handle_request(request_socket, incoming_request);
-      close(request_socket);
-      free_request(incoming_request);
+   /* Serve requests from the workers until told to stop */
+   supervise_workers(num_svrs, 2 * MAX_WORKERS, serve_forever,
+      reload_servers, upgrade_server);
 
+   for (index = 0; index < num_svrs; index++) {
+      close(svrs[index].socket);
    }
 
-   /* We will sadly never reach here :( */
-   close(svr.socket);
+   free_router(router);
+   free(svrs);
    return EXIT_SUCCESS;
 
 }
@@ -1,130 +1,186 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/types.h>
-#include <math.h>
 
 #include "hashtable.h"
 
-#define DEFAULT_CAPACITY 100
-#define RESIZE_THRESHOLD 0.6
-#define RESIZE_SCALING_FACTOR 10
+/* Capacities are powers of two, grown once three quarters full */
+#define DEFAULT_CAPACITY 16
+#define RESIZE_NUMERATOR 3
+#define RESIZE_DENOMINATOR 4
 
-static unsigned hash(char *key) {
-   int len = strlen(key);
-   unsigned hash = 0;
-   while (len-- > 0) {
-      hash += (unsigned) floor(pow(key[len], len));
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+/* Tables created in an arena are released with it, never piece by piece */
+static void *table_alloc(struct hashtable *table, size_t size) {
+   if (table->arena != NULL) {
+      return arena_alloc(table->arena, size);
+   }
+   return malloc(size);
+}
+
+static void table_free(struct hashtable *table, void *ptr) {
+   if (table->arena == NULL) {
+      free(ptr);
    }
-   return hash;
 }
 
-static unsigned double_hash(char *key) {
-   int len = strlen(key);
-   unsigned hash = 0;
+/* 32-bit FNV-1a, folding ASCII upper case for caseless tables */
+static unsigned hash(struct hashtable *table, char *key, size_t len) {
+   unsigned hash = FNV_OFFSET_BASIS;
+   unsigned char current;
    while (len-- > 0) {
-      hash += (unsigned) floor(pow(key[len], len + 1));
+      current = (unsigned char) *key++;
+      if ((table->flags & HASHTABLE_CASELESS) && current >= 'A' &&
+         current <= 'Z') {
+         current += 'a' - 'A';
+      }
+      hash = (hash ^ current) * FNV_PRIME;
    }
    return hash;
 }
 
-static void free_hashentry(struct hashentry *entry) {
-   free(entry->key);
-   free(entry->val);
-   free(entry);
+static int matches(struct hashtable *table, struct hashentry *entry,
+   char *key, size_t len, unsigned hash_val) {
+   if (entry->hash != hash_val || entry->key_len != len) {
+      return 0;
+   }
+   if (table->flags & HASHTABLE_CASELESS) {
+      return strncasecmp(entry->key, key, len) == 0;
+   }
+   return memcmp(entry->key, key, len) == 0;
+}
+
+/* Linear probing: the slot holding key, or the empty slot it belongs in */
+static struct hashentry *find_entry(struct hashtable *table, char *key,
+   size_t len, unsigned hash_val) {
+   unsigned mask = table->capacity - 1, index = hash_val & mask;
+   struct hashentry *entry = &table->entries[index];
+   while (entry->key != NULL && !matches(table, entry, key, len, hash_val)) {
+      index = (index + 1) & mask;
+      entry = &table->entries[index];
+   }
+   return entry;
+}
+
+static struct hashentry *alloc_entries(struct hashtable *table,
+   unsigned capacity) {
+   size_t entry_space = capacity * sizeof(struct hashentry);
+   struct hashentry *entries = table_alloc(table, entry_space);
+   memset(entries, 0, entry_space);
+   return entries;
 }
 
 static void expand_table(struct hashtable *table) {
-   unsigned old_capacity = table->capacity;
-   struct hashentry **old_entries = *table->entries;
-   struct hashentry *entry = **table->entries;
-   size_t new_entry_space;
-   int entry_index;
-   table->capacity *= RESIZE_SCALING_FACTOR;
-   new_entry_space = table->capacity * sizeof(struct hashentry *);
-   *table->entries = malloc(new_entry_space);
-   memset(*table->entries, 0, new_entry_space);
+   struct hashentry *old_entries = table->entries, *entry;
+   unsigned old_capacity = table->capacity, entry_index, mask, index;
+   table->capacity *= 2;
+   table->entries = alloc_entries(table, table->capacity);
+   mask = table->capacity - 1;
+   /* Stored hashes are reused, keys are never hashed twice */
    for (entry_index = 0; entry_index < old_capacity; entry_index++) {
+      entry = &old_entries[entry_index];
       if (entry->key != NULL) {
-         set(table, entry->key, entry->val, entry->val_size);
-         free_hashentry(entry);
+         index = entry->hash & mask;
+         while (table->entries[index].key != NULL) {
+            index = (index + 1) & mask;
+         }
+         table->entries[index] = *entry;
       }
-      entry += 1;
-   }
-   free(old_entries);
-}
-
-static struct hashentry *check_valid_entry(struct hashtable *table,
-   char *key, unsigned hash) {
-   if (table->size > RESIZE_THRESHOLD * table->capacity) {
-      expand_table(table);
-   }
-   if ((*table->entries)[hash] == NULL) {
-      (*table->entries)[hash] = malloc(sizeof(struct hashentry));
-      memset((*table->entries)[hash], 0, sizeof(struct hashentry));
-      table->size += 1;
-      return (*table->entries)[hash];
-   }
-   if (strcmp((*table->entries)[hash]->key, key) == 0) {
-      return (*table->entries)[hash];
    }
-   hash = (hash + double_hash(key)) % table->capacity;
-   return check_valid_entry(table, key, hash);
+   table_free(table, old_entries);
 }
 
-static struct hashentry *find_entry(struct hashtable *table, char *key) {
-   unsigned hash_val;
-   struct hashentry *entry;
-   hash_val = hash(key);
-   hash_val %= table->capacity;
-   entry = check_valid_entry(table, key, hash_val);
-   return entry;
+struct hashtable *create_hashtable() {
+   return create_hashtable_in(NULL, 0);
 }
 
-struct hashtable *create_hashtable() {
-   struct hashtable *table = malloc(sizeof(struct hashtable));
-   size_t entry_space = DEFAULT_CAPACITY * sizeof(struct hashentry *);
+struct hashtable *create_hashtable_in(struct arena *arena, int flags) {
+   struct hashtable *table;
+   if (arena != NULL) {
+      table = arena_alloc(arena, sizeof(struct hashtable));
+   }
+   else {
+      table = malloc(sizeof(struct hashtable));
+   }
    table->size = 0;
    table->capacity = DEFAULT_CAPACITY;
-   table->entries = malloc(sizeof(struct hashentry **));
-   *table->entries = malloc(entry_space);
-   memset(*table->entries, 0, entry_space);
+   table->flags = flags;
+   table->arena = arena;
+   table->entries = alloc_entries(table, table->capacity);
    return table;
 }
 
 void set(struct hashtable *table, char *key, void *val, size_t val_size) {
-   struct hashentry *found = find_entry(table, key);
+   setn(table, key, strlen(key), val, val_size);
+}
+
+void setn(struct hashtable *table, char *key, size_t len, void *val,
+   size_t val_size) {
+   unsigned hash_val = hash(table, key, len);
+   struct hashentry *found;
+   if ((table->size + 1) * RESIZE_DENOMINATOR >
+      table->capacity * RESIZE_NUMERATOR) {
+      expand_table(table);
+   }
+   found = find_entry(table, key, len, hash_val);
    if (found->key == NULL) {
-      found->key = malloc((strlen(key) + 1) * sizeof(char));
-      strcpy(found->key, key);
+      if (table->flags & HASHTABLE_BORROW) {
+         found->key = key;
+      }
+      else {
+         found->key = table_alloc(table, (len + 1) * sizeof(char));
+         memcpy(found->key, key, len);
+         found->key[len] = '\0';
+      }
+      found->key_len = len;
+      found->hash = hash_val;
+      table->size += 1;
+   }
+   else if (!(table->flags & HASHTABLE_BORROW)) {
+      table_free(table, found->val);
    }
-   if (found->val != NULL) {
-      free(found->val);
+   if (table->flags & HASHTABLE_BORROW) {
+      found->val = val;
+   }
+   else {
+      found->val = table_alloc(table, val_size);
+      memcpy(found->val, val, val_size);
    }
-   found->val = malloc(val_size);
-   memcpy(found->val, val, val_size);
    found->val_size = val_size;
 }
 
 void *get(struct hashtable *table, char *key) {
-   struct hashentry *found = find_entry(table, key);
+   return getn(table, key, strlen(key), NULL);
+}
+
+void *getn(struct hashtable *table, char *key, size_t len, size_t *val_size) {
+   struct hashentry *found = find_entry(table, key, len,
+      hash(table, key, len));
    if (found->key == NULL) {
-      table->size -= 1;
-      free(found);
       return NULL;
    }
+   if (val_size != NULL) {
+      *val_size = found->val_size;
+   }
    return found->val;
 }
 
 void free_hashtable(struct hashtable *table) {
-   struct hashentry *current;
-   while (table->capacity-- > 0) {
-      current = (*table->entries)[table->capacity];
-      if (current != NULL) {
-         free_hashentry(current);
+   unsigned index;
+   if (table->arena != NULL) {
+      return;
+   }
+   for (index = 0; index < table->capacity; index++) {
+      if (table->entries[index].key != NULL &&
+         !(table->flags & HASHTABLE_BORROW)) {
+         free(table->entries[index].key);
+         free(table->entries[index].val);
       }
    }
-   free(*table->entries);
    free(table->entries);
    free(table);
 }
@@ -3,20 +3,34 @@
 
 #include <sys/types.h>
 
+#include "arena.h"
+
+/* Compare keys without regard to ASCII case, as HTTP header names are */
+#define HASHTABLE_CASELESS 1
+/* Point at keys and values owned by the caller instead of copying them */
+#define HASHTABLE_BORROW 2
+
 struct hashentry {
    char *key;
+   size_t key_len;
+   unsigned hash;
    void *val;
    size_t val_size;
 };
 
 struct hashtable {
-   struct hashentry ***entries;
+   struct hashentry *entries;
    unsigned size, capacity;
+   int flags;
+   struct arena *arena;
 };
 
 struct hashtable *create_hashtable();
+struct hashtable *create_hashtable_in(struct arena *, int);
 void set(struct hashtable *, char *, void *, size_t);
+void setn(struct hashtable *, char *, size_t, void *, size_t);
 void *get(struct hashtable *, char *);
+void *getn(struct hashtable *, char *, size_t, size_t *);
 void free_hashtable(struct hashtable *);
 
 #endif
@@ -23,14 +23,59 @@
  * You should have received a copy of the GNU General Public License
  * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
 
 /*
  * Runs the web server, prototype of function declared in core.c.
+ * Params:
+ *    const struct config_source *source: Where the settings are read from,
+ *       again on every hangup
+ *    char *argv[]: The command line, to start an upgraded server with
  * Returns:
  *    int result: Exit code of the server
  */
-int run_server();
+int run_server(const struct config_source *, char *[]);
+
+/*
+ * Prints how to invoke the server and exits.
+ * Params:
+ *    char *program: The name the server was invoked with
+ */
+static void usage(char *program) {
+
+   fprintf(stderr, "Usage: %s [-c config] [-w workers] [-p port] [-r root] "
+      "[-l log] [-b] [-e] [-a bundle] [-o name=value]\n", program);
+   exit(EXIT_FAILURE);
+
+}
+
+/*
+ * Records a setting given on the command line, which overrides the file.
+ * Params:
+ *    struct config_source *source: The source to add the setting to
+ *    const char *name: The name of the setting
+ *    const char *value: Its value
+ * Returns:
+ *    int result: 0 on success, -1 if too many settings were given
+ */
+static int add_override(struct config_source *source, const char *name,
+   const char *value) {
+
+   if (source->num_overrides == MAX_OVERRIDES) {
+      return -1;
+   }
+
+   source->overrides[source->num_overrides][0] = name;
+   source->overrides[source->num_overrides][1] = value;
+   source->num_overrides++;
+   return 0;
+
+}
 
 /*
  * Entry point of the program.
@@ -42,7 +87,55 @@ int run_server();
  */
 int main(int argc, char *argv[]) {
 
+   /* Kept for the whole run, the settings are read again on every hangup */
+   static struct config_source source;
+   char *value;
+   int option, result = 0;
+
+   while (result == 0 &&
+      (option = getopt(argc, argv, "c:w:p:r:l:bea:o:")) != -1) {
+      switch (option) {
+         case 'c':
+            source.path = optarg;
+            break;
+         case 'w':
+            result = add_override(&source, "workers", optarg);
+            break;
+         case 'p':
+            result = add_override(&source, "port", optarg);
+            break;
+         case 'r':
+            result = add_override(&source, "root", optarg);
+            break;
+         case 'l':
+            result = add_override(&source, "access_log", optarg);
+            break;
+         case 'b':
+            result = add_override(&source, "log_block", "on");
+            break;
+         case 'e':
+            result = add_override(&source, "uring", "off");
+            break;
+         case 'a':
+            result = add_override(&source, "bundle", optarg);
+            break;
+         case 'o':
+            if ((value = strchr(optarg, '=')) == NULL) {
+               usage(argv[0]);
+            }
+            *value++ = '\0';
+            result = add_override(&source, optarg, value);
+            break;
+         default:
+            usage(argv[0]);
+      }
+   }
+
+   if (result < 0 || optind != argc) {
+      usage(argv[0]);
+   }
+
    /* Run server */
-   exit(run_server());
+   exit(run_server(&source, argv));
 
 }
@@ -0,0 +1,310 @@
+/*
+ * metrics.c
+ * Keeps per-worker counters and latency histograms in shared memory and adds
+ *    them up when scraped. Functions are prototyped in metrics.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "metrics.h"
+#include "util.h"
+
+/* Upper bound of the first bucket is 2^MIN_EXPONENT seconds, about 119ns */
+#define MIN_EXPONENT -23
+
+/* Longest line written for a single status code or bucket */
+#define MAX_LINE_LEN 128
+
+static const char *stage_names[NUM_STAGES] = {
+   "accept", "parse", "lookup", "send"
+};
+
+static const char *deadline_names[NUM_DEADLINES] = {
+   "header", "body", "idle", "write"
+};
+
+/*
+ * Maps zeroed metrics for a number of workers into memory that forked
+ *    workers share with the master.
+ * Params:
+ *    int workers: The number of workers
+ * Returns:
+ *    struct metrics *metrics: The shared metrics
+ */
+struct metrics *create_metrics(int workers) {
+
+   struct metrics *metrics = malloc(sizeof(struct metrics));
+
+   /* Anonymous shared mappings start out zeroed */
+   metrics->num_workers = workers;
+   metrics->workers = mmap(NULL, workers * sizeof(struct worker_metrics),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+   if (metrics->workers == MAP_FAILED) {
+      report_errno();
+   }
+
+   return metrics;
+
+}
+
+/*
+ * Reads the monotonic clock for timing stages.
+ * Returns:
+ *    double now: The current time in seconds
+ */
+double metrics_now() {
+
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return now.tv_sec + now.tv_nsec / 1e9;
+
+}
+
+/*
+ * Finds the upper bound of a histogram bucket.
+ * Params:
+ *    int bucket: The index of the bucket
+ * Returns:
+ *    double bound: The longest duration in the bucket, in seconds
+ */
+static double bucket_bound(int bucket) {
+
+   int octave = (bucket - 1) / 2;
+
+   if (bucket == 0) {
+      return ldexp(1, MIN_EXPONENT);
+   }
+
+   /* The first half of an octave ends half way up it */
+   return ldexp((bucket - 1) % 2 == 0 ? 1.5 : 2, MIN_EXPONENT + octave);
+
+}
+
+/*
+ * Records how long a stage took.
+ * Params:
+ *    struct worker_metrics *worker: The metrics of the calling worker
+ *    int stage: The STAGE_* that was timed
+ *    double start: When the stage started, from metrics_now
+ */
+void metrics_observe(struct worker_metrics *worker, int stage, double start) {
+
+   struct histogram *histogram = &worker->stages[stage];
+   double elapsed = metrics_now() - start, fraction;
+   int exponent, bucket;
+
+   histogram->count++;
+   histogram->sum += elapsed;
+
+   /* elapsed is fraction * 2^exponent, fraction in [0.5, 1) */
+   fraction = frexp(elapsed, &exponent);
+   if (elapsed <= 0 || exponent <= MIN_EXPONENT) {
+      bucket = 0;
+   }
+   else {
+      bucket = 1 + 2 * (exponent - 1 - MIN_EXPONENT) + (fraction >= 0.75);
+   }
+
+   if (bucket < HISTOGRAM_BUCKETS) {
+      histogram->buckets[bucket]++;
+   }
+
+}
+
+/*
+ * Counts a response by its status code.
+ * Params:
+ *    struct worker_metrics *worker: The metrics of the calling worker
+ *    int status: The status code of the response
+ */
+void metrics_count_response(struct worker_metrics *worker, int status) {
+
+   if (status >= MIN_STATUS && status <= MAX_STATUS) {
+      worker->requests[status - MIN_STATUS]++;
+   }
+
+}
+
+/*
+ * Adds up the memory held by the connections of all workers.
+ * Params:
+ *    struct metrics *metrics: The metrics of all workers
+ * Returns:
+ *    unsigned long memory: The bytes held
+ */
+unsigned long metrics_connection_memory(struct metrics *metrics) {
+
+   unsigned long total = 0;
+   int worker;
+
+   for (worker = 0; worker < metrics->num_workers; worker++) {
+      total += metrics->workers[worker].connection_memory;
+   }
+
+   return total;
+
+}
+
+/*
+ * Adds up the histograms of one stage over all workers.
+ * Params:
+ *    struct metrics *metrics: The metrics of all workers
+ *    int stage: The STAGE_* to add up
+ *    struct histogram *total: Filled with the sum
+ */
+static void sum_histograms(struct metrics *metrics, int stage,
+   struct histogram *total) {
+
+   struct histogram *histogram;
+   int worker, bucket;
+
+   memset(total, 0, sizeof(struct histogram));
+
+   for (worker = 0; worker < metrics->num_workers; worker++) {
+      histogram = &metrics->workers[worker].stages[stage];
+      for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+         total->buckets[bucket] += histogram->buckets[bucket];
+      }
+      total->count += histogram->count;
+      total->sum += histogram->sum;
+   }
+
+}
+
+/*
+ * Adds up the metrics of all workers in the Prometheus text format.
+ * Params:
+ *    struct metrics *metrics: The metrics to format
+ *    struct arena *arena: The arena the text is written into
+ *    size_t *len: Filled with the length of the text
+ * Returns:
+ *    char *text: The formatted metrics
+ */
+char *metrics_format(struct metrics *metrics, struct arena *arena,
+   size_t *len) {
+
+   struct worker_metrics *worker;
+   struct histogram histogram;
+   unsigned long total, bytes_sent = 0, accepted = 0, dropped = 0, cumulative;
+   unsigned long memory = 0;
+   long active = 0, parked = 0;
+   int index, status, stage, bucket, deadline;
+   char *text, *position;
+
+   /* Room for every line that could possibly be written */
+   text = position = arena_alloc(arena, MAX_LINE_LEN * (32 + NUM_DEADLINES +
+      (MAX_STATUS - MIN_STATUS + 1) + NUM_STAGES * (HISTOGRAM_BUCKETS + 3)));
+
+   for (index = 0; index < metrics->num_workers; index++) {
+      worker = &metrics->workers[index];
+      bytes_sent += worker->bytes_sent;
+      accepted += worker->connections_accepted;
+      dropped += worker->log_dropped;
+      active += worker->connections_active;
+      parked += worker->connections_parked;
+      memory += worker->connection_memory;
+   }
+
+   position += sprintf(position,
+      "# HELP webc_requests_total Responses sent, by status code.\n"
+      "# TYPE webc_requests_total counter\n");
+   for (status = MIN_STATUS; status <= MAX_STATUS; status++) {
+      for (index = 0, total = 0; index < metrics->num_workers; index++) {
+         total += metrics->workers[index].requests[status - MIN_STATUS];
+      }
+      if (total > 0) {
+         position += sprintf(position, "webc_requests_total{code=\"%d\"} %lu\n",
+            status, total);
+      }
+   }
+
+   position += sprintf(position,
+      "# HELP webc_bytes_sent_total Response bytes written to sockets.\n"
+      "# TYPE webc_bytes_sent_total counter\n"
+      "webc_bytes_sent_total %lu\n"
+      "# HELP webc_connections_accepted_total Connections accepted.\n"
+      "# TYPE webc_connections_accepted_total counter\n"
+      "webc_connections_accepted_total %lu\n"
+      "# HELP webc_connections_active Connections currently open.\n"
+      "# TYPE webc_connections_active gauge\n"
+      "webc_connections_active %ld\n", bytes_sent, accepted, active);
+
+   position += sprintf(position,
+      "# HELP webc_connections_parked Connections waiting for memory to be "
+      "released before reading more.\n"
+      "# TYPE webc_connections_parked gauge\n"
+      "webc_connections_parked %ld\n"
+      "# HELP webc_connection_memory_bytes Memory held by open connections.\n"
+      "# TYPE webc_connection_memory_bytes gauge\n"
+      "webc_connection_memory_bytes %lu\n", parked, memory);
+
+   position += sprintf(position,
+      "# HELP webc_access_log_dropped_total Records lost to a full log ring.\n"
+      "# TYPE webc_access_log_dropped_total counter\n"
+      "webc_access_log_dropped_total %lu\n", dropped);
+
+   position += sprintf(position,
+      "# HELP webc_connection_timeouts_total Connections closed by a "
+      "deadline.\n"
+      "# TYPE webc_connection_timeouts_total counter\n");
+   for (deadline = 0; deadline < NUM_DEADLINES; deadline++) {
+      for (index = 0, total = 0; index < metrics->num_workers; index++) {
+         total += metrics->workers[index].timeouts[deadline];
+      }
+      position += sprintf(position,
+         "webc_connection_timeouts_total{deadline=\"%s\"} %lu\n",
+         deadline_names[deadline], total);
+   }
+
+   position += sprintf(position,
+      "# HELP webc_stage_duration_seconds Time spent in each stage of "
+      "serving requests.\n"
+      "# TYPE webc_stage_duration_seconds histogram\n");
+   for (stage = 0; stage < NUM_STAGES; stage++) {
+      sum_histograms(metrics, stage, &histogram);
+      for (bucket = 0, cumulative = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+         cumulative += histogram.buckets[bucket];
+         position += sprintf(position, "webc_stage_duration_seconds_bucket"
+            "{stage=\"%s\",le=\"%.6g\"} %lu\n", stage_names[stage],
+            bucket_bound(bucket), cumulative);
+      }
+      position += sprintf(position, "webc_stage_duration_seconds_bucket"
+         "{stage=\"%s\",le=\"+Inf\"} %lu\n"
+         "webc_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n"
+         "webc_stage_duration_seconds_count{stage=\"%s\"} %lu\n",
+         stage_names[stage], histogram.count, stage_names[stage],
+         histogram.sum, stage_names[stage], histogram.count);
+   }
+
+   *len = position - text;
+   return text;
+
+}
@@ -0,0 +1,143 @@
+/*
+ * metrics.h
+ * Makes available the counters and latency histograms of every worker.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sys/types.h>
+
+#include "arena.h"
+
+/* Stages of serving a request that are timed */
+#define STAGE_ACCEPT 0
+#define STAGE_PARSE  1
+#define STAGE_LOOKUP 2
+#define STAGE_SEND   3
+#define NUM_STAGES   4
+
+/* Deadlines of a connection, counted when they close one */
+#define DEADLINE_HEADER 0
+#define DEADLINE_BODY   1
+#define DEADLINE_IDLE   2
+#define DEADLINE_WRITE  3
+#define NUM_DEADLINES   4
+
+/* Status codes counted, one counter each */
+#define MIN_STATUS 100
+#define MAX_STATUS 599
+
+/* Log-linear buckets: one below 2^-23 seconds, then two per octave */
+#define HISTOGRAM_OCTAVES 28
+#define HISTOGRAM_BUCKETS (1 + 2 * HISTOGRAM_OCTAVES)
+
+/*
+ * Durations recorded into fixed buckets, HDR style, so recording is a few
+ *    arithmetic operations and histograms add up by bucket. Longer durations
+ *    than the last bucket only count towards count and sum.
+ */
+struct histogram {
+   unsigned long buckets[HISTOGRAM_BUCKETS];
+   unsigned long count;
+   double sum;
+};
+
+/*
+ * The metrics of one worker. Only that worker ever writes them, so they are
+ *    updated without locks or atomic instructions and only added up with
+ *    those of the other workers when scraped.
+ */
+struct worker_metrics {
+   unsigned long requests[MAX_STATUS - MIN_STATUS + 1];
+   unsigned long bytes_sent, connections_accepted, log_dropped;
+   long connections_active, connections_parked;
+   unsigned long connection_memory;
+   unsigned long timeouts[NUM_DEADLINES];
+   struct histogram stages[NUM_STAGES];
+};
+
+/*
+ * The metrics of all workers, in memory shared between the processes.
+ */
+struct metrics {
+   int num_workers;
+   struct worker_metrics *workers;
+};
+
+/*
+ * Maps zeroed metrics for a number of workers into memory that forked
+ *    workers share with the master.
+ * Params:
+ *    int workers: The number of workers
+ * Returns:
+ *    struct metrics *metrics: The shared metrics
+ */
+struct metrics *create_metrics(int);
+
+/*
+ * Reads the monotonic clock for timing stages.
+ * Returns:
+ *    double now: The current time in seconds
+ */
+double metrics_now();
+
+/*
+ * Records how long a stage took.
+ * Params:
+ *    struct worker_metrics *worker: The metrics of the calling worker
+ *    int stage: The STAGE_* that was timed
+ *    double start: When the stage started, from metrics_now
+ */
+void metrics_observe(struct worker_metrics *, int, double);
+
+/*
+ * Counts a response by its status code.
+ * Params:
+ *    struct worker_metrics *worker: The metrics of the calling worker
+ *    int status: The status code of the response
+ */
+void metrics_count_response(struct worker_metrics *, int);
+
+/*
+ * Adds up the memory held by the connections of all workers.
+ * Params:
+ *    struct metrics *metrics: The metrics of all workers
+ * Returns:
+ *    unsigned long memory: The bytes held
+ */
+unsigned long metrics_connection_memory(struct metrics *);
+
+/*
+ * Adds up the metrics of all workers in the Prometheus text format.
+ * Params:
+ *    struct metrics *metrics: The metrics to format
+ *    struct arena *arena: The arena the text is written into
+ *    size_t *len: Filled with the length of the text
+ * Returns:
+ *    char *text: The formatted metrics
+ */
+char *metrics_format(struct metrics *, struct arena *, size_t *);
+
+#endif
@@ -25,105 +25,854 @@
  * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <strings.h>
 
+#include "buffer.h"
 #include "request.h"
-#include "util.h"
 #include "hashtable.h"
+#include "scan.h"
+#include "slice.h"
+#include "util.h"
+
+/*
+ * Reads a decimal number made of nothing but digits.
+ * Parameters:
+ *   struct slice digits: the digits to read.
+ * Returns:
+ *   long number: the number, or -1 if it is malformed or too large.
+ */
+static long parse_number(struct slice digits) {
 
-#define DEFAULT_HEADER_LEN 10
+   long result = 0;
+   size_t index;
+
+   if (digits.len == 0) {
+      return -1;
+   }
+
+   for (index = 0; index < digits.len; index++) {
+      if (digits.data[index] < '0' || digits.data[index] > '9' ||
+         result > (LONG_MAX - 9) / 10) {
+         return -1;
+      }
+      result = result * 10 + (digits.data[index] - '0');
+   }
+
+   return result;
+
+}
 
 /*
- * Parses a set of request headers from a raw request c-style string.
+ * Parses a set of request headers from the buffered input of a connection.
+ *    Names and values are left in the input, the headers table only points
+ *    at them.
  * Parameters:
- *   int socket: The web socket to read the request headers from.
+ *   struct request *request: The request to add the parsed headers to.
+ *   struct buffer *in: The buffered input holding the request.
+ *   size_t *pos: Where the headers start, moved past the blank line ending them.
+ *   struct request_limits *limits: The most headers and header bytes allowed.
  * Returns:
- *   request_header **result: set of request headers parsed from raw.
+ *   int complete: 1 if every header has arrived, 0 if more input is needed
+ *      or the headers are over the limits, with the request error set to 431,
+ *      or a line is malformed or repeats Content-Length with another value,
+ *      with it set to 400.
  */
+static int parse_headers(struct request *request, struct buffer *in,
+   size_t *pos, struct request_limits *limits) {
+
+   struct slice line, name;
+   size_t start = *pos, previous_len;
+   char *previous;
 
-static void parse_headers(struct request *request, int socket) {
+   while (buffer_line(in, pos, &line)) {
 
-   char *test, *key, *val;
+      if (*pos - start > limits->max_header_bytes) {
+         request->error = 431;
+         return 0;
+      }
 
-   test = fdgets(socket, '\n');
+      /* A blank line ends the headers */
+      if (line.len == 0) {
+         return 1;
+      }
 
-   while (strlen(test) > 1) {
+      if (request->num_headers == limits->max_headers) {
+         request->error = 431;
+         return 0;
+      }
 
-      key = substring(&test, ':');
-      val = substring(&test, '\r');
-      set(request->headers, key, val, (strlen(val) + 1) * sizeof(char));
-      free(test);
-      test = fdgets(socket, '\n');
+      /* The name must be all token characters up to the colon, and the
+       * value free of control characters. Anything else, like a space
+       * before the colon or a folded line, could be read differently by a
+       * proxy in front, so the request is rejected */
+      name.data = line.data;
+      name.len = scan_token(line.data, line.len);
+      if (name.len == 0 || name.len == line.len || line.data[name.len] != ':') {
+         request->error = 400;
+         return 0;
+      }
+
+      line.data += name.len + 1;
+      line.len -= name.len + 1;
+      if (scan_text(line.data, line.len) != line.len) {
+         request->error = 400;
+         return 0;
+      }
+      slice_trim(&line);
+
+      /* The body can't be framed by lengths that disagree */
+      if (slice_case_equals(name, "Content-Length") &&
+         (previous = getn(request->headers, name.data, name.len,
+         &previous_len)) != NULL &&
+         (previous_len != line.len ||
+         memcmp(previous, line.data, line.len) != 0)) {
+         request->error = 400;
+         return 0;
+      }
+
+      setn(request->headers, name.data, name.len, line.data, line.len);
+      request->num_headers++;
 
    }
 
-   free(test);
+   /* Headers still arriving can already be too long */
+   if (in->end - start > limits->max_header_bytes) {
+      request->error = 431;
+   }
+
+   return 0;
 
 }
 
 /*
- * Parses c-style string containing a url for next path and removes it from url.
+ * Checks the request line of a request: a method made of token characters,
+ *    a url without control characters and an HTTP/x.y version.
  * Parameters:
- *   char **url: the url to parse for next path.
+ *   struct request *request: The request whose line was split up
  * Returns:
- *   char *result: the path found.
+ *   int valid: 1 if the request line is well formed, 0 otherwise
  */
-static char *parse_url_path_def(char **url) {
-   return substring(url, '/');
+static int valid_request_line(struct request *request) {
+
+   struct slice version = request->version;
+
+   if (request->type.len == 0 ||
+      scan_token(request->type.data, request->type.len) != request->type.len ||
+      request->url.len == 0 ||
+      scan_text(request->url.data, request->url.len) != request->url.len) {
+      return 0;
+   }
+
+   return version.len == 8 && memcmp(version.data, "HTTP/", 5) == 0 &&
+      version.data[5] >= '0' && version.data[5] <= '9' &&
+      version.data[6] == '.' &&
+      version.data[7] >= '0' && version.data[7] <= '9';
+
 }
 
 /*
- * Parses a complete http request from a client into a useful struct.
+ * Removes the next path segment from a url.
  * Parameters:
- *   int socket: the web socket to read the request from.
+ *   struct slice *url: the url to take the segment from.
  * Returns:
- *   struct request parsed: the parsed request.
+ *   struct slice result: the segment found.
  */
-struct request *parse_request(int socket) {
+static struct slice parse_url_path_def(struct slice *url) {
 
-   struct request *parsed = malloc(sizeof(struct request));
-   memset(parsed, 0, sizeof(struct request));
+   /* Skip the slashes leading up to the segment */
+   while (url->len > 0 && *url->data == '/') {
+      url->data++;
+      url->len--;
+   }
+
+   return slice_split(url, '/');
+
+}
+
+/*
+ * Parses a request head from buffered input, in place, consuming nothing but
+ *    the blank lines before it.
+ * Parameters:
+ *   struct buffer *in: The buffered input to parse the head from
+ *   struct arena *arena: The arena holding the request until it is answered
+ *   struct request_limits *limits: The largest request to accept
+ *   size_t *pos: Set past the end of the head, once all of it has arrived
+ * Returns:
+ *   struct request parsed: the parsed request, with error set to 400 if it is
+ *      malformed or to 414 or 431 if it is over the limits, or NULL if it
+ *      is incomplete.
+ */
+static struct request *parse_head(struct buffer *in, struct arena *arena,
+   struct request_limits *limits, size_t *pos) {
 
-   /* Read in type and url of the request */
-   parsed->type = fdgets(socket, ' ');
-   parsed->url  = fdgets(socket, ' ');
+   struct request *parsed;
+   struct arena_mark mark;
+   struct slice line;
+   int too_long;
 
-   /* Skip over the http/1.1 part */
-   free(fdgets(socket, '\n'));
+   *pos = in->start;
+
+   /* Drop empty lines left over before the request line, so they can't
+    * fill up the input */
+   while (*pos < in->end &&
+      (in->data[*pos] == '\r' || in->data[*pos] == '\n')) {
+      (*pos)++;
+   }
 
-   /* Read in request headers */
-   parsed->headers = create_hashtable();
-   parse_headers(parsed, socket);
+   buffer_consume(in, *pos);
+   *pos = in->start;
 
-   /* Add function pointer and return request */
+   /* A request line too long to accept is rejected before it ends */
+   if (!buffer_line(in, pos, &line)) {
+      if (in->end - *pos <= limits->max_line) {
+         return NULL;
+      }
+      line.data = in->data + *pos;
+      line.len = in->end - *pos;
+   }
+
+   too_long = line.len > limits->max_line;
+
+   arena_mark(arena, &mark);
+   parsed = arena_alloc(arena, sizeof(struct request));
+   memset(parsed, 0, sizeof(struct request));
+   parsed->headers = create_hashtable_in(arena,
+      HASHTABLE_CASELESS | HASHTABLE_BORROW);
    parsed->parse_url_path = parse_url_path_def;
+
+   /* Split type, url and version out of the request line */
+   parsed->type = slice_split(&line, ' ');
+   parsed->url = slice_split(&line, ' ');
+   parsed->version = line;
+
+   if (too_long) {
+      parsed->error = 414;
+      return parsed;
+   }
+
+   /* Nothing more can be made of a request without a proper request line */
+   if (!valid_request_line(parsed)) {
+      parsed->error = 400;
+      return parsed;
+   }
+
+   /* Read in request headers, giving up until more input arrives */
+   if (!parse_headers(parsed, in, pos, limits)) {
+      if (parsed->error != 0) {
+         return parsed;
+      }
+      arena_rewind(arena, &mark);
+      return NULL;
+   }
+
    return parsed;
 
 }
 
 /*
- * Frees all memory used by a request.
+ * Parses a complete http request head from the buffered input of a
+ *    connection. Nothing but blank lines is consumed from the input unless
+ *    the whole head has arrived, so parsing can simply be retried once more
+ *    input is read. Every retry checks the limits again, so a request over
+ *    them is rejected as soon as enough of it has arrived to tell. The body
+ *    is left in the input for the connection to read.
+ * Parameters:
+ *   struct buffer *in: The buffered input to parse the request from
+ *   struct arena *arena: The arena holding the request until it is answered
+ *   struct request_limits *limits: The largest request to accept
+ * Returns:
+ *   struct request parsed: the parsed request, with error set to 400 if it is
+ *      malformed or its body can't be framed, to 414, 431 or 413 if it is
+ *      over the limits, or NULL if it is incomplete.
+ */
+struct request *parse_request(struct buffer *in, struct arena *arena,
+   struct request_limits *limits) {
+
+   struct request *parsed;
+   struct arena_mark mark;
+   struct buffer head;
+   struct slice length;
+   size_t pos, end;
+
+   arena_mark(arena, &mark);
+   parsed = parse_head(in, arena, limits, &pos);
+
+   if (parsed == NULL || parsed->error != 0) {
+      return parsed;
+   }
+
+   /* Where the body ends must be told from a proper Content-Length, or from
+    * chunked as the final transfer coding, or the stream is lost */
+   length = request_header(parsed, "Content-Length");
+   if (request_header(parsed, "Transfer-Encoding").data != NULL ?
+      !request_chunked(parsed) :
+      length.data != NULL && parse_number(length) < 0) {
+      parsed->error = 400;
+   }
+
+   /* A body announced over the limit isn't read at all */
+   else if (request_content_length(parsed) > limits->max_body) {
+      parsed->error = 413;
+   }
+
+   /* The input moves to make room while a body arrives, so the head of a
+    * request with one is parsed again from a copy that stays put */
+   else if (request_content_length(parsed) > 0 || request_chunked(parsed)) {
+      head.start = 0;
+      head.end = head.size = head.max_size = pos - in->start;
+      arena_rewind(arena, &mark);
+      head.data = arena_alloc(arena, head.size);
+      memcpy(head.data, in->data + in->start, head.size);
+      parsed = parse_head(&head, arena, limits, &end);
+   }
+
+   buffer_consume(in, pos);
+
+   return parsed;
+
+}
+
+/*
+ * Finds the value of a request header.
  * Params:
- *    struct request *req: The request to be completely freed
+ *    struct request *req: The request to search
+ *    char *name: The header name, compared without regard to case
+ * Returns:
+ *    struct slice value: The value, with data NULL if the header is absent
  */
-void free_request(struct request *req) {
+struct slice request_header(struct request *req, char *name) {
+
+   struct slice value;
+
+   value.len = 0;
+   value.data = getn(req->headers, name, strlen(name), &value.len);
+   return value;
+
+}
+
+/*
+ * Reads the quality value among the parameters of a list item.
+ * Parameters:
+ *   struct slice params: the parameters following the item, like ";q=0.5".
+ * Returns:
+ *   int quality: the quality in thousandths, 1000 if none is given.
+ */
+static int parse_quality(struct slice params) {
+
+   struct slice param;
+   int quality, scale;
+
+   while (params.len > 0) {
+
+      param = slice_split(&params, ';');
+      slice_trim(&param);
+
+      if (param.len < 2 || (param.data[0] != 'q' && param.data[0] != 'Q') ||
+         param.data[1] != '=') {
+         continue;
+      }
+
+      /* A qvalue has a single integer digit and up to three decimals */
+      quality = param.len > 2 && param.data[2] == '1' ? 1000 : 0;
+      param.data += 3;
+      param.len = param.len > 3 ? param.len - 3 : 0;
+      if (quality == 0 && param.len > 0 && *param.data == '.') {
+         for (scale = 100; scale > 0 && --param.len > 0; scale /= 10) {
+            param.data++;
+            if (*param.data < '0' || *param.data > '9') {
+               break;
+            }
+            quality += (*param.data - '0') * scale;
+         }
+      }
+
+      return quality;
+
+   }
 
-   /* Free everything */
-   free(req->type);
-   free(req->url);
-   free_hashtable(req->headers);
-   free(req);
+   return 1000;
 
 }
 
 /*
- * Prints a request to the console.
+ * Finds how much the client wants a response in a content coding, according
+ *    to its Accept-Encoding header.
  * Params:
- *    struct request *request: The request to be printed
+ *    struct request *req: The request to inspect
+ *    char *coding: The content coding, like gzip or identity
+ * Returns:
+ *    int quality: From 0, not acceptable, up to 1000 in thousandths
+ */
+int request_encoding_quality(struct request *req, char *coding) {
+
+   struct slice accept = request_header(req, "Accept-Encoding"), item, name;
+   int quality, wildcard = -1;
+
+   while (accept.data != NULL && accept.len > 0) {
+
+      item = slice_split(&accept, ',');
+      name = slice_split(&item, ';');
+      slice_trim(&name);
+      quality = parse_quality(item);
+
+      if (slice_case_equals(name, coding)) {
+         return quality;
+      }
+      else if (slice_equals(name, "*")) {
+         wildcard = quality;
+      }
+
+   }
+
+   if (wildcard >= 0) {
+      return wildcard;
+   }
+
+   /* Unlisted codings are unwanted, unless it is no coding at all */
+   return strcmp(coding, "identity") == 0 ? 1000 : 0;
+
+}
+
+/*
+ * Decides whether the client's copy of a static file is still current, so
+ *    a 304 Not Modified can stand in for it. If-None-Match takes precedence
+ *    over If-Modified-Since.
+ * Params:
+ *    struct request *req: The request to inspect
+ *    const char *etag: The quoted entity tag of the file
+ *    time_t modified: The modification time of the file
+ * Returns:
+ *    int not_modified: 1 if the copy is current, 0 if the file must be sent
  */
-void log_request(struct request *request) {
-   printf("%s %s successful\n", request->type, request->url);
+int request_not_modified(struct request *req, const char *etag,
+   time_t modified) {
+
+   struct slice match = request_header(req, "If-None-Match"), item;
+   struct slice since = request_header(req, "If-Modified-Since");
+   char date[HTTP_DATE_LEN];
+   time_t since_time;
+
+   if (!slice_equals(req->type, "GET") && !slice_equals(req->type, "HEAD")) {
+      return 0;
+   }
+
+   if (match.data != NULL) {
+
+      /* Tags are compared weakly, ignoring any W/ prefix */
+      while (match.len > 0) {
+         item = slice_split(&match, ',');
+         slice_trim(&item);
+         if (item.len > 2 && item.data[0] == 'W' && item.data[1] == '/') {
+            item.data += 2;
+            item.len -= 2;
+         }
+         if (slice_equals(item, "*") || slice_equals(item, etag)) {
+            return 1;
+         }
+      }
+
+      return 0;
+
+   }
+
+   if (since.data == NULL || since.len >= sizeof(date)) {
+      return 0;
+   }
+
+   memcpy(date, since.data, since.len);
+   date[since.len] = '\0';
+   return parse_http_date(date, &since_time) == 0 && modified <= since_time;
+
+}
+
+/*
+ * Decides whether If-Range still names the current version of a file.
+ * Parameters:
+ *   struct slice condition: the If-Range value, an entity tag or a date.
+ *   const char *etag: the quoted entity tag of the file.
+ *   time_t modified: the modification time of the file.
+ * Returns:
+ *   int current: 1 if ranges of the file may be sent, 0 otherwise.
+ */
+static int if_range_matches(struct slice condition, const char *etag,
+   time_t modified) {
+
+   char date[HTTP_DATE_LEN];
+   time_t condition_time;
+
+   /* Tags must match strongly, so a weak W/ tag never does */
+   if (condition.len > 0 && condition.data[0] != '"' &&
+      !(condition.len > 1 && condition.data[0] == 'W' &&
+      condition.data[1] == '/')) {
+      if (condition.len >= sizeof(date)) {
+         return 0;
+      }
+      memcpy(date, condition.data, condition.len);
+      date[condition.len] = '\0';
+      return parse_http_date(date, &condition_time) == 0 &&
+         condition_time == modified;
+   }
+
+   return slice_equals(condition, etag);
+
+}
+
+/*
+ * Reads the byte ranges of a file that a GET request asks for in its Range
+ *    header. Ranges are ignored when If-Range names another version of the
+ *    file, when the header is malformed, or when it asks for more than max.
+ * Params:
+ *    struct request *req: The request to inspect
+ *    off_t size: The size of the file
+ *    const char *etag: The quoted entity tag of the file
+ *    time_t modified: The modification time of the file
+ *    struct byte_range *ranges: Filled with the satisfiable ranges, in order
+ *    int max: The most ranges that fit in ranges
+ * Returns:
+ *    int count: The number of satisfiable ranges, possibly 0, or -1 if the
+ *       whole file should be sent
+ */
+int request_ranges(struct request *req, off_t size, const char *etag,
+   time_t modified, struct byte_range *ranges, int max) {
+
+   struct slice range = request_header(req, "Range");
+   struct slice condition = request_header(req, "If-Range");
+   struct slice spec, first;
+   long start, end;
+   int count = 0;
+
+   if (range.data == NULL || !slice_equals(req->type, "GET") ||
+      (condition.data != NULL && !if_range_matches(condition, etag,
+      modified))) {
+      return -1;
+   }
+
+   if (range.len < 6 || strncasecmp(range.data, "bytes=", 6) != 0) {
+      return -1;
+   }
+   range.data += 6;
+   range.len -= 6;
+
+   while (range.len > 0) {
+
+      spec = slice_split(&range, ',');
+      slice_trim(&spec);
+      if (spec.len == 0) {
+         continue;
+      }
+      if (memchr(spec.data, '-', spec.len) == NULL) {
+         return -1;
+      }
+
+      /* After the split spec holds what followed the dash */
+      first = slice_split(&spec, '-');
+      start = first.len > 0 ? parse_number(first) : -1;
+      end = spec.len > 0 ? parse_number(spec) : -1;
+
+      /* A suffix range asks for the last bytes of the file */
+      if (first.len == 0) {
+         if (end < 0) {
+            return -1;
+         }
+         if (end == 0 || size == 0) {
+            continue;
+         }
+         start = end < size ? size - end : 0;
+         end = size - 1;
+      }
+      else if (start < 0 || (spec.len > 0 && (end < 0 || end < start))) {
+         return -1;
+      }
+      else if (spec.len == 0 || end >= size) {
+         end = size - 1;
+      }
+
+      if (start >= size) {
+         continue;
+      }
+      if (count == max) {
+         return -1;
+      }
+
+      ranges[count].first = start;
+      ranges[count].last = end;
+      count++;
+
+   }
+
+   return count;
+
+}
+
+/*
+ * Decides whether the client wants the connection kept open after responding.
+ * Params:
+ *    struct request *req: The request to inspect
+ * Returns:
+ *    int keep_alive: 1 if the connection may be reused, 0 otherwise
+ */
+int request_keep_alive(struct request *req) {
+
+   struct slice connection = request_header(req, "Connection");
+
+   if (connection.data != NULL && slice_has_token(connection, "close")) {
+      return 0;
+   }
+
+   /* HTTP/1.1 connections persist unless closed, HTTP/1.0 ones must ask */
+   if (slice_equals(req->version, "HTTP/1.1")) {
+      return 1;
+   }
+
+   return slice_equals(req->version, "HTTP/1.0") && connection.data != NULL &&
+      slice_has_token(connection, "keep-alive");
+
+}
+
+/*
+ * Finds the length of the body following a request head.
+ * Params:
+ *    struct request *req: The request to inspect
+ * Returns:
+ *    long length: The body length, or -1 if it is chunked. Requests with a
+ *       malformed Content-Length never get past parse_request
+ */
+long request_content_length(struct request *req) {
+
+   struct slice length = request_header(req, "Content-Length");
+
+   if (request_header(req, "Transfer-Encoding").data != NULL) {
+      return -1;
+   }
+
+   return length.data != NULL ? parse_number(length) : 0;
+
+}
+
+/*
+ * Tells whether the body following a request head is chunked.
+ * Params:
+ *    struct request *req: The request to inspect
+ * Returns:
+ *    int chunked: 1 if chunked is the last transfer coding, 0 otherwise
+ */
+int request_chunked(struct request *req) {
+
+   struct slice codings = request_header(req, "Transfer-Encoding"), coding;
+
+   if (codings.data == NULL) {
+      return 0;
+   }
+
+   /* Any other coding applied last leaves the body without an end */
+   do {
+      coding = slice_split(&codings, ',');
+      slice_trim(&coding);
+   } while (codings.len > 0);
+
+   return slice_case_equals(coding, "chunked");
+
+}
+
+/* Where a chunked decoder is up to: a chunk size, the whitespace after it,
+ * its extensions and line break, the data and the line break after it, then
+ * the trailer lines */
+#define CHUNK_SIZE_START   0
+#define CHUNK_SIZE         1
+#define CHUNK_SIZE_SPACE   2
+#define CHUNK_EXTENSION    3
+#define CHUNK_SIZE_LF      4
+#define CHUNK_DATA         5
+#define CHUNK_DATA_CR      6
+#define CHUNK_DATA_LF      7
+#define CHUNK_TRAILER      8
+#define CHUNK_TRAILER_LINE 9
+#define CHUNK_LAST_LF      10
+#define CHUNK_DONE         11
+
+/*
+ * Reads a hexadecimal digit.
+ * Params:
+ *    char digit: The character to read
+ * Returns:
+ *    int value: The value of the digit, or -1 if it isn't one
+ */
+static int hex_value(char digit) {
+
+   if (digit >= '0' && digit <= '9') {
+      return digit - '0';
+   }
+   if (digit >= 'a' && digit <= 'f') {
+      return digit - 'a' + 10;
+   }
+   if (digit >= 'A' && digit <= 'F') {
+      return digit - 'A' + 10;
+   }
+
+   return -1;
+
+}
+
+/*
+ * Gets a decoder ready for a new chunked body.
+ * Params:
+ *    struct chunked_decoder *decoder: The decoder to reset
+ *    long max: The most data bytes the body may carry
+ */
+void init_chunked_decoder(struct chunked_decoder *decoder, long max) {
+
+   decoder->state = CHUNK_SIZE_START;
+   decoder->line = 0;
+   decoder->remaining = decoder->total = 0;
+   decoder->max = max;
+
+}
+
+/*
+ * Decodes the next part of a chunked body, stopping at the first data found
+ *    so it can be used in place.
+ * Params:
+ *    struct chunked_decoder *decoder: Where the body is up to
+ *    char *input: The body bytes received so far and not yet used
+ *    size_t len: The number of bytes at input
+ *    size_t *used: Set to the number of input bytes decoded
+ *    struct slice *data: Set to the data found, pointing into input
+ * Returns:
+ *    int result: CHUNKED_DATA with data set, CHUNKED_MORE once all of input
+ *       is used without finding any, CHUNKED_DONE after the last trailer,
+ *       CHUNKED_ERROR if the body is malformed or CHUNKED_TOO_LARGE if it
+ *       carries more than max
+ */
+int chunked_decode(struct chunked_decoder *decoder, char *input, size_t len,
+   size_t *used, struct slice *data) {
+
+   size_t index;
+   int digit;
+   char next;
+
+   for (index = 0; index < len && decoder->state != CHUNK_DONE; index++) {
+
+      /* Data is handed out in place, as much of the chunk as has arrived */
+      if (decoder->state == CHUNK_DATA) {
+         data->data = input + index;
+         data->len = len - index < decoder->remaining ?
+            len - index : decoder->remaining;
+         decoder->remaining -= data->len;
+         if (decoder->remaining == 0) {
+            decoder->state = CHUNK_DATA_CR;
+         }
+         *used = index + data->len;
+         return CHUNKED_DATA;
+      }
+
+      next = input[index];
+
+      /* Size and trailer lines are skipped, but never without end */
+      if (decoder->state != CHUNK_DATA_CR && decoder->state != CHUNK_DATA_LF &&
+         ++decoder->line > CHUNKED_MAX_LINE) {
+         return CHUNKED_ERROR;
+      }
+
+      switch (decoder->state) {
+
+         case CHUNK_SIZE_START:
+         case CHUNK_SIZE:
+            digit = hex_value(next);
+            if (digit >= 0) {
+               if (decoder->remaining > (ULONG_MAX >> 4)) {
+                  return CHUNKED_TOO_LARGE;
+               }
+               decoder->remaining = decoder->remaining << 4 | digit;
+               decoder->state = CHUNK_SIZE;
+               break;
+            }
+            if (decoder->state == CHUNK_SIZE_START) {
+               return CHUNKED_ERROR;
+            }
+            /* Falls through, as only whitespace, an extension or the line
+             * break may follow the digits */
+
+         case CHUNK_SIZE_SPACE:
+            if (next == ' ' || next == '\t') {
+               decoder->state = CHUNK_SIZE_SPACE;
+               break;
+            }
+            if (next == ';') {
+               decoder->state = CHUNK_EXTENSION;
+               break;
+            }
+            if (next == '\r') {
+               decoder->state = CHUNK_SIZE_LF;
+               break;
+            }
+            if (next != '\n') {
+               return CHUNKED_ERROR;
+            }
+            /* Falls through to end the size line */
+
+         case CHUNK_EXTENSION:
+         case CHUNK_SIZE_LF:
+            if (next != '\n') {
+               if (decoder->state == CHUNK_SIZE_LF) {
+                  return CHUNKED_ERROR;
+               }
+               break;
+            }
+            decoder->line = 0;
+            if (decoder->remaining == 0) {
+               decoder->state = CHUNK_TRAILER;
+            }
+            else if (decoder->remaining > decoder->max - decoder->total) {
+               return CHUNKED_TOO_LARGE;
+            }
+            else {
+               decoder->total += decoder->remaining;
+               decoder->state = CHUNK_DATA;
+            }
+            break;
+
+         case CHUNK_DATA_CR:
+            if (next == '\r') {
+               decoder->state = CHUNK_DATA_LF;
+               break;
+            }
+            /* Falls through to accept a bare line feed */
+
+         case CHUNK_DATA_LF:
+            if (next != '\n') {
+               return CHUNKED_ERROR;
+            }
+            decoder->state = CHUNK_SIZE_START;
+            break;
+
+         case CHUNK_TRAILER:
+            decoder->state = next == '\n' ? CHUNK_DONE :
+               next == '\r' ? CHUNK_LAST_LF : CHUNK_TRAILER_LINE;
+            break;
+
+         case CHUNK_TRAILER_LINE:
+            if (next == '\n') {
+               decoder->line = 0;
+               decoder->state = CHUNK_TRAILER;
+            }
+            break;
+
+         case CHUNK_LAST_LF:
+            if (next != '\n') {
+               return CHUNKED_ERROR;
+            }
+            decoder->state = CHUNK_DONE;
+            break;
+
+      }
+
+   }
+
+   *used = index;
+   return decoder->state == CHUNK_DONE ? CHUNKED_DONE : CHUNKED_MORE;
+
 }
@@ -27,39 +27,195 @@
 #ifndef REQUEST_H
 #define REQUEST_H
 
+#include <time.h>
+
+#include "arena.h"
+#include "buffer.h"
 #include "hashtable.h"
+#include "slice.h"
+
+typedef struct slice (*parse_url_path)(struct slice *);
+
+/* Results of chunked_decode */
+#define CHUNKED_MORE      0
+#define CHUNKED_DATA      1
+#define CHUNKED_DONE      2
+#define CHUNKED_ERROR     3
+#define CHUNKED_TOO_LARGE 4
+
+/* The longest chunk size line or trailer line of a chunked body */
+#define CHUNKED_MAX_LINE 4096
+
+/*
+ * The bytes from first to last of a file, both included.
+ */
+struct byte_range {
+   off_t first, last;
+};
 
-typedef char *(*parse_url_path)(char **);
+/*
+ * The largest requests accepted. Body bytes are limited through the
+ *    Content-Length they announce, or as chunks of a chunked body arrive.
+ */
+struct request_limits {
+   size_t max_line, max_header_bytes;
+   int max_headers;
+   long max_body;
+};
 
+/*
+ * Every part of a request is a slice of the connection input it was parsed
+ *    from, valid until the request is answered. The head of a request with
+ *    a body is parsed from a copy in the arena instead, as the input moves
+ *    while the body arrives. The body, decoded if it was chunked, is filled
+ *    in by the connection once all of it has arrived. A request over the
+ *    limits has the status code to reject it with as its error, and only as
+ *    much of it parsed as was needed to tell.
+ */
 struct request {
-  char *type;
-  char *url;
+  struct slice type;
+  struct slice url;
+  struct slice version;
   struct hashtable *headers;
   int num_headers;
-  char *(*parse_url_path)(char **);
+  int error;
+  struct slice body;
+  struct slice (*parse_url_path)(struct slice *);
 };
 
 /*
- * Parses a complete http request from a client into a useful struct.
+ * Where a chunked body is up to. The decoder holds no input of its own, so
+ *    a body of any size is decoded as it arrives in constant memory.
+ */
+struct chunked_decoder {
+   int state;
+   size_t line;
+   unsigned long remaining, total, max;
+};
+
+/*
+ * Parses a complete http request head from the buffered input of a
+ *    connection. Nothing but blank lines is consumed from the input unless
+ *    the whole head has arrived, so parsing can simply be retried once more
+ *    input is read. Every retry checks the limits again, so a request over
+ *    them is rejected as soon as enough of it has arrived to tell. The body
+ *    is left in the input for the connection to read.
  * Parameters:
- *   int socket: The web socket to read the request from
+ *   struct buffer *in: The buffered input to parse the request from
+ *   struct arena *arena: The arena holding the request until it is answered
+ *   struct request_limits *limits: The largest request to accept
  * Returns:
- *   struct request parsed: the parsed request.
+ *   struct request parsed: the parsed request, with error set to 400 if it is
+ *      malformed or its body can't be framed, to 414, 431 or 413 if it is
+ *      over the limits, or NULL if it is incomplete.
  */
-struct request *parse_request(int);
+struct request *parse_request(struct buffer *, struct arena *,
+   struct request_limits *);
 
 /*
- * Frees all memory used by a request.
+ * Finds the value of a request header.
  * Params:
- *    struct request *req: The request to be completely freed
+ *    struct request *req: The request to search
+ *    char *name: The header name, compared without regard to case
+ * Returns:
+ *    struct slice value: The value, with data NULL if the header is absent
  */
-void free_request(struct request *);
+struct slice request_header(struct request *, char *);
 
 /*
- * Prints a request to the console.
+ * Finds how much the client wants a response in a content coding, according
+ *    to its Accept-Encoding header.
  * Params:
- *    struct request *request: The request to be printed
+ *    struct request *req: The request to inspect
+ *    char *coding: The content coding, like gzip or identity
+ * Returns:
+ *    int quality: From 0, not acceptable, up to 1000 in thousandths
+ */
+int request_encoding_quality(struct request *, char *);
+
+/*
+ * Decides whether the client's copy of a static file is still current, so
+ *    a 304 Not Modified can stand in for it. If-None-Match takes precedence
+ *    over If-Modified-Since.
+ * Params:
+ *    struct request *req: The request to inspect
+ *    const char *etag: The quoted entity tag of the file
+ *    time_t modified: The modification time of the file
+ * Returns:
+ *    int not_modified: 1 if the copy is current, 0 if the file must be sent
+ */
+int request_not_modified(struct request *, const char *, time_t);
+
+/*
+ * Reads the byte ranges of a file that a GET request asks for in its Range
+ *    header. Ranges are ignored when If-Range names another version of the
+ *    file, when the header is malformed, or when it asks for more than max.
+ * Params:
+ *    struct request *req: The request to inspect
+ *    off_t size: The size of the file
+ *    const char *etag: The quoted entity tag of the file
+ *    time_t modified: The modification time of the file
+ *    struct byte_range *ranges: Filled with the satisfiable ranges, in order
+ *    int max: The most ranges that fit in ranges
+ * Returns:
+ *    int count: The number of satisfiable ranges, possibly 0, or -1 if the
+ *       whole file should be sent
+ */
+int request_ranges(struct request *, off_t, const char *, time_t,
+   struct byte_range *, int);
+
+/*
+ * Decides whether the client wants the connection kept open after responding.
+ * Params:
+ *    struct request *req: The request to inspect
+ * Returns:
+ *    int keep_alive: 1 if the connection may be reused, 0 otherwise
+ */
+int request_keep_alive(struct request *);
+
+/*
+ * Finds the length of the body following a request head.
+ * Params:
+ *    struct request *req: The request to inspect
+ * Returns:
+ *    long length: The body length, or -1 if it is chunked. Requests with a
+ *       malformed Content-Length never get past parse_request
+ */
+long request_content_length(struct request *);
+
+/*
+ * Tells whether the body following a request head is chunked.
+ * Params:
+ *    struct request *req: The request to inspect
+ * Returns:
+ *    int chunked: 1 if chunked is the last transfer coding, 0 otherwise
+ */
+int request_chunked(struct request *);
+
+/*
+ * Gets a decoder ready for a new chunked body.
+ * Params:
+ *    struct chunked_decoder *decoder: The decoder to reset
+ *    long max: The most data bytes the body may carry
+ */
+void init_chunked_decoder(struct chunked_decoder *, long);
+
+/*
+ * Decodes the next part of a chunked body, stopping at the first data found
+ *    so it can be used in place.
+ * Params:
+ *    struct chunked_decoder *decoder: Where the body is up to
+ *    char *input: The body bytes received so far and not yet used
+ *    size_t len: The number of bytes at input
+ *    size_t *used: Set to the number of input bytes decoded
+ *    struct slice *data: Set to the data found, pointing into input
+ * Returns:
+ *    int result: CHUNKED_DATA with data set, CHUNKED_MORE once all of input
+ *       is used without finding any, CHUNKED_DONE after the last trailer,
+ *       CHUNKED_ERROR if the body is malformed or CHUNKED_TOO_LARGE if it
+ *       carries more than max
  */
-void log_request(struct request *);
+int chunked_decode(struct chunked_decoder *, char *, size_t, size_t *,
+   struct slice *);
 
 #endif
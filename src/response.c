@@ -1,21 +1,408 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include "buffer.h"
 #include "response.h"
 #include "hashtable.h"
 
-struct response *create_response() {
-   struct response *new_response = malloc(sizeof(struct response));
-   new_response->headers = create_hashtable();
+/* A chunk size of up to 16 hex digits and the line breaks around the data */
+#define CHUNK_FRAMING 20
+#define LAST_CHUNK "0\r\n\r\n"
+
+struct response *create_response(struct arena *arena, struct request *req) {
+   struct response *new_response = arena_alloc(arena, sizeof(struct response));
+   memset(new_response, 0, sizeof(struct response));
+   new_response->initial_request = req;
+   new_response->headers = create_hashtable_in(arena, HASHTABLE_CASELESS);
+   new_response->body_fd = -1;
+   new_response->arena = arena;
    return new_response;
 }
 
-void free_response(struct response *server_response) {
-   free(server_response->headers);
-   free(server_response);
+void response_set_header(struct response *res, char *name, char *value) {
+   set(res->headers, name, value, (strlen(value) + 1) * sizeof(char));
+}
+
+static void set_content_length(struct response *res, off_t length) {
+   char content_len[32];
+   sprintf(content_len, "%ld", (long) length);
+   response_set_header(res, "Content-Length", content_len);
+}
+
+void response_set_body(struct response *res, const char *body, size_t len) {
+   res->body = body;
+   res->body_len = len;
+   set_content_length(res, len);
+}
+
+/* Cached assets carry their entity headers already serialized */
+void response_set_asset(struct response *res, struct cache_entry *asset,
+   int encoding) {
+   struct cache_variant *variant = &asset->variants[encoding];
+   res->asset = asset;
+   res->variant = variant;
+   res->body = variant->body;
+   res->body_len = variant->body_len;
+   res->preset = variant->headers;
+   res->preset_len = variant->headers_len;
+}
+
+/* A 304 repeats only the validators of the cached coding, never its body */
+void response_set_not_modified(struct response *res, struct cache_entry *asset,
+   int encoding) {
+   struct cache_variant *variant = &asset->variants[encoding];
+   res->status_code = 304;
+   res->asset = asset;
+   res->variant = variant;
+   res->preset = variant->headers + variant->validators_offset;
+   res->preset_len = variant->headers_len - variant->validators_offset;
+}
+
+/* The response takes ownership of the file descriptor */
+void response_set_file(struct response *res, int fd, off_t offset,
+   off_t length) {
+   res->body_fd = fd;
+   res->body_offset = offset;
+   res->body_end = offset + length;
+   set_content_length(res, length);
+}
+
+/*
+ * Stream the body from a producer as the socket drains, framed as chunks
+ *    unless an HTTP/1.0 client reads it up to the end of the connection.
+ */
+void response_set_stream(struct response *res, response_producer produce,
+   void *state) {
+   res->produce = produce;
+   res->produce_state = state;
+   res->stream = arena_alloc(res->arena, STREAM_BUFFER_LEN);
+   res->chunked = !slice_equals(res->initial_request->version, "HTTP/1.0");
+   if (res->chunked) {
+      response_set_header(res, "Transfer-Encoding", "chunked");
+   }
+}
+
+/* Copy as much as fits as one chunk, keeping room for the last chunk */
+size_t response_write(struct response *res, const char *data, size_t len) {
+   size_t room = STREAM_BUFFER_LEN - res->stream_len, framing = 0;
+   if (res->chunked) {
+      framing = CHUNK_FRAMING + strlen(LAST_CHUNK);
+   }
+   if (len == 0 || room <= framing) {
+      return 0;
+   }
+   len = len < room - framing ? len : room - framing;
+   if (res->chunked) {
+      res->stream_len += sprintf(res->stream + res->stream_len, "%lx\r\n",
+         (unsigned long) len);
+   }
+   memcpy(res->stream + res->stream_len, data, len);
+   res->stream_len += len;
+   if (res->chunked) {
+      memcpy(res->stream + res->stream_len, "\r\n", 2);
+      res->stream_len += 2;
+   }
+   return len;
+}
+
+/* Fill the stream buffer again once it is sent, ending the body if done */
+static void refill_stream(struct response *res) {
+   size_t written;
+   int result;
+   res->stream_len = 0;
+   do {
+      written = res->stream_len;
+      result = res->produce(res, res->produce_state);
+   } while (result > 0 && res->stream_len > written);
+   /* Nothing written at all would leave the response waiting forever */
+   if (result < 0 || (result > 0 && res->stream_len == 0)) {
+      res->failed = 1;
+      res->stream_len = 0;
+   }
+   if (result <= 0) {
+      res->produce = NULL;
+   }
+   if (result == 0 && res->chunked) {
+      memcpy(res->stream + res->stream_len, LAST_CHUNK, strlen(LAST_CHUNK));
+      res->stream_len += strlen(LAST_CHUNK);
+   }
+   res->segments[1].data = res->stream;
+   res->segments[1].offset = 0;
+   res->segments[1].end = res->stream_len;
+   res->current_segment = 1;
+}
+
+/* Part of the body as a segment, from memory or from the body file */
+static void add_body_segment(struct response *res, off_t first, off_t last) {
+   struct response_segment *segment = &res->segments[res->num_segments++];
+   segment->data = res->body_fd >= 0 ? NULL : res->body;
+   segment->offset = (res->body_fd >= 0 ? res->body_offset : 0) + first;
+   segment->end = segment->offset + (last - first + 1);
+}
+
+static void add_memory_segment(struct response *res, const char *data,
+   size_t len) {
+   struct response_segment *segment = &res->segments[res->num_segments++];
+   segment->data = data;
+   segment->offset = 0;
+   segment->end = len;
+}
+
+/*
+ * Narrow a body set by response_set_asset or response_set_file down to byte
+ *    ranges: one range is sent as is, several as multipart/byteranges, and
+ *    none at all as 416 Range Not Satisfiable.
+ */
+void response_set_ranges(struct response *res, struct byte_range *ranges,
+   int count, off_t size, const char *type) {
+   static unsigned long responses = 0;
+   char value[128], boundary[40], *part;
+   off_t length = 0;
+   int index;
+   /* The cached entity headers describe the whole body, keep the rest */
+   if (res->variant != NULL) {
+      res->preset = res->variant->headers + res->variant->validators_offset;
+      res->preset_len = res->variant->headers_len -
+         res->variant->validators_offset;
+      response_set_header(res, "Content-Type", (char *) type);
+   }
+   if (count == 0) {
+      res->status_code = 416;
+      sprintf(value, "bytes */%ld", (long) size);
+      response_set_header(res, "Content-Range", value);
+      response_set_header(res, "Content-Type", "text/plain");
+      response_set_body(res, "", 0);
+      if (res->body_fd >= 0) {
+         close(res->body_fd);
+         res->body_fd = -1;
+      }
+      return;
+   }
+   res->status_code = 206;
+   /* Slot 0 is left for the head, filled in by response_serialize */
+   res->segments = arena_alloc(res->arena,
+      (2 * count + 2) * sizeof(struct response_segment));
+   res->num_segments = 1;
+   if (count == 1) {
+      sprintf(value, "bytes %ld-%ld/%ld", (long) ranges[0].first,
+         (long) ranges[0].last, (long) size);
+      response_set_header(res, "Content-Range", value);
+      set_content_length(res, ranges[0].last - ranges[0].first + 1);
+      add_body_segment(res, ranges[0].first, ranges[0].last);
+      return;
+   }
+   /* Every part is introduced by the boundary and its own range */
+   sprintf(boundary, "webc%08lx%08lx", (unsigned long) getpid(), ++responses);
+   for (index = 0; index < count; index++) {
+      part = arena_alloc(res->arena, strlen(boundary) + strlen(type) + 128);
+      sprintf(part, "\r\n--%s\r\nContent-Type: %s\r\n"
+         "Content-Range: bytes %ld-%ld/%ld\r\n\r\n", boundary, type,
+         (long) ranges[index].first, (long) ranges[index].last, (long) size);
+      add_memory_segment(res, part, strlen(part));
+      add_body_segment(res, ranges[index].first, ranges[index].last);
+      length += strlen(part) + ranges[index].last - ranges[index].first + 1;
+   }
+   part = arena_alloc(res->arena, strlen(boundary) + 9);
+   sprintf(part, "\r\n--%s--\r\n", boundary);
+   add_memory_segment(res, part, strlen(part));
+   length += strlen(part);
+   sprintf(value, "multipart/byteranges; boundary=%s", boundary);
+   response_set_header(res, "Content-Type", value);
+   set_content_length(res, length);
+}
+
+const char *status_text(int status_code) {
+   switch (status_code) {
+      case 200: return "OK";
+      case 206: return "Partial Content";
+      case 304: return "Not Modified";
+      case 400: return "Bad Request";
+      case 404: return "Not Found";
+      case 405: return "Method Not Allowed";
+      case 413: return "Content Too Large";
+      case 414: return "URI Too Long";
+      case 416: return "Range Not Satisfiable";
+      case 431: return "Request Header Fields Too Large";
+      case 500: return "Internal Server Error";
+      default: return "Unknown";
+   }
+}
+
+/* Lay out the status line, preset block and header table in one buffer */
+void response_serialize(struct response *res) {
+   struct hashentry *entry;
+   const char *reason = status_text(res->status_code);
+   unsigned index;
+   size_t length = strlen("HTTP/1.1 000 \r\n") + strlen(reason) +
+      res->preset_len + 2;
+   char *position;
+   for (index = 0; index < res->headers->capacity; index++) {
+      entry = &res->headers->entries[index];
+      if (entry->key != NULL) {
+         length += entry->key_len + strlen(entry->val) + 4;
+      }
+   }
+   res->head = position = arena_alloc(res->arena, length + 1);
+   position += sprintf(position, "HTTP/1.1 %03d %s\r\n", res->status_code,
+      reason);
+   memcpy(position, res->preset, res->preset_len);
+   position += res->preset_len;
+   for (index = 0; index < res->headers->capacity; index++) {
+      entry = &res->headers->entries[index];
+      if (entry->key != NULL) {
+         position += sprintf(position, "%s: %s\r\n", entry->key,
+            (char *) entry->val);
+      }
+   }
+   memcpy(position, "\r\n", 2);
+   res->head_len = position + 2 - res->head;
+   /* Without ranges the head is followed by the whole body, if any */
+   if (res->segments == NULL) {
+      res->segments = arena_alloc(res->arena,
+         2 * sizeof(struct response_segment));
+      res->num_segments = 1;
+      if (res->body_fd >= 0 && res->body_end > res->body_offset) {
+         add_body_segment(res, 0, res->body_end - res->body_offset - 1);
+      }
+      else if (res->body_fd < 0 && res->body_len > 0) {
+         add_body_segment(res, 0, res->body_len - 1);
+      }
+      else if (res->produce != NULL) {
+         add_memory_segment(res, res->stream, 0);
+      }
+   }
+   res->segments[0].data = res->head;
+   res->segments[0].offset = 0;
+   res->segments[0].end = res->head_len;
+   /* HEAD gets the head the body would have, but nothing of the body */
+   if (slice_equals(res->initial_request->type, "HEAD")) {
+      res->num_segments = 1;
+      res->produce = NULL;
+   }
+}
+
+/* Step past sent bytes, over as many memory segments as they cover */
+void response_advance(struct response *res, size_t sent) {
+   struct response_segment *segment;
+   res->bytes_sent += sent;
+   while (sent > 0) {
+      segment = &res->segments[res->current_segment];
+      if (sent < (size_t) (segment->end - segment->offset)) {
+         segment->offset += sent;
+         return;
+      }
+      sent -= segment->end - segment->offset;
+      segment->offset = segment->end;
+      res->current_segment++;
+   }
+}
+
+/*
+ * Point iov at the memory segments up to the next file range, skipping sent
+ *    ones and producing more of a streamed body once all are sent. Returns
+ *    how many were gathered, 0 if the response is done or a file range is
+ *    next, and sets more if anything follows them.
+ */
+int response_iov(struct response *res, struct iovec *iov, int max, int *more) {
+   struct response_segment *segment;
+   int count;
+   if (res->head == NULL) {
+      response_serialize(res);
+   }
+   while (1) {
+      while (res->current_segment < res->num_segments &&
+         res->segments[res->current_segment].offset ==
+         res->segments[res->current_segment].end) {
+         res->current_segment++;
+      }
+      if (res->current_segment < res->num_segments || res->produce == NULL) {
+         break;
+      }
+      refill_stream(res);
+   }
+   segment = &res->segments[res->current_segment];
+   for (count = 0; count < max &&
+      res->current_segment + count < res->num_segments &&
+      segment[count].data != NULL; count++) {
+      iov[count].iov_base = (char *) segment[count].data +
+         segment[count].offset;
+      iov[count].iov_len = segment[count].end - segment[count].offset;
+   }
+   *more = res->current_segment + count < res->num_segments;
+   return count;
+}
+
+/*
+ * Send as much of the response as the socket accepts. Returns IO_DONE once
+ *    everything is sent, IO_AGAIN if the socket is full, or IO_ERROR, also
+ *    once a streamed body is abandoned.
+ */
+int response_send(struct response *res, int socket) {
+   struct iovec iov[MAX_IOV];
+   struct msghdr message;
+   struct response_segment *segment;
+   int count, more;
+   ssize_t sent;
+   while (1) {
+      if ((count = response_iov(res, iov, MAX_IOV, &more)) > 0) {
+         /* Memory segments up to the next file range leave together, the
+          * last partial packet is held back if more segments follow */
+         memset(&message, 0, sizeof(message));
+         message.msg_iov = iov;
+         message.msg_iovlen = count;
+         sent = sendmsg(socket, &message, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+         if (sent >= 0) {
+            response_advance(res, sent);
+         }
+         else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return IO_AGAIN;
+         }
+         else if (errno != EINTR) {
+            return IO_ERROR;
+         }
+      }
+      else if (res->current_segment == res->num_segments) {
+         return res->failed ? IO_ERROR : IO_DONE;
+      }
+      else {
+         /* Let the kernel copy file ranges, sendfile advances the offset */
+         segment = &res->segments[res->current_segment];
+         sent = sendfile(socket, res->body_fd, &segment->offset,
+            segment->end - segment->offset);
+         if (sent == 0) {
+            /* The file shrank underneath us, the response can't be finished */
+            return IO_ERROR;
+         }
+         else if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+               return IO_AGAIN;
+            }
+            if (errno != EINTR) {
+               return IO_ERROR;
+            }
+         }
+         else {
+            res->bytes_sent += sent;
+         }
+      }
+   }
 }
 
-void log_response(struct response *server_response) {
-   printf("%s %s %d\n", server_response->initial_request->type,
-         server_response->initial_request->url, server_response->status_code);
+/* Give back what the arena can't reclaim: the file and the cached asset */
+void release_response(struct response *res) {
+   if (res->body_fd >= 0) {
+      close(res->body_fd);
+      res->body_fd = -1;
+   }
+   if (res->asset != NULL) {
+      cache_release(res->asset);
+      res->asset = NULL;
+   }
 }
@@ -1,16 +1,85 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "arena.h"
+#include "cache.h"
 #include "request.h"
 
+/* Most segments gathered into one send */
+#define MAX_IOV 16
+
+/* Room for the chunks of a streamed body waiting to be sent */
+#define STREAM_BUFFER_LEN 16384
+
+struct response;
+
+/*
+ * Writes the next part of a streamed body with response_write, as much as
+ *    it likes up to the room left. Returns 1 to be called again once the
+ *    socket has taken what was written, 0 when the body is complete, or -1
+ *    to abandon the response.
+ */
+typedef int (*response_producer)(struct response *, void *);
+
+/*
+ * A piece of a response on the wire: the bytes from offset to end of data,
+ *    or of the body file when data is NULL.
+ */
+struct response_segment {
+   const char *data;
+   off_t offset, end;
+};
+
+/*
+ * A response is built by filling in its status, headers and body, then
+ *    serialized once and sent with as few system calls as possible: the head
+ *    and in-memory segments go out in a single writev, file segments follow
+ *    with sendfile. A streamed body is produced a buffer at a time, only
+ *    when the socket has taken the previous one.
+ */
 struct response {
    struct request *initial_request;
    int status_code;
    struct hashtable *headers;
+   const char *preset;
+   size_t preset_len;
+   char *head;
+   size_t head_len;
+   const char *body;
+   size_t body_len;
+   struct cache_entry *asset;
+   struct cache_variant *variant;
+   int body_fd;
+   off_t body_offset, body_end;
+   struct response_segment *segments;
+   unsigned num_segments, current_segment;
+   size_t bytes_sent;
+   struct arena *arena;
+   response_producer produce;
+   void *produce_state;
+   char *stream;
+   size_t stream_len;
+   int chunked, failed;
 };
 
-struct response *create_response();
-void free_response(struct response *);
-void log_response(struct response *);
+struct response *create_response(struct arena *, struct request *);
+void response_set_header(struct response *, char *, char *);
+void response_set_body(struct response *, const char *, size_t);
+void response_set_asset(struct response *, struct cache_entry *, int);
+void response_set_not_modified(struct response *, struct cache_entry *, int);
+void response_set_file(struct response *, int, off_t, off_t);
+void response_set_ranges(struct response *, struct byte_range *, int, off_t,
+   const char *);
+void response_set_stream(struct response *, response_producer, void *);
+size_t response_write(struct response *, const char *, size_t);
+void response_serialize(struct response *);
+void response_advance(struct response *, size_t);
+int response_iov(struct response *, struct iovec *, int, int *);
+int response_send(struct response *, int);
+void release_response(struct response *);
+const char *status_text(int);
 
 #endif
@@ -0,0 +1,470 @@
+/*
+ * router.c
+ * Compiles routes into a radix trie and dispatches requests along it.
+ *    Functions are prototyped in router.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "router.h"
+#include "util.h"
+
+/*
+ * Creates a node of the trie without children or methods.
+ * Params:
+ *    const char *label: The bytes the node matches, or the name it captures
+ *    size_t len: The length of the label
+ * Returns:
+ *    struct route_node *node: The new node
+ */
+static struct route_node *create_node(const char *label, size_t len) {
+
+   struct route_node *node = malloc(sizeof(struct route_node));
+   memset(node, 0, sizeof(struct route_node));
+
+   node->label = malloc((len + 1) * sizeof(char));
+   memcpy(node->label, label, len);
+   node->label[len] = '\0';
+   node->label_len = len;
+
+   return node;
+
+}
+
+/*
+ * Frees a node and everything below it.
+ * Params:
+ *    struct route_node *node: The node to be freed, may be NULL
+ */
+static void free_node(struct route_node *node) {
+
+   int index;
+
+   if (node == NULL) {
+      return;
+   }
+
+   for (index = 0; index < node->num_children; index++) {
+      free_node(node->children[index]);
+   }
+
+   for (index = 0; index < node->num_methods; index++) {
+      free(node->methods[index].method);
+   }
+
+   free_node(node->param);
+   free_node(node->wildcard);
+   free(node->children);
+   free(node->methods);
+   free(node->label);
+   free(node);
+
+}
+
+/*
+ * Creates a router without any routes.
+ * Returns:
+ *    struct router *router: The new router
+ */
+struct router *create_router() {
+
+   struct router *router = malloc(sizeof(struct router));
+
+   router->root = create_node("", 0);
+   return router;
+
+}
+
+/*
+ * Frees a router and all of its routes.
+ * Params:
+ *    struct router *router: The router to be freed
+ */
+void free_router(struct router *router) {
+
+   free_node(router->root);
+   free(router);
+
+}
+
+/*
+ * Makes a node the end of a route for a method.
+ * Params:
+ *    struct route_node *node: The node the route ends at
+ *    char *method: The method the route answers, NULL for any method
+ *    route_handler handler: The function answering matching requests
+ * Returns:
+ *    int result: 0 on success, -1 if the method is already routed there
+ */
+static int add_method(struct route_node *node, char *method,
+   route_handler handler) {
+
+   struct route_method *added;
+   int index;
+
+   for (index = 0; index < node->num_methods; index++) {
+      if ((method == NULL) == (node->methods[index].method == NULL) &&
+         (method == NULL || strcmp(method, node->methods[index].method) == 0)) {
+         return -1;
+      }
+   }
+
+   node->methods = realloc(node->methods,
+      (node->num_methods + 1) * sizeof(struct route_method));
+   added = &node->methods[node->num_methods++];
+   added->handler = handler;
+   added->method = NULL;
+
+   if (method != NULL) {
+      added->method = malloc((strlen(method) + 1) * sizeof(char));
+      strcpy(added->method, method);
+   }
+
+   return 0;
+
+}
+
+/*
+ * Finds or creates the parameter or wildcard child of a node.
+ * Params:
+ *    struct route_node **child: The param or wildcard field of the node
+ *    const char *name: The name the child captures
+ *    size_t len: The length of the name
+ * Returns:
+ *    struct route_node *node: The child, or NULL if one with another name
+ *       is already there
+ */
+static struct route_node *capture_child(struct route_node **child,
+   const char *name, size_t len) {
+
+   if (*child == NULL) {
+      *child = create_node(name, len);
+   }
+   else if ((*child)->label_len != len ||
+      memcmp((*child)->label, name, len) != 0) {
+      return NULL;
+   }
+
+   return *child;
+
+}
+
+/*
+ * Adds the rest of a pattern below a node, splitting labels where the
+ *    pattern parts ways with existing routes.
+ * Params:
+ *    struct route_node *node: The node the pattern continues from
+ *    char *pattern: The rest of the pattern
+ *    char *method: The method the route answers, NULL for any method
+ *    route_handler handler: The function answering matching requests
+ * Returns:
+ *    int result: 0 on success, -1 if the pattern conflicts with another
+ */
+static int insert_route(struct route_node *node, char *pattern, char *method,
+   route_handler handler) {
+
+   struct route_node *child, *split;
+   size_t run, common;
+   int index;
+
+   if (*pattern == '\0') {
+      return add_method(node, method, handler);
+   }
+
+   /* A parameter captures up to the next slash, the route goes on after */
+   if (*pattern == ':') {
+      run = strcspn(pattern + 1, "/");
+      if (run == 0 ||
+         (child = capture_child(&node->param, pattern + 1, run)) == NULL) {
+         return -1;
+      }
+      return insert_route(child, pattern + 1 + run, method, handler);
+   }
+
+   /* A wildcard captures everything left, so it has to come last */
+   if (*pattern == '*') {
+      if (pattern[1] == '\0' || strchr(pattern, '/') != NULL ||
+         (child = capture_child(&node->wildcard, pattern + 1,
+            strlen(pattern + 1))) == NULL) {
+         return -1;
+      }
+      return add_method(child, method, handler);
+   }
+
+   run = strcspn(pattern, ":*");
+
+   for (index = 0; index < node->num_children; index++) {
+      if (node->children[index]->label[0] == *pattern) {
+         break;
+      }
+   }
+
+   /* Nothing shares the first byte yet, the whole run becomes one label */
+   if (index == node->num_children) {
+      node->children = realloc(node->children,
+         (node->num_children + 1) * sizeof(struct route_node *));
+      child = node->children[node->num_children++] = create_node(pattern, run);
+      return insert_route(child, pattern + run, method, handler);
+   }
+
+   child = node->children[index];
+   for (common = 0; common < run && common < child->label_len &&
+      child->label[common] == pattern[common]; common++);
+
+   /* Split the label where the pattern leaves it */
+   if (common < child->label_len) {
+      split = create_node(child->label, common);
+      split->children = malloc(sizeof(struct route_node *));
+      split->children[0] = child;
+      split->num_children = 1;
+      child->label_len -= common;
+      memmove(child->label, child->label + common, child->label_len + 1);
+      node->children[index] = child = split;
+   }
+
+   return insert_route(child, pattern + common, method, handler);
+
+}
+
+/*
+ * Adds a route to the trie. Patterns are paths where a segment starting
+ *    with ':' captures that segment as a parameter and a final segment
+ *    starting with '*' captures the rest of the path. Static segments win
+ *    over parameters, which win over wildcards.
+ * Params:
+ *    struct router *router: The router to add to
+ *    char *method: The method the route answers, NULL for any method
+ *    char *pattern: The path pattern, such as /users/:id
+ *    route_handler handler: The function answering matching requests
+ * Returns:
+ *    int result: 0 on success, -1 if the pattern conflicts with another
+ */
+int router_add(struct router *router, char *method, char *pattern,
+   route_handler handler) {
+
+   return insert_route(router->root, pattern, method, handler);
+
+}
+
+/*
+ * Picks the handler a route ending at a node has for a method.
+ * Params:
+ *    struct route_node *node: The node the path ended at
+ *    struct slice method: The method of the request
+ *    struct route_match *match: Filled with the handler if one is found, or
+ *       with the node as allowed if it only routes other methods
+ * Returns:
+ *    int found: 1 if the method is routed, 0 otherwise
+ */
+static int match_method(struct route_node *node, struct slice method,
+   struct route_match *match) {
+
+   int index;
+
+   for (index = 0; index < node->num_methods; index++) {
+      if (node->methods[index].method == NULL ||
+         slice_equals(method, node->methods[index].method)) {
+         match->handler = node->methods[index].handler;
+         return 1;
+      }
+   }
+
+   /* The most specific route for the path tells what is allowed */
+   if (node->num_methods > 0 && match->allowed == NULL) {
+      match->allowed = node;
+   }
+
+   return 0;
+
+}
+
+/*
+ * Records a captured parameter.
+ * Params:
+ *    struct route_match *match: The match to add to
+ *    struct route_node *node: The parameter or wildcard node capturing it
+ *    const char *value: The captured bytes of the path
+ *    size_t len: The number of bytes captured
+ */
+static void push_param(struct route_match *match, struct route_node *node,
+   const char *value, size_t len) {
+
+   struct route_param *param = &match->params[match->num_params++];
+
+   param->name.data = node->label;
+   param->name.len = node->label_len;
+   param->value.data = (char *) value;
+   param->value.len = len;
+
+}
+
+/*
+ * Walks the rest of a path down from a node, trying static children before
+ *    parameters and wildcards and backing up when a branch fails.
+ * Params:
+ *    struct route_node *node: The node whose label was just matched
+ *    struct slice method: The method of the request
+ *    const char *path: The rest of the path
+ *    size_t len: The length of the rest of the path
+ *    struct route_match *match: Filled with the handler and parameters
+ * Returns:
+ *    int found: 1 if a route matched, 0 otherwise
+ */
+static int match_node(struct route_node *node, struct slice method,
+   const char *path, size_t len, struct route_match *match) {
+
+   struct route_node *child;
+   const char *slash;
+   size_t segment;
+   int index;
+
+   if (len == 0 && match_method(node, method, match)) {
+      return 1;
+   }
+
+   /* At most one static child starts with the next byte */
+   for (index = 0; len > 0 && index < node->num_children; index++) {
+      child = node->children[index];
+      if (child->label[0] == *path) {
+         if (child->label_len <= len &&
+            memcmp(child->label, path, child->label_len) == 0 &&
+            match_node(child, method, path + child->label_len,
+               len - child->label_len, match)) {
+            return 1;
+         }
+         break;
+      }
+   }
+
+   if (match->num_params == MAX_ROUTE_PARAMS) {
+      return 0;
+   }
+
+   /* A parameter takes the whole next segment, which can't be empty */
+   if (node->param != NULL && len > 0 && *path != '/') {
+      slash = memchr(path, '/', len);
+      segment = slash != NULL ? (size_t) (slash - path) : len;
+      push_param(match, node->param, path, segment);
+      if (match_node(node->param, method, path + segment, len - segment,
+         match)) {
+         return 1;
+      }
+      match->num_params--;
+   }
+
+   if (node->wildcard != NULL) {
+      push_param(match, node->wildcard, path, len);
+      if (match_method(node->wildcard, method, match)) {
+         return 1;
+      }
+      match->num_params--;
+   }
+
+   return 0;
+
+}
+
+/*
+ * Finds the handler for a request without allocating anything, in time
+ *    proportional to the length of its path.
+ * Params:
+ *    struct router *router: The router to search
+ *    struct slice method: The method of the request
+ *    struct slice path: The path of the request, without its query
+ *    struct route_match *match: Filled with the handler and parameters
+ * Returns:
+ *    int result: ROUTE_FOUND, ROUTE_NOT_FOUND, or ROUTE_NO_METHOD if only
+ *       other methods are routed for the path
+ */
+int router_match(struct router *router, struct slice method, struct slice path,
+   struct route_match *match) {
+
+   match->handler = NULL;
+   match->allowed = NULL;
+   match->path = path;
+   match->num_params = 0;
+
+   if (match_node(router->root, method, path.data, path.len, match)) {
+      return ROUTE_FOUND;
+   }
+
+   return match->allowed != NULL ? ROUTE_NO_METHOD : ROUTE_NOT_FOUND;
+
+}
+
+/*
+ * Finds a parameter captured by a match.
+ * Params:
+ *    struct route_match *match: The match to search
+ *    char *name: The name of the parameter, without its ':' or '*'
+ * Returns:
+ *    struct slice value: The value, with data NULL if there is none
+ */
+struct slice route_param(struct route_match *match, char *name) {
+
+   struct slice value;
+   int index;
+
+   for (index = 0; index < match->num_params; index++) {
+      if (slice_equals(match->params[index].name, name)) {
+         return match->params[index].value;
+      }
+   }
+
+   value.data = NULL;
+   value.len = 0;
+   return value;
+
+}
+
+/*
+ * Lists the methods routed for the path of a request no route answered.
+ * Params:
+ *    struct route_match *match: The match that found only other methods
+ *    char *allow: Filled with the methods separated by ", "
+ *    size_t len: The room at allow, including the '\0'
+ */
+void route_allow(struct route_match *match, char *allow, size_t len) {
+
+   size_t used = 0, method_len;
+   int index;
+
+   allow[0] = '\0';
+
+   for (index = 0; match->allowed != NULL &&
+      index < match->allowed->num_methods; index++) {
+      method_len = strlen(match->allowed->methods[index].method);
+      if (used + method_len + 3 > len) {
+         break;
+      }
+      if (used > 0) {
+         strcpy(allow + used, ", ");
+         used += 2;
+      }
+      strcpy(allow + used, match->allowed->methods[index].method);
+      used += method_len;
+   }
+
+}
@@ -0,0 +1,152 @@
+/*
+ * router.h
+ * Makes available the routing of requests to handlers by method and path.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "slice.h"
+
+/* Most parameters a single route can capture */
+#define MAX_ROUTE_PARAMS 8
+
+/* Results of routing a request */
+#define ROUTE_FOUND      0
+#define ROUTE_NOT_FOUND  1
+#define ROUTE_NO_METHOD  2
+
+struct connection;
+struct route_match;
+
+typedef void (*route_handler)(struct connection *, struct route_match *);
+
+/*
+ * A parameter captured from the path, its name is a slice of the pattern.
+ */
+struct route_param {
+   struct slice name, value;
+};
+
+/*
+ * The handler a request was routed to, with the parameters it captured.
+ *    Without one, allowed is the route for the path answering other methods.
+ */
+struct route_match {
+   route_handler handler;
+   struct route_node *allowed;
+   struct slice path;
+   struct route_param params[MAX_ROUTE_PARAMS];
+   int num_params;
+};
+
+struct route_method {
+   char *method;
+   route_handler handler;
+};
+
+/*
+ * A node of the radix trie routes are compiled into. Static children are
+ *    told apart by the first byte of their label, a parameter child takes a
+ *    whole segment and a wildcard takes the rest of the path. The label of
+ *    those two is the name of what they capture.
+ */
+struct route_node {
+   char *label;
+   size_t label_len;
+   struct route_node **children;
+   int num_children;
+   struct route_node *param, *wildcard;
+   struct route_method *methods;
+   int num_methods;
+};
+
+struct router {
+   struct route_node *root;
+};
+
+/*
+ * Creates a router without any routes.
+ * Returns:
+ *    struct router *router: The new router
+ */
+struct router *create_router();
+
+/*
+ * Frees a router and all of its routes.
+ * Params:
+ *    struct router *router: The router to be freed
+ */
+void free_router(struct router *);
+
+/*
+ * Adds a route to the trie. Patterns are paths where a segment starting
+ *    with ':' captures that segment as a parameter and a final segment
+ *    starting with '*' captures the rest of the path. Static segments win
+ *    over parameters, which win over wildcards.
+ * Params:
+ *    struct router *router: The router to add to
+ *    char *method: The method the route answers, NULL for any method
+ *    char *pattern: The path pattern, such as /users/:id
+ *    route_handler handler: The function answering matching requests
+ * Returns:
+ *    int result: 0 on success, -1 if the pattern conflicts with another
+ */
+int router_add(struct router *, char *, char *, route_handler);
+
+/*
+ * Finds the handler for a request without allocating anything, in time
+ *    proportional to the length of its path.
+ * Params:
+ *    struct router *router: The router to search
+ *    struct slice method: The method of the request
+ *    struct slice path: The path of the request, without its query
+ *    struct route_match *match: Filled with the handler and parameters
+ * Returns:
+ *    int result: ROUTE_FOUND, ROUTE_NOT_FOUND, or ROUTE_NO_METHOD if only
+ *       other methods are routed for the path
+ */
+int router_match(struct router *, struct slice, struct slice,
+   struct route_match *);
+
+/*
+ * Finds a parameter captured by a match.
+ * Params:
+ *    struct route_match *match: The match to search
+ *    char *name: The name of the parameter, without its ':' or '*'
+ * Returns:
+ *    struct slice value: The value, with data NULL if there is none
+ */
+struct slice route_param(struct route_match *, char *);
+
+/*
+ * Lists the methods routed for the path of a request no route answered.
+ * Params:
+ *    struct route_match *match: The match that found only other methods
+ *    char *allow: Filled with the methods separated by ", "
+ *    size_t len: The room at allow, including the '\0'
+ */
+void route_allow(struct route_match *, char *, size_t);
+
+#endif
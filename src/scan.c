@@ -0,0 +1,397 @@
+/*
+ * scan.c
+ * Scans header bytes 16 or 32 at a time with SSE4.2 or AVX2, picking the
+ *    instructions from CPUID at runtime. Functions are prototyped in scan.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*scan_impl)(const char *, size_t);
+
+/* Bytes allowed in a token: "!#$%&'*+-.^_`|~", digits and letters */
+static unsigned char token_table[256];
+
+/* The same set as a bitmap per low nibble, with a bit per high nibble, twice
+ * over to fill both halves of an AVX2 register */
+static unsigned char token_rows[32], nibble_bits[32];
+static int tables_ready = 0;
+
+static size_t resolve_token(const char *, size_t);
+static size_t resolve_text(const char *, size_t);
+
+/* Every scan starts out choosing its implementation on first use */
+static scan_impl token_impl = resolve_token;
+static scan_impl text_impl = resolve_text;
+
+/*
+ * Fills in the table of token characters used by the scalar scans.
+ */
+static void init_tables() {
+
+   const char *symbols = "!#$%&'*+-.^_`|~";
+   int current;
+
+   for (current = 0; current < 256; current++) {
+      token_table[current] = (current >= '0' && current <= '9') ||
+         (current >= 'A' && current <= 'Z') ||
+         (current >= 'a' && current <= 'z') ||
+         (current != '\0' && strchr(symbols, current) != NULL);
+
+      /* Token characters are all ASCII, high nibbles 8 to 15 stay clear */
+      if (token_table[current]) {
+         token_rows[current & 0x0f] |= 1 << (current >> 4);
+         token_rows[(current & 0x0f) + 16] |= 1 << (current >> 4);
+      }
+   }
+
+   for (current = 0; current < 8; current++) {
+      nibble_bits[current] = nibble_bits[current + 16] = 1 << current;
+   }
+
+   tables_ready = 1;
+
+}
+
+/*
+ * Checks whether a byte is a control character other than tab.
+ * Params:
+ *    unsigned char current: The byte to check
+ * Returns:
+ *    int control: 1 if it is not field text, 0 otherwise
+ */
+static int is_control(unsigned char current) {
+   return (current < ' ' && current != '\t') || current == 0x7f;
+}
+
+/*
+ * Measures a run of token characters one byte at a time.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first non-token byte, or len
+ */
+static size_t token_scalar(const char *data, size_t len) {
+
+   size_t index = 0;
+
+   while (index < len && token_table[(unsigned char) data[index]]) {
+      index++;
+   }
+
+   return index;
+
+}
+
+/*
+ * Measures a run of field text one byte at a time.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first control character, or len
+ */
+static size_t text_scalar(const char *data, size_t len) {
+
+   size_t index = 0;
+
+   while (index < len && !is_control((unsigned char) data[index])) {
+      index++;
+   }
+
+   return index;
+
+}
+
+#ifdef SCAN_X86
+
+/*
+ * Measures a run of token characters 16 bytes at a time. pcmpestri only takes
+ *    eight ranges, so the rarest token character, '~', stops the vector loop
+ *    and is stepped over one byte at a time.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first non-token byte, or len
+ */
+__attribute__((target("sse4.2")))
+static size_t token_sse42(const char *data, size_t len) {
+
+   static const char ranges[16] = {
+      '!', '!', '#', '\'', '*', '+', '-', '.',
+      '0', '9', 'A', 'Z', '^', 'z', '|', '|'
+   };
+   __m128i set = _mm_loadu_si128((const __m128i *) ranges), chunk;
+   size_t index = 0;
+   int found;
+
+   while (len - index >= 16) {
+
+      chunk = _mm_loadu_si128((const __m128i *) (data + index));
+      found = _mm_cmpestri(set, 16, chunk, 16, _SIDD_UBYTE_OPS |
+         _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY |
+         _SIDD_LEAST_SIGNIFICANT);
+      index += found;
+
+      /* A byte outside the ranges may still be a token character */
+      if (found < 16) {
+         if (!token_table[(unsigned char) data[index]]) {
+            return index;
+         }
+         index++;
+      }
+
+   }
+
+   return index + token_scalar(data + index, len - index);
+
+}
+
+/*
+ * Measures a run of field text 16 bytes at a time.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first control character, or len
+ */
+__attribute__((target("sse4.2")))
+static size_t text_sse42(const char *data, size_t len) {
+
+   static const char ranges[16] = {
+      0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f
+   };
+   __m128i set = _mm_loadu_si128((const __m128i *) ranges), chunk;
+   size_t index = 0;
+   int found;
+
+   while (len - index >= 16) {
+
+      chunk = _mm_loadu_si128((const __m128i *) (data + index));
+      found = _mm_cmpestri(set, 6, chunk, 16, _SIDD_UBYTE_OPS |
+         _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+
+      if (found < 16) {
+         return index + found;
+      }
+      index += 16;
+
+   }
+
+   return index + text_scalar(data + index, len - index);
+
+}
+
+/*
+ * Measures a run of token characters 32 bytes at a time. Each byte indexes a
+ *    bitmap by its low nibble with one shuffle and picks the bit for its high
+ *    nibble with another. Shorter runs, like most header names, are left to
+ *    SSE4.2, which every AVX2 processor has.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first non-token byte, or len
+ */
+__attribute__((target("avx2")))
+static size_t token_avx2(const char *data, size_t len) {
+
+   __m256i row_table = _mm256_loadu_si256((const __m256i *) token_rows),
+      bit_table = _mm256_loadu_si256((const __m256i *) nibble_bits),
+      nibble_mask = _mm256_set1_epi8(0x0f), chunk, row, bit;
+   size_t index = 0;
+   unsigned mask;
+
+   while (len - index >= 32) {
+
+      chunk = _mm256_loadu_si256((const __m256i *) (data + index));
+      row = _mm256_shuffle_epi8(row_table, _mm256_and_si256(chunk,
+         nibble_mask));
+      bit = _mm256_shuffle_epi8(bit_table, _mm256_and_si256(
+         _mm256_srli_epi16(chunk, 4), nibble_mask));
+
+      /* Bytes whose bit is clear are not token characters */
+      mask = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+         _mm256_and_si256(row, bit), _mm256_setzero_si256()));
+
+      if (mask != 0) {
+         return index + __builtin_ctz(mask);
+      }
+      index += 32;
+
+   }
+
+   _mm256_zeroupper();
+   return index + token_sse42(data + index, len - index);
+
+}
+
+/*
+ * Measures a run of field text 32 bytes at a time, finishing with SSE4.2.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first control character, or len
+ */
+__attribute__((target("avx2")))
+static size_t text_avx2(const char *data, size_t len) {
+
+   __m256i below_space = _mm256_set1_epi8(0x1f), tab = _mm256_set1_epi8('\t'),
+      delete = _mm256_set1_epi8(0x7f), chunk, control;
+   size_t index = 0;
+   unsigned mask;
+
+   while (len - index >= 32) {
+
+      chunk = _mm256_loadu_si256((const __m256i *) (data + index));
+
+      /* Unsigned bytes no larger than 0x1f, except tab, or exactly 0x7f */
+      control = _mm256_andnot_si256(_mm256_cmpeq_epi8(chunk, tab),
+         _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, below_space), chunk));
+      control = _mm256_or_si256(control, _mm256_cmpeq_epi8(chunk, delete));
+      mask = (unsigned) _mm256_movemask_epi8(control);
+
+      if (mask != 0) {
+         return index + __builtin_ctz(mask);
+      }
+      index += 32;
+
+   }
+
+   _mm256_zeroupper();
+   return index + text_sse42(data + index, len - index);
+
+}
+
+#endif
+
+/*
+ * Finds the best implementation of the scans this processor supports.
+ * Returns:
+ *    int impl: SCAN_SCALAR, SCAN_SSE42 or SCAN_AVX2
+ */
+int scan_best() {
+
+#ifdef SCAN_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      return SCAN_AVX2;
+   }
+   if (__builtin_cpu_supports("sse4.2")) {
+      return SCAN_SSE42;
+   }
+#endif
+
+   return SCAN_SCALAR;
+
+}
+
+/*
+ * Chooses the implementation used by the scans. Without a call the best one
+ *    is chosen on first use.
+ * Params:
+ *    int impl: SCAN_SCALAR, SCAN_SSE42 or SCAN_AVX2
+ * Returns:
+ *    int chosen: 1 if the processor supports impl, 0 if nothing changed
+ */
+int scan_use(int impl) {
+
+   if (impl < SCAN_SCALAR || impl > scan_best()) {
+      return 0;
+   }
+
+   if (!tables_ready) {
+      init_tables();
+   }
+
+   token_impl = token_scalar;
+   text_impl = text_scalar;
+
+#ifdef SCAN_X86
+   if (impl == SCAN_SSE42) {
+      token_impl = token_sse42;
+      text_impl = text_sse42;
+   }
+   else if (impl == SCAN_AVX2) {
+      token_impl = token_avx2;
+      text_impl = text_avx2;
+   }
+#endif
+
+   return 1;
+
+}
+
+/*
+ * Picks the best scans on the first token scan.
+ */
+static size_t resolve_token(const char *data, size_t len) {
+   scan_use(scan_best());
+   return token_impl(data, len);
+}
+
+/*
+ * Picks the best scans on the first text scan.
+ */
+static size_t resolve_text(const char *data, size_t len) {
+   scan_use(scan_best());
+   return text_impl(data, len);
+}
+
+/*
+ * Measures the run of token characters, as allowed in methods and header
+ *    names, at the start of some bytes.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first byte that is not a token
+ *       character, or len if there is none
+ */
+size_t scan_token(const char *data, size_t len) {
+   return token_impl(data, len);
+}
+
+/*
+ * Measures the run of field text, anything but control characters other than
+ *    tab, at the start of some bytes.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first control character, or len if
+ *       there is none
+ */
+size_t scan_text(const char *data, size_t len) {
+   return text_impl(data, len);
+}
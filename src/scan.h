@@ -0,0 +1,79 @@
+/*
+ * scan.h
+ * Makes available vectorized scans over HTTP header bytes.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <sys/types.h>
+
+/* Implementations of the scans, in increasing order of speed */
+#define SCAN_SCALAR 0
+#define SCAN_SSE42  1
+#define SCAN_AVX2   2
+
+/*
+ * Finds the best implementation of the scans this processor supports.
+ * Returns:
+ *    int impl: SCAN_SCALAR, SCAN_SSE42 or SCAN_AVX2
+ */
+int scan_best();
+
+/*
+ * Chooses the implementation used by the scans. Without a call the best one
+ *    is chosen on first use.
+ * Params:
+ *    int impl: SCAN_SCALAR, SCAN_SSE42 or SCAN_AVX2
+ * Returns:
+ *    int chosen: 1 if the processor supports impl, 0 if nothing changed
+ */
+int scan_use(int);
+
+/*
+ * Measures the run of token characters, as allowed in methods and header
+ *    names, at the start of some bytes.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first byte that is not a token
+ *       character, or len if there is none
+ */
+size_t scan_token(const char *, size_t);
+
+/*
+ * Measures the run of field text, anything but control characters other than
+ *    tab, at the start of some bytes.
+ * Params:
+ *    const char *data: The bytes to scan
+ *    size_t len: The number of bytes
+ * Returns:
+ *    size_t length: The offset of the first control character, or len if
+ *       there is none
+ */
+size_t scan_text(const char *, size_t);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * slice.c
+ * Splits and compares slices without copying them. Functions are prototyped
+ *    in slice.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "slice.h"
+
+/*
+ * Removes the bytes up to a delimiter from the front of a slice.
+ * Params:
+ *    struct slice *input: The slice to split, left pointing past the delimiter
+ *    char delimiter: The byte ending the segment
+ * Returns:
+ *    struct slice segment: The bytes before the delimiter, or all of input if
+ *       it holds no delimiter
+ */
+struct slice slice_split(struct slice *input, char delimiter) {
+
+   struct slice segment;
+   char *found = memchr(input->data, delimiter, input->len);
+
+   segment.data = input->data;
+   segment.len = found != NULL ? (size_t) (found - input->data) : input->len;
+
+   /* Step over the delimiter too, if there was one */
+   input->data += segment.len;
+   input->len -= segment.len;
+   if (found != NULL) {
+      input->data++;
+      input->len--;
+   }
+
+   return segment;
+
+}
+
+/*
+ * Drops spaces and tabs from both ends of a slice.
+ * Params:
+ *    struct slice *input: The slice to trim
+ */
+void slice_trim(struct slice *input) {
+
+   while (input->len > 0 && (*input->data == ' ' || *input->data == '\t')) {
+      input->data++;
+      input->len--;
+   }
+
+   while (input->len > 0 && (input->data[input->len - 1] == ' ' ||
+      input->data[input->len - 1] == '\t')) {
+      input->len--;
+   }
+
+}
+
+/*
+ * Compares a slice with a string.
+ * Params:
+ *    struct slice input: The slice to compare
+ *    const char *string: The string to compare against
+ * Returns:
+ *    int equal: 1 if they hold the same bytes, 0 otherwise
+ */
+int slice_equals(struct slice input, const char *string) {
+   return strlen(string) == input.len &&
+      memcmp(input.data, string, input.len) == 0;
+}
+
+/*
+ * Compares a slice with a string without regard to ASCII case.
+ * Params:
+ *    struct slice input: The slice to compare
+ *    const char *string: The string to compare against
+ * Returns:
+ *    int equal: 1 if they hold the same letters, 0 otherwise
+ */
+int slice_case_equals(struct slice input, const char *string) {
+   return strlen(string) == input.len &&
+      strncasecmp(input.data, string, input.len) == 0;
+}
+
+/*
+ * Checks whether a comma separated list, as in many header values, holds a
+ *    token. Tokens are compared without regard to case.
+ * Params:
+ *    struct slice list: The list to search
+ *    const char *token: The token to find
+ * Returns:
+ *    int found: 1 if the token is listed, 0 otherwise
+ */
+int slice_has_token(struct slice list, const char *token) {
+
+   struct slice current;
+
+   while (list.len > 0) {
+
+      current = slice_split(&list, ',');
+      slice_trim(&current);
+
+      if (slice_case_equals(current, token)) {
+         return 1;
+      }
+
+   }
+
+   return 0;
+
+}
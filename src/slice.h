@@ -0,0 +1,91 @@
+/*
+ * slice.h
+ * Makes available views of byte ranges owned by someone else.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SLICE_H
+#define SLICE_H
+
+#include <sys/types.h>
+
+/*
+ * A run of len bytes at data, not terminated and not owned. A slice is only
+ *    valid as long as the memory it points into.
+ */
+struct slice {
+   char *data;
+   size_t len;
+};
+
+/*
+ * Removes the bytes up to a delimiter from the front of a slice.
+ * Params:
+ *    struct slice *input: The slice to split, left pointing past the delimiter
+ *    char delimiter: The byte ending the segment
+ * Returns:
+ *    struct slice segment: The bytes before the delimiter, or all of input if
+ *       it holds no delimiter
+ */
+struct slice slice_split(struct slice *, char);
+
+/*
+ * Drops spaces and tabs from both ends of a slice.
+ * Params:
+ *    struct slice *input: The slice to trim
+ */
+void slice_trim(struct slice *);
+
+/*
+ * Compares a slice with a string.
+ * Params:
+ *    struct slice input: The slice to compare
+ *    const char *string: The string to compare against
+ * Returns:
+ *    int equal: 1 if they hold the same bytes, 0 otherwise
+ */
+int slice_equals(struct slice, const char *);
+
+/*
+ * Compares a slice with a string without regard to ASCII case.
+ * Params:
+ *    struct slice input: The slice to compare
+ *    const char *string: The string to compare against
+ * Returns:
+ *    int equal: 1 if they hold the same letters, 0 otherwise
+ */
+int slice_case_equals(struct slice, const char *);
+
+/*
+ * Checks whether a comma separated list, as in many header values, holds a
+ *    token. Tokens are compared without regard to case.
+ * Params:
+ *    struct slice list: The list to search
+ *    const char *token: The token to find
+ * Returns:
+ *    int found: 1 if the token is listed, 0 otherwise
+ */
+int slice_has_token(struct slice, const char *);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * timer.c
+ * Keeps timers in a hierarchical wheel, scheduling and cancelling them in
+ *    constant time. Functions are prototyped in timer.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include "timer.h"
+
+/* Ticks from now the whole wheel reaches, later timers wait at its end */
+#define TIMER_RANGE (1UL << (TIMER_LEVELS * TIMER_SLOT_BITS))
+
+/*
+ * Makes a slot an empty circular list.
+ * Params:
+ *    struct timer *head: The head of the slot
+ */
+static void init_slot(struct timer *head) {
+
+   head->prev = head->next = head;
+
+}
+
+/*
+ * Moves every timer of a slot onto an empty list, so the slot can take new
+ *    timers while they are handled.
+ * Params:
+ *    struct timer *head: The head of the slot to empty
+ *    struct timer *list: The head of the list to move them to
+ */
+static void take_slot(struct timer *head, struct timer *list) {
+
+   init_slot(list);
+
+   if (head->next != head) {
+      list->next = head->next;
+      list->prev = head->prev;
+      list->next->prev = list->prev->next = list;
+      init_slot(head);
+   }
+
+}
+
+/*
+ * Sets up an empty wheel.
+ * Params:
+ *    struct timer_wheel *wheel: The wheel to set up
+ *    unsigned long now: The current tick
+ */
+void init_timer_wheel(struct timer_wheel *wheel, unsigned long now) {
+
+   int level, slot;
+
+   wheel->current = now;
+
+   for (level = 0; level < TIMER_LEVELS; level++) {
+      for (slot = 0; slot < TIMER_SLOTS; slot++) {
+         init_slot(&wheel->slots[level][slot]);
+      }
+   }
+
+}
+
+/*
+ * Sets up a timer that is not scheduled yet.
+ * Params:
+ *    struct timer *timer: The timer to set up
+ *    void *data: What the timer is for, handed back when it expires
+ */
+void init_timer(struct timer *timer, void *data) {
+
+   timer->expires = 0;
+   timer->data = data;
+   timer->prev = timer->next = NULL;
+
+}
+
+/*
+ * Tells whether a timer is scheduled.
+ * Params:
+ *    struct timer *timer: The timer to check
+ * Returns:
+ *    int pending: 1 if it is scheduled, 0 otherwise
+ */
+int timer_pending(struct timer *timer) {
+
+   return timer->next != NULL;
+
+}
+
+/*
+ * Links a timer into the slot its expiry falls in: the lowest level whose
+ *    slots still reach that far.
+ * Params:
+ *    struct timer_wheel *wheel: The wheel to link into
+ *    struct timer *timer: The timer to link, not currently linked
+ */
+static void place_timer(struct timer_wheel *wheel, struct timer *timer) {
+
+   unsigned long expires = timer->expires, delta;
+   struct timer *head;
+   int level = 0;
+
+   /* Timers already due fire on the next tick */
+   if ((long) (expires - wheel->current) < 0) {
+      expires = wheel->current;
+   }
+
+   delta = expires - wheel->current;
+   if (delta >= TIMER_RANGE) {
+      expires = wheel->current + TIMER_RANGE - 1;
+      delta = TIMER_RANGE - 1;
+   }
+
+   while (delta >> ((level + 1) * TIMER_SLOT_BITS) != 0) {
+      level++;
+   }
+
+   head = &wheel->slots[level]
+      [(expires >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1)];
+   timer->prev = head->prev;
+   timer->next = head;
+   head->prev->next = timer;
+   head->prev = timer;
+
+}
+
+/*
+ * Unschedules a timer, if it is scheduled.
+ * Params:
+ *    struct timer *timer: The timer to cancel
+ */
+void timer_cancel(struct timer *timer) {
+
+   if (timer->next != NULL) {
+      timer->prev->next = timer->next;
+      timer->next->prev = timer->prev;
+      timer->prev = timer->next = NULL;
+   }
+
+}
+
+/*
+ * Schedules a timer, moving it if it already is.
+ * Params:
+ *    struct timer_wheel *wheel: The wheel to schedule on
+ *    struct timer *timer: The timer to schedule
+ *    unsigned long expires: The tick it expires at
+ */
+void timer_schedule(struct timer_wheel *wheel, struct timer *timer,
+   unsigned long expires) {
+
+   timer_cancel(timer);
+   timer->expires = expires;
+   place_timer(wheel, timer);
+
+}
+
+/*
+ * Moves the timers of a slot down to the levels below, now that the slot
+ *    is the next one due on its level.
+ * Params:
+ *    struct timer_wheel *wheel: The wheel the slot belongs to
+ *    int level: The level of the slot
+ */
+static void cascade(struct timer_wheel *wheel, int level) {
+
+   struct timer list, *timer;
+
+   take_slot(&wheel->slots[level][(wheel->current >>
+      (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1)], &list);
+
+   while ((timer = list.next) != &list) {
+      timer_cancel(timer);
+      place_timer(wheel, timer);
+   }
+
+}
+
+/*
+ * Moves the wheel up to a tick, calling back every timer that expires on
+ *    the way. A timer is unscheduled before its callback, which may
+ *    schedule it again or cancel others.
+ * Params:
+ *    struct timer_wheel *wheel: The wheel to move
+ *    unsigned long now: The current tick
+ *    timer_expired expired: Called with each expired timer
+ */
+void timer_advance(struct timer_wheel *wheel, unsigned long now,
+   timer_expired expired) {
+
+   struct timer list, *timer;
+   int level;
+
+   while ((long) (now - wheel->current) >= 0) {
+
+      /* Each time a level wraps around, the next slot above comes down */
+      for (level = 1; level < TIMER_LEVELS && ((wheel->current >>
+         ((level - 1) * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1)) == 0;
+         level++) {
+         cascade(wheel, level);
+      }
+
+      take_slot(&wheel->slots[0][wheel->current & (TIMER_SLOTS - 1)], &list);
+
+      /* Timers scheduled by the callbacks are due from the next tick on */
+      wheel->current++;
+
+      while ((timer = list.next) != &list) {
+         timer_cancel(timer);
+         expired(timer);
+      }
+
+   }
+
+}
@@ -0,0 +1,110 @@
+/*
+ * timer.h
+ * Makes available a hierarchical timer wheel for connection deadlines.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/* Each level of the wheel has 2^TIMER_SLOT_BITS slots */
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4
+
+/*
+ * A timer, embedded in whatever it is for. Pending timers are linked into
+ *    one slot of the wheel, so scheduling and cancelling them never
+ *    allocates or searches.
+ */
+struct timer {
+   unsigned long expires;
+   void *data;
+   struct timer *prev, *next;
+};
+
+/*
+ * Slots of ticks at increasing granularity. A slot of level n covers
+ *    TIMER_SLOTS^n ticks, timers in it move down a level as their time gets
+ *    near. Timers further out than the wheel reaches wait in its last slot.
+ */
+struct timer_wheel {
+   unsigned long current;
+   struct timer slots[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+typedef void (*timer_expired)(struct timer *);
+
+/*
+ * Sets up an empty wheel.
+ * Params:
+ *    struct timer_wheel *wheel: The wheel to set up
+ *    unsigned long now: The current tick
+ */
+void init_timer_wheel(struct timer_wheel *, unsigned long);
+
+/*
+ * Sets up a timer that is not scheduled yet.
+ * Params:
+ *    struct timer *timer: The timer to set up
+ *    void *data: What the timer is for, handed back when it expires
+ */
+void init_timer(struct timer *, void *);
+
+/*
+ * Tells whether a timer is scheduled.
+ * Params:
+ *    struct timer *timer: The timer to check
+ * Returns:
+ *    int pending: 1 if it is scheduled, 0 otherwise
+ */
+int timer_pending(struct timer *);
+
+/*
+ * Schedules a timer, moving it if it already is.
+ * Params:
+ *    struct timer_wheel *wheel: The wheel to schedule on
+ *    struct timer *timer: The timer to schedule
+ *    unsigned long expires: The tick it expires at
+ */
+void timer_schedule(struct timer_wheel *, struct timer *, unsigned long);
+
+/*
+ * Unschedules a timer, if it is scheduled.
+ * Params:
+ *    struct timer *timer: The timer to cancel
+ */
+void timer_cancel(struct timer *);
+
+/*
+ * Moves the wheel up to a tick, calling back every timer that expires on
+ *    the way. A timer is unscheduled before its callback, which may
+ *    schedule it again or cancel others.
+ * Params:
+ *    struct timer_wheel *wheel: The wheel to move
+ *    unsigned long now: The current tick
+ *    timer_expired expired: Called with each expired timer
+ */
+void timer_advance(struct timer_wheel *, unsigned long, timer_expired);
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ * pack.c
+ * Packs every file below a directory into one bundle for the server to map
+ *    with -a. The records are sorted by url and each file gets a strong
+ *    entity tag from a hash of its bytes. The bundle is written next to its
+ *    destination and renamed over it, so a running deploy swaps atomically.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../bundle.h"
+#include "../util.h"
+
+/* Offsets are 32 bits, so is everything they point into */
+#define MAX_BUNDLE_SIZE 0xffffffffUL
+#define DATA_ALIGN 16
+
+struct packed_file {
+   char *url, *data, etag[BUNDLE_MAX_ETAG + 1];
+   const char *type;
+   size_t length;
+   time_t mtime;
+};
+
+struct pack {
+   struct packed_file *files;
+   size_t num_files, files_size;
+};
+
+/*
+ * Reports what went wrong with a file and gives up.
+ * Params:
+ *    const char *what: What couldn't be done, such as "Can't open"
+ *    const char *path: The file it couldn't be done to
+ */
+static void fail(const char *what, const char *path) {
+   fprintf(stderr, "%s %s: %s\n", what, path, strerror(errno));
+   exit(EXIT_FAILURE);
+}
+
+/*
+ * Hashes the bytes of a file with 32-bit FNV-1a.
+ * Params:
+ *    const char *data: The bytes to hash
+ *    size_t length: The number of bytes at data
+ * Returns:
+ *    unsigned long hash: The 32-bit hash
+ */
+static unsigned long hash_bytes(const char *data, size_t length) {
+   unsigned long hash = 2166136261UL;
+   size_t index;
+   for (index = 0; index < length; index++) {
+      hash = ((hash ^ (unsigned char) data[index]) * 16777619UL) & 0xffffffffUL;
+   }
+   return hash;
+}
+
+/*
+ * Reads a whole file into memory.
+ * Params:
+ *    const char *path: The file to read
+ *    size_t length: The size of the file
+ * Returns:
+ *    char *data: The bytes of the file, to be freed by the caller
+ */
+static char *read_file(const char *path, size_t length) {
+   char *data = malloc(length > 0 ? length : 1);
+   size_t total = 0;
+   ssize_t received;
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      fail("Can't open", path);
+   }
+   while (total < length) {
+      received = read(fd, data + total, length - total);
+      if (received <= 0 && !(received < 0 && errno == EINTR)) {
+         errno = received == 0 ? EIO : errno;
+         fail("Can't read", path);
+      }
+      total += received > 0 ? received : 0;
+   }
+   close(fd);
+   return data;
+}
+
+/*
+ * Adds a file to the pack, with its media type and entity tag.
+ * Params:
+ *    struct pack *pack: The pack to add to
+ *    const char *path: The file to add
+ *    const char *url: The url the file is served at
+ *    struct stat *info: The status of the file
+ */
+static void add_file(struct pack *pack, const char *path, const char *url,
+   struct stat *info) {
+   struct packed_file *file;
+   if (pack->num_files == pack->files_size) {
+      pack->files_size = pack->files_size ? pack->files_size * 2 : 64;
+      pack->files = realloc(pack->files,
+         pack->files_size * sizeof(struct packed_file));
+   }
+   file = &pack->files[pack->num_files++];
+   file->url = malloc(strlen(url) + 1);
+   strcpy(file->url, url);
+   file->type = mime_type(url);
+   file->length = info->st_size;
+   file->mtime = info->st_mtime;
+   file->data = read_file(path, file->length);
+   sprintf(file->etag, "\"%lx-%08lx\"", (unsigned long) file->length,
+      hash_bytes(file->data, file->length));
+}
+
+/*
+ * Adds every regular file below a directory, urls relative to the root.
+ * Params:
+ *    struct pack *pack: The pack to add to
+ *    const char *path: The directory to add
+ *    const char *url: The url of the directory, empty for the root
+ */
+static void add_directory(struct pack *pack, const char *path,
+   const char *url) {
+   DIR *dir = opendir(path);
+   struct dirent *entry;
+   struct stat info;
+   char *child_path, *child_url;
+   if (dir == NULL) {
+      fail("Can't read", path);
+   }
+   while ((entry = readdir(dir)) != NULL) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+         continue;
+      }
+      child_path = malloc(strlen(path) + strlen(entry->d_name) + 2);
+      child_url = malloc(strlen(url) + strlen(entry->d_name) + 2);
+      sprintf(child_path, "%s/%s", path, entry->d_name);
+      sprintf(child_url, "%s/%s", url, entry->d_name);
+      if (stat(child_path, &info) < 0) {
+         fail("Can't stat", child_path);
+      }
+      if (S_ISDIR(info.st_mode)) {
+         add_directory(pack, child_path, child_url);
+      }
+      else if (S_ISREG(info.st_mode)) {
+         add_file(pack, child_path, child_url, &info);
+      }
+      free(child_path);
+      free(child_url);
+   }
+   closedir(dir);
+}
+
+/*
+ * Orders packed files by url, for qsort.
+ * Params:
+ *    const void *a: The first file
+ *    const void *b: The second file
+ * Returns:
+ *    int order: Less than, equal to or greater than 0 as a sorts before,
+ *       with or after b
+ */
+static int compare_files(const void *a, const void *b) {
+   return strcmp(((const struct packed_file *) a)->url,
+      ((const struct packed_file *) b)->url);
+}
+
+/*
+ * Lays out the bundle in memory: header, records, strings, then data.
+ * Params:
+ *    struct pack *pack: The files to bundle, sorted by url
+ *    size_t *size: Set to the size of the bundle
+ * Returns:
+ *    char *bundle: The bundle, to be freed by the caller
+ */
+static char *build_bundle(struct pack *pack, size_t *size) {
+   struct bundle_header *header;
+   struct bundle_record *records;
+   struct packed_file *file;
+   size_t index, strings = 0, data, position;
+   char *bundle;
+   for (index = 0; index < pack->num_files; index++) {
+      file = &pack->files[index];
+      strings += strlen(file->url) + strlen(file->type) +
+         strlen(file->etag) + 3;
+   }
+   data = sizeof(struct bundle_header) +
+      pack->num_files * sizeof(struct bundle_record) + strings;
+   *size = data;
+   for (index = 0; index < pack->num_files; index++) {
+      *size = (*size + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN +
+         pack->files[index].length;
+      if (*size > MAX_BUNDLE_SIZE) {
+         fprintf(stderr, "Bundle would exceed %lu bytes\n", MAX_BUNDLE_SIZE);
+         exit(EXIT_FAILURE);
+      }
+   }
+   bundle = malloc(*size > 0 ? *size : 1);
+   memset(bundle, 0, *size);
+   header = (struct bundle_header *) bundle;
+   memcpy(header->magic, BUNDLE_MAGIC, BUNDLE_MAGIC_LEN);
+   header->count = pack->num_files;
+   records = (struct bundle_record *) (bundle + sizeof(struct bundle_header));
+   position = data - strings;
+   for (index = 0; index < pack->num_files; index++) {
+      file = &pack->files[index];
+      records[index].url = position;
+      position += sprintf(bundle + position, "%s", file->url) + 1;
+      records[index].type = position;
+      position += sprintf(bundle + position, "%s", file->type) + 1;
+      records[index].etag = position;
+      position += sprintf(bundle + position, "%s", file->etag) + 1;
+      records[index].mtime = file->mtime;
+      records[index].length = file->length;
+   }
+   for (index = 0; index < pack->num_files; index++) {
+      file = &pack->files[index];
+      position = (position + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN;
+      records[index].data = position;
+      memcpy(bundle + position, file->data, file->length);
+      position += file->length;
+   }
+   return bundle;
+}
+
+/*
+ * Writes the bundle beside its destination, then swaps it in at once.
+ * Params:
+ *    const char *path: Where the bundle goes
+ *    const char *bundle: The bundle laid out in memory
+ *    size_t size: The size of the bundle
+ */
+static void write_bundle(const char *path, const char *bundle, size_t size) {
+   char *temporary = malloc(strlen(path) + 5);
+   size_t written = 0;
+   ssize_t result;
+   int fd;
+   sprintf(temporary, "%s.tmp", path);
+   if ((fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+      fail("Can't create", temporary);
+   }
+   while (written < size) {
+      if ((result = write(fd, bundle + written, size - written)) < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         fail("Can't write", temporary);
+      }
+      written += result;
+   }
+   if (fsync(fd) < 0 || close(fd) < 0) {
+      fail("Can't write", temporary);
+   }
+   if (rename(temporary, path) < 0) {
+      fail("Can't replace", path);
+   }
+   free(temporary);
+}
+
+/*
+ * Packs a directory into a bundle.
+ * Params:
+ *    int argc: The number of arguments, 3
+ *    char *argv[]: The program, the directory and the bundle to write
+ * Returns:
+ *    int status: EXIT_SUCCESS once the bundle is in place
+ */
+int main(int argc, char *argv[]) {
+   struct pack pack;
+   char *bundle;
+   size_t size;
+   if (argc != 3) {
+      fprintf(stderr, "Usage: %s directory bundle\n", argv[0]);
+      exit(EXIT_FAILURE);
+   }
+   memset(&pack, 0, sizeof(pack));
+   add_directory(&pack, argv[1], "");
+   qsort(pack.files, pack.num_files, sizeof(struct packed_file),
+      compare_files);
+   bundle = build_bundle(&pack, &size);
+   write_bundle(argv[2], bundle, size);
+   printf("Packed %lu files into %s, %lu bytes\n",
+      (unsigned long) pack.num_files, argv[2], (unsigned long) size);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,279 @@
+/*
+ * uring.c
+ * Sets up and drives an io_uring through raw system calls, without liburing.
+ *    Functions are prototyped in uring.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "util.h"
+
+/* One submitting thread and completions only run when waited for, which
+ *    also requires a kernel recent enough for multishot accept */
+#define URING_FLAGS (IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN)
+
+/*
+ * Maps one of the regions a ring shares with the kernel.
+ * Params:
+ *    int fd: The ring
+ *    size_t len: The length of the region
+ *    off_t offset: Which region, an IORING_OFF_* value
+ * Returns:
+ *    void *region: The mapped region, or MAP_FAILED
+ */
+static void *map_region(int fd, size_t len, off_t offset) {
+
+   return mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      fd, offset);
+
+}
+
+/*
+ * Sets up a ring, if the kernel supports everything the server needs.
+ * Params:
+ *    struct uring *ring: The ring to set up
+ *    unsigned entries: The size of the submission queue
+ * Returns:
+ *    int result: 0 on success, -1 with errno set if io_uring can't be used
+ */
+int uring_init(struct uring *ring, unsigned entries) {
+
+   struct io_uring_params params;
+   char *sq, *cq;
+
+   memset(ring, 0, sizeof(struct uring));
+   memset(&params, 0, sizeof(params));
+   params.flags = URING_FLAGS;
+
+   if ((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+      return -1;
+   }
+
+   /* Both queues share one mapping on every kernel new enough for the flags */
+   ring->sq_ring_len = params.sq_off.array +
+      params.sq_entries * sizeof(unsigned);
+   ring->cq_ring_len = params.cq_off.cqes +
+      params.cq_entries * sizeof(struct io_uring_cqe);
+   if (ring->cq_ring_len > ring->sq_ring_len) {
+      ring->sq_ring_len = ring->cq_ring_len;
+   }
+   ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+   if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+      close(ring->fd);
+      errno = ENOSYS;
+      return -1;
+   }
+
+   if ((ring->sq_ring = map_region(ring->fd, ring->sq_ring_len,
+      IORING_OFF_SQ_RING)) == MAP_FAILED) {
+      close(ring->fd);
+      return -1;
+   }
+
+   if ((ring->sqes = map_region(ring->fd, ring->sqes_len,
+      IORING_OFF_SQES)) == MAP_FAILED) {
+      munmap(ring->sq_ring, ring->sq_ring_len);
+      close(ring->fd);
+      return -1;
+   }
+
+   ring->cq_ring = ring->sq_ring;
+   sq = ring->sq_ring;
+   cq = ring->cq_ring;
+
+   ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+   ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+   ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+   ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+   ring->sq_entries = params.sq_entries;
+   ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+   ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+   ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+   ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+   return 0;
+
+}
+
+/*
+ * Tears down a ring, abandoning requests still in flight.
+ * Params:
+ *    struct uring *ring: The ring to free
+ */
+void uring_free(struct uring *ring) {
+
+   munmap(ring->sqes, ring->sqes_len);
+   munmap(ring->sq_ring, ring->sq_ring_len);
+   close(ring->fd);
+   free(ring->backlog);
+
+}
+
+/*
+ * Takes the next free submission queue entry, submitting queued ones first
+ *    if the queue is full. If the kernel takes none, because completions
+ *    have to be handled first, the entry waits in the backlog instead.
+ * Params:
+ *    struct uring *ring: The ring to queue a request on
+ * Returns:
+ *    struct io_uring_sqe *sqe: A zeroed entry, queued once this returns and
+ *       valid until the next request is queued
+ */
+struct io_uring_sqe *uring_sqe(struct uring *ring) {
+
+   unsigned tail = *ring->sq_tail, index;
+   struct io_uring_sqe *sqe;
+
+   if (ring->num_backlog == 0 && tail -
+      __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+      uring_submit(ring, 0);
+   }
+
+   /* Requests keep their order, none overtakes those in the backlog */
+   if (ring->num_backlog > 0 || tail -
+      __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+      if (ring->num_backlog == ring->backlog_size) {
+         ring->backlog_size = ring->backlog_size > 0 ?
+            ring->backlog_size * 2 : ring->sq_entries;
+         ring->backlog = safe_realloc(ring->backlog,
+            ring->backlog_size * sizeof(struct io_uring_sqe));
+      }
+      sqe = &ring->backlog[ring->num_backlog++];
+      memset(sqe, 0, sizeof(struct io_uring_sqe));
+      return sqe;
+   }
+
+   index = tail & *ring->sq_mask;
+   sqe = &ring->sqes[index];
+   memset(sqe, 0, sizeof(struct io_uring_sqe));
+   ring->sq_array[index] = index;
+
+   /* The kernel only looks at the entry once the submission system call
+    * has been made, so it may be filled in after the tail moved */
+   __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+   ring->queued++;
+
+   return sqe;
+
+}
+
+/*
+ * Moves as much of the backlog into the submission queue as fits.
+ * Params:
+ *    struct uring *ring: The ring to move the backlog of
+ */
+static void queue_backlog(struct uring *ring) {
+
+   unsigned tail = *ring->sq_tail, index, moved = 0;
+
+   while (moved < ring->num_backlog && tail -
+      __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) < ring->sq_entries) {
+      index = tail & *ring->sq_mask;
+      ring->sqes[index] = ring->backlog[moved++];
+      ring->sq_array[index] = index;
+      tail++;
+   }
+
+   __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+   ring->queued += moved;
+   ring->num_backlog -= moved;
+   memmove(ring->backlog, ring->backlog + moved,
+      ring->num_backlog * sizeof(struct io_uring_sqe));
+
+}
+
+/*
+ * Hands every queued request to the kernel in a single system call, the
+ *    backlog first. A signal cuts the wait short without submitting
+ *    anything, and so does a kernel that takes no more requests until the
+ *    completions waiting are handled.
+ * Params:
+ *    struct uring *ring: The ring to submit
+ *    unsigned wait: The number of completions to wait for
+ */
+void uring_submit(struct uring *ring, unsigned wait) {
+
+   int submitted;
+
+   do {
+
+      queue_backlog(ring);
+
+      /* Nothing is waited for while the backlog still has to go in */
+      submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued,
+         ring->num_backlog > 0 ? 0 : wait,
+         wait > 0 && ring->num_backlog == 0 ? IORING_ENTER_GETEVENTS : 0,
+         NULL, 0);
+
+      /* A signal handler's flag is to be looked at, or completions handled
+       * before the kernel takes more */
+      if (submitted < 0) {
+         if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            report_errno();
+         }
+         return;
+      }
+
+      ring->queued -= submitted;
+
+   } while (ring->num_backlog > 0 && submitted > 0);
+
+}
+
+/*
+ * Finds the oldest completion not yet seen.
+ * Params:
+ *    struct uring *ring: The ring to look at
+ * Returns:
+ *    struct io_uring_cqe *cqe: The completion, or NULL if there is none
+ */
+struct io_uring_cqe *uring_cqe(struct uring *ring) {
+
+   unsigned head = *ring->cq_head;
+
+   if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      return NULL;
+   }
+
+   return &ring->cqes[head & *ring->cq_mask];
+
+}
+
+/*
+ * Gives the oldest completion back to the kernel after it was handled.
+ * Params:
+ *    struct uring *ring: The ring the completion came from
+ */
+void uring_cqe_seen(struct uring *ring) {
+
+   __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+
+}
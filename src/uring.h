@@ -0,0 +1,106 @@
+/*
+ * uring.h
+ * Makes available a minimal io_uring, set up with raw system calls.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+/*
+ * The submission and completion queues shared with the kernel. Requests are
+ *    queued with uring_sqe and handed over in one system call by
+ *    uring_submit, which also waits for their completions. Requests queued
+ *    while the kernel takes no more wait in the backlog, in order.
+ */
+struct uring {
+   int fd;
+   unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+   unsigned *cq_head, *cq_tail, *cq_mask;
+   unsigned queued, num_backlog, backlog_size;
+   struct io_uring_sqe *sqes, *backlog;
+   struct io_uring_cqe *cqes;
+   void *sq_ring, *cq_ring;
+   size_t sq_ring_len, cq_ring_len, sqes_len;
+};
+
+/*
+ * Sets up a ring, if the kernel supports everything the server needs.
+ * Params:
+ *    struct uring *ring: The ring to set up
+ *    unsigned entries: The size of the submission queue
+ * Returns:
+ *    int result: 0 on success, -1 with errno set if io_uring can't be used
+ */
+int uring_init(struct uring *, unsigned);
+
+/*
+ * Tears down a ring, abandoning requests still in flight.
+ * Params:
+ *    struct uring *ring: The ring to free
+ */
+void uring_free(struct uring *);
+
+/*
+ * Takes the next free submission queue entry, submitting queued ones first
+ *    if the queue is full. If the kernel takes none, because completions
+ *    have to be handled first, the entry waits in the backlog instead.
+ * Params:
+ *    struct uring *ring: The ring to queue a request on
+ * Returns:
+ *    struct io_uring_sqe *sqe: A zeroed entry, queued once this returns and
+ *       valid until the next request is queued
+ */
+struct io_uring_sqe *uring_sqe(struct uring *);
+
+/*
+ * Hands every queued request to the kernel in a single system call, the
+ *    backlog first. A signal cuts the wait short without submitting
+ *    anything, and so does a kernel that takes no more requests until the
+ *    completions waiting are handled.
+ * Params:
+ *    struct uring *ring: The ring to submit
+ *    unsigned wait: The number of completions to wait for
+ */
+void uring_submit(struct uring *, unsigned);
+
+/*
+ * Finds the oldest completion not yet seen.
+ * Params:
+ *    struct uring *ring: The ring to look at
+ * Returns:
+ *    struct io_uring_cqe *cqe: The completion, or NULL if there is none
+ */
+struct io_uring_cqe *uring_cqe(struct uring *);
+
+/*
+ * Gives the oldest completion back to the kernel after it was handled.
+ * Params:
+ *    struct uring *ring: The ring the completion came from
+ */
+void uring_cqe_seen(struct uring *);
+
+#endif
@@ -25,14 +25,39 @@
  */
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define DEFAULT_WORD_LEN 10
 
+static const char *mime_types[][2] = {
+   { ".html", "text/html" },
+   { ".htm",  "text/html" },
+   { ".css",  "text/css" },
+   { ".js",   "application/javascript" },
+   { ".json", "application/json" },
+   { ".txt",  "text/plain" },
+   { ".xml",  "application/xml" },
+   { ".svg",  "image/svg+xml" },
+   { ".png",  "image/png" },
+   { ".jpg",  "image/jpeg" },
+   { ".jpeg", "image/jpeg" },
+   { ".gif",  "image/gif" },
+   { ".ico",  "image/x-icon" },
+   { ".webp", "image/webp" },
+   { ".woff", "font/woff" },
+   { ".woff2", "font/woff2" },
+   { ".pdf",  "application/pdf" },
+   { ".mp4",  "video/mp4" }
+};
+
 void *safe_malloc(size_t size) {
    void *ptr = malloc(size);
    if (ptr == NULL) {
@@ -142,9 +167,12 @@ char *substring(char **input, char delimiter) {
    result = (char *) realloc(result, (length + 1) * sizeof(char));
    result[length] = '\0';
 
-   /* Remove the segment from the input */
-   output = (char *) malloc((strlen(*input) - length) * sizeof(char));
-   strcpy(output, &current[1]);
+   /* Remove the segment and its delimiter, if present, from the input */
+   if (*current != '\0') {
+      current++;
+   }
+   output = (char *) malloc((strlen(current) + 1) * sizeof(char));
+   strcpy(output, current);
    free(*input);
    *input = output;
 
@@ -163,3 +191,106 @@ void append_string(char **dest, char *src) {
    *dest = realloc(*dest, (dest_len + src_len + 1) * sizeof(char));
    strcpy(*dest + dest_len, src);
 }
+
+/*
+ * Switches a file descriptor to non-blocking mode.
+ * Params:
+ *    int fd: The file descriptor to be changed
+ * Returns:
+ *    int result: 0 on success, -1 on failure with errno set
+ */
+int set_nonblocking(int fd) {
+
+   int flags = fcntl(fd, F_GETFL, 0);
+
+   if (flags < 0) {
+      return -1;
+   }
+
+   return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+}
+
+/*
+ * Guesses the Content-Type of a file from the extension of its path.
+ * Params:
+ *    const char *path: The path of the file
+ * Returns:
+ *    const char *type: The media type, application/octet-stream if unknown
+ */
+const char *mime_type(const char *path) {
+
+   const char *extension = strrchr(path, '.');
+   size_t index;
+
+   if (extension == NULL || strchr(extension, '/') != NULL) {
+      return "application/octet-stream";
+   }
+
+   for (index = 0; index < sizeof(mime_types) / sizeof(mime_types[0]);
+      index++) {
+      if (strcasecmp(extension, mime_types[index][0]) == 0) {
+         return mime_types[index][1];
+      }
+   }
+
+   return "application/octet-stream";
+
+}
+
+/*
+ * Formats the strong entity tag of a file, which changes along with its
+ *    inode, size or modification time.
+ * Params:
+ *    char *etag: Filled with the quoted tag, ETAG_LEN in cache.h is enough
+ *    struct stat *info: The status of the file
+ */
+void format_etag(char *etag, struct stat *info) {
+
+   sprintf(etag, "\"%lx-%lx-%lx-%lx\"", (unsigned long) info->st_ino,
+      (unsigned long) info->st_size, (unsigned long) info->st_mtim.tv_sec,
+      (unsigned long) info->st_mtim.tv_nsec);
+
+}
+
+/*
+ * Formats a time the way HTTP dates are written, e.g.
+ *    Sun, 06 Nov 1994 08:49:37 GMT.
+ * Params:
+ *    char *date: Filled with the date, HTTP_DATE_LEN is always enough
+ *    size_t len: The room in date
+ *    time_t time: The time to format
+ */
+void format_http_date(char *date, size_t len, time_t time) {
+
+   struct tm parts;
+
+   gmtime_r(&time, &parts);
+   strftime(date, len, "%a, %d %b %Y %H:%M:%S GMT", &parts);
+
+}
+
+/*
+ * Reads an HTTP date in its preferred format.
+ * Params:
+ *    const char *date: The date to read
+ *    time_t *time: Filled with the time the date stands for
+ * Returns:
+ *    int result: 0 on success, -1 if the date is malformed
+ */
+int parse_http_date(const char *date, time_t *time) {
+
+   struct tm parts;
+   char *end;
+
+   memset(&parts, 0, sizeof(struct tm));
+   end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &parts);
+
+   if (end == NULL || *end != '\0') {
+      return -1;
+   }
+
+   *time = timegm(&parts);
+   return 0;
+
+}
@@ -27,7 +27,9 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "response.h"
@@ -37,6 +39,9 @@
 #define fork(void)          safe_fork()
 #define report_errno()  report_errno_with_data(__FILE__, __LINE__)
 
+/* Room for an HTTP date along with its '\0' */
+#define HTTP_DATE_LEN   32
+
 /*
  * Provides easy error reporting.
  * Params:
@@ -74,6 +79,53 @@ char *substring(char **, char);
  */
 void append_string(char **, char *);
 
+/*
+ * Switches a file descriptor to non-blocking mode.
+ * Params:
+ *    int fd: The file descriptor to be changed
+ * Returns:
+ *    int result: 0 on success, -1 on failure with errno set
+ */
+int set_nonblocking(int);
+
+/*
+ * Guesses the Content-Type of a file from the extension of its path.
+ * Params:
+ *    const char *path: The path of the file
+ * Returns:
+ *    const char *type: The media type, application/octet-stream if unknown
+ */
+const char *mime_type(const char *);
+
+/*
+ * Formats the strong entity tag of a file, which changes along with its
+ *    inode, size or modification time.
+ * Params:
+ *    char *etag: Filled with the quoted tag, ETAG_LEN in cache.h is enough
+ *    struct stat *info: The status of the file
+ */
+void format_etag(char *, struct stat *);
+
+/*
+ * Formats a time the way HTTP dates are written, e.g.
+ *    Sun, 06 Nov 1994 08:49:37 GMT.
+ * Params:
+ *    char *date: Filled with the date, HTTP_DATE_LEN is always enough
+ *    size_t len: The room in date
+ *    time_t time: The time to format
+ */
+void format_http_date(char *, size_t, time_t);
+
+/*
+ * Reads an HTTP date in its preferred format.
+ * Params:
+ *    const char *date: The date to read
+ *    time_t *time: Filled with the time the date stands for
+ * Returns:
+ *    int result: 0 on success, -1 if the date is malformed
+ */
+int parse_http_date(const char *, time_t *);
+
 void *safe_malloc(size_t);
 void *safe_realloc(void *, size_t);
 pid_t safe_fork();
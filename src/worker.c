@@ -0,0 +1,369 @@
+/*
+ * worker.c
+ * Runs the master process, which forks the workers serving requests and
+ *    respawns them when they die. Functions are prototyped in worker.h.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "worker.h"
+#include "util.h"
+
+/* Workers dying sooner than this after starting are respawned slowly */
+#define MIN_WORKER_LIFETIME 1
+
+/*
+ * A worker process, the server it serves and when it started. Workers told to
+ *    finish up serve no server, their index is -1.
+ */
+struct worker {
+   pid_t pid;
+   int index;
+   time_t started;
+};
+
+static volatile sig_atomic_t terminating = 0, hangup = 0, quitting = 0,
+   upgrading = 0;
+
+/* The signals the master handles, blocked but while it waits for them, and
+ * the mask it had before */
+static sigset_t watched, unwatched;
+
+/*
+ * Records that the master was asked to shut down.
+ * Params:
+ *    int signum: The signal received
+ */
+static void handle_terminate(int signum) {
+   terminating = 1;
+}
+
+/*
+ * Records that the master was asked to reload its settings.
+ * Params:
+ *    int signum: The signal received
+ */
+static void handle_hangup(int signum) {
+   hangup = 1;
+}
+
+/*
+ * Records that the master was asked to exit once its workers are done with
+ *    the requests they have.
+ * Params:
+ *    int signum: The signal received
+ */
+static void handle_quit(int signum) {
+   quitting = 1;
+}
+
+/*
+ * Wakes the master up when a worker exits.
+ * Params:
+ *    int signum: The signal received
+ */
+static void handle_child(int signum) {
+}
+
+/*
+ * Records that the master was asked to start an upgraded master.
+ * Params:
+ *    int signum: The signal received
+ */
+static void handle_upgrade(int signum) {
+   upgrading = 1;
+}
+
+/*
+ * Installs a handler for a signal without restarting interrupted calls.
+ * Params:
+ *    int signum: The signal to handle
+ *    void (*handler)(int): The function to call, or SIG_DFL
+ */
+static void set_signal_handler(int signum, void (*handler)(int)) {
+
+   struct sigaction action;
+
+   memset(&action, 0, sizeof(action));
+   action.sa_handler = handler;
+   sigemptyset(&action.sa_mask);
+
+   if (sigaction(signum, &action, NULL) < 0) {
+      report_errno();
+   }
+
+}
+
+/*
+ * Forks a worker process that serves requests on one of the servers.
+ * Params:
+ *    int index: The server the new worker serves
+ *    int slot: The slot the new worker keeps its metrics in
+ *    worker_main run: The request-handling loop of the worker
+ * Returns:
+ *    pid_t pid: The process id of the new worker
+ */
+static pid_t spawn_worker(int index, int slot, worker_main run) {
+
+   pid_t pid;
+   sigset_t mask;
+
+   /* Don't let the child inherit and repeat unflushed output */
+   fflush(stdout);
+   fflush(stderr);
+
+   /* The master's signals stay blocked until the child has dropped its
+    * handlers, or a worker signalled right after the fork would act as
+    * the master */
+   if ((pid = fork()) != 0) {
+      return pid;
+   }
+
+   set_signal_handler(SIGTERM, SIG_DFL);
+   set_signal_handler(SIGINT, SIG_DFL);
+   set_signal_handler(SIGHUP, SIG_IGN);
+   set_signal_handler(SIGQUIT, SIG_DFL);
+   set_signal_handler(SIGUSR2, SIG_IGN);
+   set_signal_handler(SIGCHLD, SIG_DFL);
+
+   /* Being told to finish up waits until the worker can handle it */
+   mask = unwatched;
+   sigaddset(&mask, SIGQUIT);
+   sigprocmask(SIG_SETMASK, &mask, NULL);
+
+   run(index, slot);
+   exit(EXIT_SUCCESS);
+
+}
+
+/*
+ * Starts a worker for every server that has none, each in a free slot. Servers
+ *    left without one wait for a finishing worker to exit.
+ * Params:
+ *    struct worker *workers: The workers, one for each slot
+ *    int slots: The number of slots
+ *    int count: The number of servers
+ *    worker_main run: The request-handling loop each worker runs
+ */
+static void start_workers(struct worker *workers, int slots, int count,
+   worker_main run) {
+
+   int index, slot;
+
+   for (index = 0; index < count; index++) {
+
+      for (slot = 0; slot < slots && (workers[slot].pid <= 0 ||
+         workers[slot].index != index); slot++);
+
+      if (slot < slots) {
+         continue;
+      }
+
+      for (slot = 0; slot < slots && workers[slot].pid > 0; slot++);
+
+      if (slot == slots) {
+         return;
+      }
+
+      workers[slot].pid = spawn_worker(index, slot, run);
+      workers[slot].index = index;
+      workers[slot].started = time(NULL);
+
+   }
+
+}
+
+/*
+ * Tells the workers of some servers to stop accepting connections, finish the
+ *    requests they have in flight and exit.
+ * Params:
+ *    struct worker *workers: The workers, one for each slot
+ *    int slots: The number of slots
+ *    int from: The first server whose worker finishes up
+ */
+static void retire_workers(struct worker *workers, int slots, int from) {
+
+   int slot;
+
+   for (slot = 0; slot < slots; slot++) {
+      if (workers[slot].pid > 0 && workers[slot].index >= from) {
+         kill(workers[slot].pid, SIGQUIT);
+         workers[slot].index = -1;
+      }
+   }
+
+}
+
+/*
+ * Forks one worker process per server and keeps them running, respawning any
+ *    worker that dies, until the master is asked to terminate. A hangup
+ *    reloads the settings: workers change them in place, or new workers take
+ *    over while the old ones finish the requests they have in flight.
+ * Params:
+ *    int count: The number of servers, one served by each worker
+ *    int slots: The most workers running or finishing at once
+ *    worker_main run: The request-handling loop each worker runs
+ *    worker_reload reload: Reloads the settings of the master
+ *    worker_upgrade upgrade: Starts a new master to take over
+ */
+void supervise_workers(int count, int slots, worker_main run,
+   worker_reload reload, worker_upgrade upgrade) {
+
+   struct worker *workers = malloc(slots * sizeof(struct worker));
+   pid_t pid;
+   int slot, status, running;
+
+   memset(workers, 0, slots * sizeof(struct worker));
+
+   /* Signals are only taken while waiting, so none arrives between looking
+    * at the flags and going to sleep */
+   sigemptyset(&watched);
+   sigaddset(&watched, SIGTERM);
+   sigaddset(&watched, SIGINT);
+   sigaddset(&watched, SIGHUP);
+   sigaddset(&watched, SIGQUIT);
+   sigaddset(&watched, SIGUSR2);
+   sigaddset(&watched, SIGCHLD);
+   sigprocmask(SIG_BLOCK, &watched, &unwatched);
+
+   set_signal_handler(SIGTERM, handle_terminate);
+   set_signal_handler(SIGINT, handle_terminate);
+   set_signal_handler(SIGHUP, handle_hangup);
+   set_signal_handler(SIGQUIT, handle_quit);
+   set_signal_handler(SIGUSR2, handle_upgrade);
+   set_signal_handler(SIGCHLD, handle_child);
+
+   start_workers(workers, slots, count, run);
+
+   printf("Master %d supervising %d workers\n\n", (int) getpid(), count);
+
+   /* Wait for workers to die, replacing them until told to stop */
+   while (!terminating) {
+
+      /* Quitting, no worker is started any more and the master exits once
+       * the last one is done */
+      if (quitting) {
+         hangup = upgrading = 0;
+         count = 0;
+         retire_workers(workers, slots, 0);
+         for (slot = 0, running = 0; slot < slots; slot++) {
+            running += workers[slot].pid > 0;
+         }
+         if (running == 0) {
+            break;
+         }
+      }
+
+      /* The new master is a child like the workers, though not one of them,
+       * and starts out with the signals it handles unblocked. This master
+       * keeps them blocked, so none comes in before the next wait */
+      if (upgrading) {
+         upgrading = 0;
+         upgrade(&unwatched);
+      }
+
+      /* Workers reread the settings and reopen their logs on a hangup, unless
+       * the new settings need new workers */
+      if (hangup) {
+         hangup = 0;
+         if (reload(&count) == RELOAD_RESTART) {
+            retire_workers(workers, slots, 0);
+         }
+         else {
+            retire_workers(workers, slots, count);
+            for (slot = 0; slot < slots; slot++) {
+               if (workers[slot].pid > 0 && workers[slot].index >= 0) {
+                  kill(workers[slot].pid, SIGHUP);
+               }
+            }
+         }
+         start_workers(workers, slots, count, run);
+      }
+
+      /* Sleep until a signal comes in if no worker has exited yet */
+      if ((pid = waitpid(-1, &status, WNOHANG)) <= 0) {
+         if (pid < 0 && errno != ECHILD) {
+            report_errno();
+         }
+         sigsuspend(&unwatched);
+         continue;
+      }
+
+      for (slot = 0; slot < slots && workers[slot].pid != pid; slot++);
+
+      if (slot == slots) {
+         fprintf(stderr, "Process %d exited with status %d\n", (int) pid,
+            WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+         continue;
+      }
+
+      /* Workers dying along with the master are not replaced */
+      workers[slot].pid = 0;
+      if (terminating) {
+         break;
+      }
+
+      /* Retired workers exiting make room for servers waiting on a slot */
+      if (workers[slot].index >= 0) {
+
+         fprintf(stderr, "Worker %d exited with status %d, respawning\n",
+            (int) pid, WIFEXITED(status) ? WEXITSTATUS(status)
+               : 128 + WTERMSIG(status));
+
+         /* Back off from workers that crash as soon as they start */
+         if (time(NULL) - workers[slot].started < MIN_WORKER_LIFETIME) {
+            sleep(MIN_WORKER_LIFETIME);
+         }
+
+      }
+
+      start_workers(workers, slots, count, run);
+
+   }
+
+   /* Pass the shutdown on to the workers, finishing ones too, and wait for
+    * all of them. An upgraded master keeps running */
+   for (slot = 0; slot < slots; slot++) {
+      if (workers[slot].pid > 0) {
+         kill(workers[slot].pid, SIGTERM);
+      }
+   }
+
+   for (slot = 0; slot < slots; slot++) {
+      while (workers[slot].pid > 0 &&
+         waitpid(workers[slot].pid, &status, 0) < 0 && errno == EINTR);
+   }
+
+   free(workers);
+   sigprocmask(SIG_SETMASK, &unwatched, NULL);
+
+}
@@ -0,0 +1,72 @@
+/*
+ * worker.h
+ * Makes available the master process that supervises the workers.
+ *
+ * Author:   Brandon M. Kelley
+ * Date:     May 8, 2016
+ * Version:  1.0
+ * License:  GNU GPL
+ * Copyright (C) 2016 Brandon M. Kelley
+ *
+ * This file is a part of WebC
+ *
+ * WebC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WebC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WebC.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <signal.h>
+
+/* What a reload of the settings asks of the running workers */
+#define RELOAD_IN_PLACE 0
+#define RELOAD_RESTART  1
+
+/*
+ * The request-handling loop of a worker, given the index of the server it
+ *    serves and the slot it keeps its metrics in. SIGQUIT asks the worker to
+ *    finish up, it is blocked until the worker unblocks it.
+ */
+typedef void (*worker_main)(int, int);
+
+/*
+ * Reloads the settings in the master, given the number of servers and
+ *    updating it, and returns one of the RELOAD_* values.
+ */
+typedef int (*worker_reload)(int *);
+
+/*
+ * Starts a new master from the server binary, handing it the listening
+ *    sockets. The new master starts with the signal mask given, as the
+ *    caller keeps its own signals blocked.
+ */
+typedef void (*worker_upgrade)(const sigset_t *);
+
+/*
+ * Forks one worker process per server and keeps them running, respawning any
+ *    worker that dies, until the master is asked to terminate. A hangup
+ *    reloads the settings: workers change them in place, or new workers take
+ *    over while the old ones finish the requests they have in flight.
+ *    SIGUSR2 upgrades the master, and SIGQUIT has the workers finish their
+ *    requests before the master exits.
+ * Params:
+ *    int count: The number of servers, one served by each worker
+ *    int slots: The most workers running or finishing at once
+ *    worker_main run: The request-handling loop each worker runs
+ *    worker_reload reload: Reloads the settings of the master
+ *    worker_upgrade upgrade: Starts a new master to take over
+ */
+void supervise_workers(int, int, worker_main, worker_reload, worker_upgrade);
+
+#endif